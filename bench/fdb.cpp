@@ -0,0 +1,55 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+//
+// Lookup rate of toybridge::fdb filled with a given number of random unicast addresses,
+// shared by a given number of threads that each perform every lookup.
+// Usage: fdb [entries (default: 1000000)] [lookups (default: 20000000)] [threads (default: 1)]
+#include <toybridge/fdb.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+
+int main(const int argc, const char** const argv)
+{
+    const std::size_t entries = argc > 1 ? std::strtoul(argv[1], nullptr, 0) : 1000000;
+    const std::size_t lookups = argc > 2 ? std::strtoul(argv[2], nullptr, 0) : 20000000;
+    const std::size_t threads = argc > 3 ? std::max(std::strtoul(argv[3], nullptr, 0), 1ul) : 1;
+
+    std::mt19937_64 rng(42);
+    std::vector<::u_char> macs(entries * ETH_ALEN);
+    for (std::size_t i = 0; i < entries; ++i) {
+        const srook::uint64_t r = rng();
+        std::copy_n(reinterpret_cast<const ::u_char*>(&r), ETH_ALEN, &macs[i * ETH_ALEN]);
+        macs[i * ETH_ALEN] &= 0xfe;
+    }
+
+    toybridge::fdb table(entries, 300);
+    for (std::size_t i = 0; i < entries; ++i) table.learn(&macs[i * ETH_ALEN], static_cast<toybridge::fdb::port_type>(i % 64), 1);
+
+    std::vector<srook::uint32_t> order(lookups);
+    std::uniform_int_distribution<srook::uint32_t> pick(0, static_cast<srook::uint32_t>(entries - 1));
+    std::generate(order.begin(), order.end(), [&] { return pick(rng); });
+
+    std::vector<std::size_t> hits(threads);
+    std::vector<std::thread> pool;
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t t = 0; t < threads; ++t) {
+        pool.emplace_back([&, t] {
+            std::size_t h = 0;
+            for (srook::uint32_t i : order) h += table.lookup(&macs[i * ETH_ALEN], 2) != toybridge::fdb::npos;
+            hits[t] = h;
+        });
+    }
+    for (std::thread& th : pool) th.join();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    const double total = double(lookups) * threads;
+
+    std::cout 
+        << "entries: " << table.size() << '/' << table.capacity() << '\n'
+        << "threads: " << threads << ", lookups: " << lookups << " each, hits: " << std::accumulate(hits.cbegin(), hits.cend(), std::size_t(0)) << '\n'
+        << "rate: " << total / elapsed.count() / 1e6 << " Mlookups/s" << std::endl;
+}
@@ -0,0 +1,106 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+//
+// The frames gen sends and sink counts: Ethernet, IPv4 and UDP to the discard port, then a
+// probe with a sequence number and the CLOCK_MONOTONIC time the frame was handed to the
+// socket. gen and sink run on the same host, so the difference is a one-way latency.
+#ifndef INCLUDED_TOYBRIDGE_BENCH_FRAME_HPP
+#define INCLUDED_TOYBRIDGE_BENCH_FRAME_HPP
+
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <time.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace bench {
+
+struct probe {
+    std::uint32_t magic;
+    std::uint32_t seq;
+    std::uint64_t timestamp;
+};
+
+constexpr std::uint32_t probe_magic = 0x5442424e; // "TBBN"
+constexpr std::uint16_t probe_port = 9;
+constexpr std::size_t header_size = sizeof(::ether_header) + sizeof(::iphdr) + sizeof(::udphdr);
+constexpr std::size_t min_frame = header_size + sizeof(probe);
+// Without the FCS, which the sockets never see.
+constexpr std::size_t max_frame = 9014;
+
+inline std::uint64_t now() noexcept
+{
+    ::timespec ts{};
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return std::uint64_t(ts.tv_sec) * 1000000000 + std::uint64_t(ts.tv_nsec);
+}
+
+inline bool parse_mac(const char* s, ::u_char* mac) noexcept
+{
+    unsigned int b[ETH_ALEN];
+    char tail;
+    if (std::sscanf(s, "%x:%x:%x:%x:%x:%x%c", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &tail) != ETH_ALEN) return false;
+    for (std::size_t i = 0; i < ETH_ALEN; ++i) {
+        if (b[i] > 0xff) return false;
+        mac[i] = static_cast<::u_char>(b[i]);
+    }
+    return true;
+}
+
+// A frame of size bytes from src to dst; the probe is left for the sender to fill in.
+inline std::vector<::u_char> make_frame(std::size_t size, const ::u_char* dst, const ::u_char* src, std::uint16_t sport)
+{
+    std::vector<::u_char> f(size);
+    ::ether_header eh{};
+    std::memcpy(eh.ether_dhost, dst, ETH_ALEN);
+    std::memcpy(eh.ether_shost, src, ETH_ALEN);
+    eh.ether_type = htons(ETHERTYPE_IP);
+    std::memcpy(&f[0], &eh, sizeof(eh));
+
+    ::iphdr ip{};
+    ip.version = 4;
+    ip.ihl = sizeof(ip) / 4;
+    ip.ttl = 64;
+    ip.protocol = IPPROTO_UDP;
+    ip.tot_len = htons(static_cast<std::uint16_t>(size - sizeof(eh)));
+    ip.saddr = htonl(0x0afe0001); // 10.254.0.1
+    ip.daddr = htonl(0x0afe0002);
+    std::uint32_t sum = 0;
+    const ::u_char* p = reinterpret_cast<const ::u_char*>(&ip);
+    for (std::size_t i = 0; i < sizeof(ip); i += 2) sum += std::uint32_t(p[i]) << 8 | p[i + 1];
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    ip.check = htons(static_cast<std::uint16_t>(~sum));
+    std::memcpy(&f[sizeof(eh)], &ip, sizeof(ip));
+
+    ::udphdr udp{};
+    udp.source = htons(sport);
+    udp.dest = htons(probe_port);
+    udp.len = htons(static_cast<std::uint16_t>(size - sizeof(eh) - sizeof(ip)));
+    std::memcpy(&f[sizeof(eh) + sizeof(ip)], &udp, sizeof(udp));
+    return f;
+}
+
+// The probe in a received frame, if it is one of ours. truncated is set when the frame is
+// shorter than its IP header says.
+inline bool read_probe(const ::u_char* f, std::size_t len, probe& pr, bool& truncated) noexcept
+{
+    if (len < min_frame) return false;
+    ::ether_header eh;
+    ::iphdr ip;
+    ::udphdr udp;
+    std::memcpy(&eh, f, sizeof(eh));
+    std::memcpy(&ip, f + sizeof(eh), sizeof(ip));
+    std::memcpy(&udp, f + sizeof(eh) + sizeof(ip), sizeof(udp));
+    if (eh.ether_type != htons(ETHERTYPE_IP) || ip.protocol != IPPROTO_UDP || udp.dest != htons(probe_port)) return false;
+    std::memcpy(&pr, f + header_size, sizeof(pr));
+    if (pr.magic != probe_magic) return false;
+    truncated = len < sizeof(eh) + ntohs(ip.tot_len);
+    return true;
+}
+
+} // namespace bench
+
+#endif
@@ -0,0 +1,148 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+//
+// Sends probe frames (see frame.hpp) out of one interface with sendmmsg(2) and prints
+// what it sent as JSON. Frame i comes from flow i % flows, each flow with a source address
+// and UDP source port of its own so that PACKET_FANOUT_HASH spreads them, and goes to
+// destination (i / flows) % destinations.
+// Usage: gen [options] <interface>
+//   -s <bytes>    frame size without the FCS (default: 64)
+//   -f <flows>    number of source addresses (default: 1)
+//   -d <mac,...>  destination addresses (default: ff:ff:ff:ff:ff:ff)
+//   -r <pps>      frames per second, 0 for as fast as possible (default: 0)
+//   -t <seconds>  how long to send (default: 5)
+//   -b <frames>   frames per sendmmsg (default: 64)
+//   -q <tpid>:<vid>  tag every frame, e.g. 0x88a8:100 for an 802.1ad service tag (default: untagged)
+#include "frame.hpp"
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main(const int argc, char** const argv)
+{
+    std::size_t size = 64, flows = 1, batch = 64;
+    unsigned long rate = 0;
+    double seconds = 5;
+    std::vector<std::vector<::u_char>> dsts;
+    // The tag goes between the addresses and the ethertype, as an iovec of its own.
+    ::u_char tag[4];
+    bool tagged = false;
+    for (int c; (c = ::getopt(argc, argv, "s:f:d:r:t:b:q:")) != -1;) {
+        switch (c) {
+            case 's': size = std::strtoul(optarg, nullptr, 0); break;
+            case 'f': flows = std::strtoul(optarg, nullptr, 0); break;
+            case 'r': rate = std::strtoul(optarg, nullptr, 0); break;
+            case 't': seconds = std::strtod(optarg, nullptr); break;
+            case 'b': batch = std::strtoul(optarg, nullptr, 0); break;
+            case 'q': {
+                int tpid, vid;
+                char tail;
+                if (std::sscanf(optarg, "%i:%i%c", &tpid, &vid, &tail) != 2 || tpid < 0 || tpid > 0xffff || vid < 0 || vid > 0xfff) {
+                    std::cerr << optarg << ": not a tag" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                tag[0] = ::u_char(tpid >> 8);
+                tag[1] = ::u_char(tpid);
+                tag[2] = ::u_char(vid >> 8);
+                tag[3] = ::u_char(vid);
+                tagged = true;
+                break;
+            }
+            case 'd':
+                for (char* tok = std::strtok(optarg, ","); tok; tok = std::strtok(nullptr, ",")) {
+                    dsts.emplace_back(ETH_ALEN);
+                    if (!bench::parse_mac(tok, dsts.back().data())) {
+                        std::cerr << tok << ": not a MAC address" << std::endl;
+                        return EXIT_FAILURE;
+                    }
+                }
+                break;
+            default: optind = argc + 1; break;
+        }
+    }
+    if (optind + 1 != argc || size < bench::min_frame || size > bench::max_frame || !flows || flows > 0xffff || !batch || seconds <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [-s bytes (" << bench::min_frame << '-' << bench::max_frame << ")] [-f flows] [-d mac,...] [-r pps] [-t seconds] [-b frames] [-q tpid:vid] <interface>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (dsts.empty()) dsts.emplace_back(ETH_ALEN, 0xff);
+    // Paced bursts stay short, so that they do not show up as queueing in the latency.
+    if (rate) batch = std::max<std::size_t>(1, std::min<std::size_t>(batch, rate / 10000));
+
+    const int soc = ::socket(AF_PACKET, SOCK_RAW, 0);
+    ::sockaddr_ll sll{};
+    sll.sll_family = AF_PACKET;
+    sll.sll_ifindex = static_cast<int>(::if_nametoindex(argv[optind]));
+    const int one = 1;
+    if (soc < 0 || !sll.sll_ifindex || ::bind(soc, reinterpret_cast<const ::sockaddr*>(&sll), sizeof(sll)) < 0) {
+        std::perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+    ::setsockopt(soc, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+
+    std::vector<std::vector<::u_char>> frames(batch);
+    std::vector<::iovec> iov(batch * 3);
+    std::vector<::mmsghdr> msgs(batch);
+    for (std::size_t b = 0; b < batch; ++b) {
+        frames[b] = bench::make_frame(size, dsts.front().data(), dsts.front().data(), 0);
+        ::iovec* v = &iov[b * 3];
+        if (tagged) {
+            v[0] = { frames[b].data(), 2 * ETH_ALEN };
+            v[1] = { tag, sizeof(tag) };
+            v[2] = { frames[b].data() + 2 * ETH_ALEN, size - 2 * ETH_ALEN };
+        } else {
+            v[0] = { frames[b].data(), size };
+        }
+        msgs[b] = {};
+        msgs[b].msg_hdr.msg_iov = v;
+        msgs[b].msg_hdr.msg_iovlen = tagged ? 3 : 1;
+    }
+
+    const std::uint64_t start = bench::now(), duration = std::uint64_t(seconds * 1e9);
+    std::uint64_t sent = 0, full = 0;
+    for (std::uint64_t t = start; t - start < duration; t = bench::now()) {
+        if (rate) {
+            const std::uint64_t due = start + sent * 1000000000 / rate;
+            if (due > t) {
+                const ::timespec ts = { ::time_t(due / 1000000000), long(due % 1000000000) };
+                ::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+            }
+        }
+        const std::uint64_t ts = bench::now();
+        for (std::size_t b = 0; b < batch; ++b) {
+            const std::uint64_t i = sent + b;
+            const std::uint16_t flow = static_cast<std::uint16_t>(i % flows);
+            ::u_char* f = frames[b].data();
+            std::memcpy(f, dsts[(i / flows) % dsts.size()].data(), ETH_ALEN);
+            const ::u_char src[ETH_ALEN] = { 0x02, 0, 0, 0, ::u_char(flow >> 8), ::u_char(flow) };
+            std::memcpy(f + ETH_ALEN, src, ETH_ALEN);
+            const std::uint16_t sport = htons(static_cast<std::uint16_t>(10000 + flow));
+            std::memcpy(f + bench::header_size - sizeof(::udphdr), &sport, sizeof(sport));
+            const bench::probe pr = { bench::probe_magic, static_cast<std::uint32_t>(i), ts };
+            std::memcpy(f + bench::header_size, &pr, sizeof(pr));
+        }
+        const int n = ::sendmmsg(soc, msgs.data(), static_cast<unsigned int>(batch), 0);
+        if (n < 0) {
+            if (errno != ENOBUFS && errno != EAGAIN) {
+                std::perror("sendmmsg");
+                return EXIT_FAILURE;
+            }
+            ++full;
+            ::sched_yield();
+            continue;
+        }
+        sent += std::uint64_t(n);
+    }
+    const double elapsed = double(bench::now() - start) / 1e9;
+    std::cout << "{\"interface\": \"" << argv[optind] << "\", \"size\": " << size << ", \"flows\": " << flows
+        << ", \"destinations\": " << dsts.size() << ", \"rate\": " << rate << ", \"sent\": " << sent
+        << ", \"seconds\": " << elapsed << ", \"pps\": " << double(sent) / elapsed << ", \"send_full\": " << full << '}' << std::endl;
+    ::close(soc);
+}
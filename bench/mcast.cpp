@@ -0,0 +1,196 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+//
+// Sends an IGMP or MLD message out of one interface, for snooping checks that need messages the
+// kernel does not send, such as ones behind an 802.1ad tag: a general query, or a report or leave
+// for one group in IGMPv2, IGMPv3, MLDv1 or MLDv2.
+// Usage: mcast [options] <interface> query|join|leave [<group>]
+//   -v <version>     igmp2, igmp3, mld1 or mld2 (default: igmp2)
+//   -q <tpid>:<vid>  tag the message, e.g. 0x88a8:100 for an 802.1ad service tag (default: untagged)
+//   -c <count>       how many times to send it (default: 1)
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+void put16(std::vector<::u_char>& f, std::size_t at, std::uint16_t v)
+{
+    f[at] = ::u_char(v >> 8);
+    f[at + 1] = ::u_char(v);
+}
+
+// The Internet checksum of len bytes at p, on top of sum.
+std::uint16_t checksum(const ::u_char* p, std::size_t len, std::uint32_t sum = 0)
+{
+    for (std::size_t i = 0; i + 1 < len; i += 2) sum += std::uint32_t(p[i]) << 8 | p[i + 1];
+    if (len & 1) sum += std::uint32_t(p[len - 1]) << 8;
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return static_cast<std::uint16_t>(~sum);
+}
+
+// IPv4 with the router alert option, as RFC 2236 and RFC 3376 ask for, around an IGMP message.
+std::vector<::u_char> igmp(const ::in_addr& dst, const std::vector<::u_char>& msg)
+{
+    std::vector<::u_char> f(ETH_HLEN + 24 + msg.size());
+    const std::uint32_t d = ntohl(dst.s_addr);
+    const ::u_char mac[ETH_ALEN] = { 0x01, 0x00, 0x5e, ::u_char((d >> 16) & 0x7f), ::u_char(d >> 8), ::u_char(d) };
+    std::memcpy(&f[0], mac, ETH_ALEN);
+    put16(f, 12, ETH_P_IP);
+    ::u_char* ip = &f[ETH_HLEN];
+    ip[0] = 0x46;
+    ip[1] = 0xc0;
+    put16(f, ETH_HLEN + 2, static_cast<std::uint16_t>(24 + msg.size()));
+    ip[8] = 1;
+    ip[9] = IPPROTO_IGMP;
+    std::memcpy(ip + 16, &dst, 4);
+    ip[20] = 0x94;
+    ip[21] = 4;
+    put16(f, ETH_HLEN + 10, checksum(ip, 24));
+    std::memcpy(ip + 24, msg.data(), msg.size());
+    put16(f, ETH_HLEN + 26, checksum(ip + 24, msg.size()));
+    return f;
+}
+
+// IPv6 from the unspecified address with a hop-by-hop router alert, as RFC 2710 and RFC 3810 ask
+// for, around an MLD message.
+std::vector<::u_char> mld(const ::in6_addr& dst, const std::vector<::u_char>& msg)
+{
+    std::vector<::u_char> f(ETH_HLEN + 40 + 8 + msg.size());
+    const ::u_char mac[ETH_ALEN] = { 0x33, 0x33, dst.s6_addr[12], dst.s6_addr[13], dst.s6_addr[14], dst.s6_addr[15] };
+    std::memcpy(&f[0], mac, ETH_ALEN);
+    put16(f, 12, ETH_P_IPV6);
+    ::u_char* ip = &f[ETH_HLEN];
+    ip[0] = 0x60;
+    put16(f, ETH_HLEN + 4, static_cast<std::uint16_t>(8 + msg.size()));
+    ip[6] = IPPROTO_HOPOPTS;
+    ip[7] = 1;
+    std::memcpy(ip + 24, &dst, 16);
+    const ::u_char hbh[8] = { IPPROTO_ICMPV6, 0, 5, 2, 0, 0, 1, 0 };
+    std::memcpy(ip + 40, hbh, sizeof(hbh));
+    ::u_char* icmp = ip + 48;
+    std::memcpy(icmp, msg.data(), msg.size());
+    // The pseudo-header: both addresses, the upper-layer length and the next header.
+    std::uint32_t sum = IPPROTO_ICMPV6 + std::uint32_t(msg.size());
+    for (std::size_t i = 8; i < 40; i += 2) sum += std::uint32_t(ip[i]) << 8 | ip[i + 1];
+    put16(f, ETH_HLEN + 50, checksum(icmp, msg.size(), sum));
+    return f;
+}
+
+} // namespace
+
+int main(const int argc, char** const argv)
+{
+    std::string version = "igmp2";
+    ::u_char tag[4];
+    bool tagged = false;
+    unsigned long count = 1;
+    for (int c; (c = ::getopt(argc, argv, "v:q:c:")) != -1;) {
+        switch (c) {
+            case 'v': version = optarg; break;
+            case 'c': count = std::strtoul(optarg, nullptr, 0); break;
+            case 'q': {
+                int tpid, vid;
+                char tail;
+                if (std::sscanf(optarg, "%i:%i%c", &tpid, &vid, &tail) != 2 || tpid < 0 || tpid > 0xffff || vid < 0 || vid > 0xfff) {
+                    std::cerr << optarg << ": not a tag" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                tag[0] = ::u_char(tpid >> 8);
+                tag[1] = ::u_char(tpid);
+                tag[2] = ::u_char(vid >> 8);
+                tag[3] = ::u_char(vid);
+                tagged = true;
+                break;
+            }
+            default: optind = argc + 1; break;
+        }
+    }
+    const bool v6 = version == "mld1" || version == "mld2", v2 = version == "igmp3" || version == "mld2";
+    const std::string what = optind + 1 < argc ? argv[optind + 1] : "";
+    const bool query = what == "query";
+    ::in_addr group4{};
+    ::in6_addr group6{};
+    if (optind + 2 + !query != argc || (!v6 && version != "igmp2" && version != "igmp3") || (!query && what != "join" && what != "leave") ||
+            (!query && !(v6 ? ::inet_pton(AF_INET6, argv[optind + 2], &group6) : ::inet_pton(AF_INET, argv[optind + 2], &group4)))) {
+        std::cerr << "Usage: " << argv[0] << " [-v igmp2|igmp3|mld1|mld2] [-q tpid:vid] [-c count] <interface> query|join|leave [<group>]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const bool join = what == "join";
+
+    std::vector<::u_char> msg, f;
+    if (!v6) {
+        ::in_addr dst{};
+        if (query) {
+            // A general query in the IGMPv2 format, which every version answers.
+            msg = { 0x11, 100, 0, 0, 0, 0, 0, 0 };
+            dst.s_addr = htonl(0xe0000001);
+        } else if (!v2) {
+            msg = { ::u_char(join ? 0x16 : 0x17), 0, 0, 0, 0, 0, 0, 0 };
+            std::memcpy(&msg[4], &group4, 4);
+            dst = join ? group4 : ::in_addr{ htonl(0xe0000002) };
+        } else {
+            // One record: a change to the exclude mode without sources joins, to the include mode leaves.
+            msg = { 0x22, 0, 0, 0, 0, 0, 0, 1, ::u_char(join ? 4 : 3), 0, 0, 0, 0, 0, 0, 0 };
+            std::memcpy(&msg[12], &group4, 4);
+            dst.s_addr = htonl(0xe0000016);
+        }
+        f = igmp(dst, msg);
+    } else {
+        ::in6_addr dst{};
+        dst.s6_addr[0] = 0xff;
+        dst.s6_addr[1] = 0x02;
+        if (query) {
+            msg.assign(24, 0);
+            msg[0] = 130;
+            msg[5] = 100;
+            dst.s6_addr[15] = 1;
+        } else if (!v2) {
+            msg.assign(24, 0);
+            msg[0] = join ? 131 : 132;
+            std::memcpy(&msg[8], &group6, 16);
+            if (join) dst = group6;
+            else dst.s6_addr[15] = 2;
+        } else {
+            msg.assign(28, 0);
+            msg[0] = 143;
+            msg[7] = 1;
+            msg[8] = join ? 4 : 3;
+            std::memcpy(&msg[12], &group6, 16);
+            dst.s6_addr[15] = 0x16;
+        }
+        f = mld(dst, msg);
+    }
+    if (f.size() < ETH_ZLEN) f.resize(ETH_ZLEN);
+
+    const int soc = ::socket(AF_PACKET, SOCK_RAW, 0);
+    ::sockaddr_ll sll{};
+    sll.sll_family = AF_PACKET;
+    sll.sll_ifindex = static_cast<int>(::if_nametoindex(argv[optind]));
+    ::ifreq ifr{};
+    std::strncpy(ifr.ifr_name, argv[optind], IFNAMSIZ - 1);
+    if (soc < 0 || !sll.sll_ifindex || ::bind(soc, reinterpret_cast<const ::sockaddr*>(&sll), sizeof(sll)) < 0 || ::ioctl(soc, SIOCGIFHWADDR, &ifr) < 0) {
+        std::perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+    std::memcpy(&f[ETH_ALEN], ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+    if (tagged) f.insert(f.begin() + 2 * ETH_ALEN, tag, tag + sizeof(tag));
+
+    for (unsigned long i = 0; i < count; ++i) {
+        if (::send(soc, f.data(), f.size(), 0) < 0) {
+            std::perror("send");
+            return EXIT_FAILURE;
+        }
+    }
+    ::close(soc);
+}
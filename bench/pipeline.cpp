@@ -0,0 +1,138 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+//
+// Cost per frame of the per-frame path (dump, admit, steer) of a bridge without VLANs, storm control,
+// logging or capturing, with snooping off and on: the pipeline specialised for what is in use
+// against the one with every stage, which tests for each per frame as the bridge used to. Frames
+// are unicast between learned hosts on the given number of ports, one in sixteen broadcast.
+// Counts user-space instructions per frame with perf_event_open(2) where hardware counters are
+// available, and nanoseconds per frame in any case.
+// Usage: pipeline [frames (default: 20000000)] [ports (default: 4)]
+#include <toybridge/detail/pipeline.hpp>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+// A counter of the instructions this thread retires in user space, or none.
+struct instructions {
+    instructions() : fd(-1)
+    {
+        ::perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    ~instructions()
+    {
+        if (fd >= 0) ::close(fd);
+    }
+
+    void start() const
+    {
+        if (fd < 0) return;
+        ::ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    srook::uint64_t stop() const
+    {
+        srook::uint64_t n = 0;
+        if (fd < 0) return n;
+        ::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        return ::read(fd, &n, sizeof(n)) == sizeof(n) ? n : 0;
+    }
+
+    int fd;
+};
+
+// Where the ports of every frame end up, so that none of the work is optimised away.
+volatile toybridge::port_mask consumed;
+
+struct frame {
+    std::size_t in;
+    ::u_char data[64];
+};
+
+template <unsigned Stages>
+void measure(const char* name, toybridge::detail::forwarding_tables& tables, std::vector<frame>& frames, std::size_t n, const instructions& counter)
+{
+    toybridge::detail::worker_stats stats(std::size_t(__builtin_popcountll(tables.ports)));
+    toybridge::detail::worker w;
+    w.stats = &stats;
+    w.now = 1;
+    const toybridge::detail::pipeline<Stages> p(tables);
+
+    toybridge::port_mask sink = 0;
+    counter.start();
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < n; ++i) {
+        frame& f = frames[i & (frames.size() - 1)];
+        ::u_char* data = f.data;
+        std::size_t len = sizeof(f.data);
+        sink ^= p.dump(w, f.in, data, len) && p.admit(w, f.in, data, len) ? p.steer(w, f.in, data, len) : 0;
+    }
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    const srook::uint64_t retired = counter.stop();
+
+    consumed = sink;
+    if (!name) return;
+    std::cout << name << ": " << elapsed.count() / double(n) << " ns/frame";
+    if (counter.fd >= 0) std::cout << ", " << double(retired) / double(n) << " instructions/frame";
+    std::cout << '\n';
+}
+
+} // namespace
+
+int main(const int argc, const char** const argv)
+{
+    namespace detail = toybridge::detail;
+    const std::size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 0) : 20000000;
+    const std::size_t ports = argc > 2 ? std::min(std::max(std::strtoul(argv[2], nullptr, 0), 2ul), std::size_t(toybridge::devinfo::max_devices)) : 4;
+    std::vector<std::string> devices;
+    for (std::size_t i = 0; i < ports; ++i) devices.push_back("p" + std::to_string(i));
+
+    // 256 hosts, host h behind port h % ports.
+    static const ::u_char broadcast[ETH_ALEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    std::mt19937_64 rng(42);
+    std::vector<frame> frames(4096);
+    for (frame& f : frames) {
+        const std::size_t src = rng() % 256, dst = rng() % 256;
+        f.in = src % ports;
+        std::memset(f.data, 0, sizeof(f.data));
+        const ::u_char s[ETH_ALEN] = { 0x02, 0, 0, 0, 0, static_cast<::u_char>(src) }, d[ETH_ALEN] = { 0x02, 0, 0, 0, 0, static_cast<::u_char>(dst) };
+        std::memcpy(f.data, rng() % 16 ? d : broadcast, ETH_ALEN);
+        std::memcpy(f.data + ETH_ALEN, s, ETH_ALEN);
+        f.data[12] = 0x08;
+    }
+
+    const instructions counter;
+    if (counter.fd < 0) std::cout << "no hardware instruction counter, timing only\n";
+    for (std::size_t groups : { 0, 1024 }) {
+        toybridge::options opts;
+        opts.mdb_size = groups;
+        detail::forwarding_tables tables(opts, devices);
+        measure<detail::stage::all>(nullptr, tables, frames, frames.size(), counter);
+        if (groups) {
+            measure<detail::stage::snoop>("snooping, specialised", tables, frames, n, counter);
+        } else {
+            measure<0>("plain, specialised", tables, frames, n, counter);
+        }
+        measure<detail::stage::all>(groups ? "snooping, every stage" : "plain, every stage", tables, frames, n, counter);
+    }
+}
@@ -0,0 +1,175 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+//
+// Rate of a worker's recvmmsg(2) datapath over AF_UNIX datagram socket pairs, one per port, and
+// whether it allocates. Broadcast frames from the peer of port 0 are received into the worker's
+// frame_pool by its mmsg_batch and go through the per-frame pipeline, which floods them to every
+// other port and hands every n-th of them to a capture_ring by reference. Odd ports send them
+// with sendmmsg(2); even ports queue them by reference on their egress_queue as a busy port does,
+// and drain the queue into the socket. Another thread drains the capture ring and thereby gives
+// those frames back. Every heap allocation after the warm-up is counted, and the program fails
+// unless there was none and every frame went back to the pool in the end.
+// Usage: pool [frames (default: 2000000)] [ports (default: 4)] [capture every n-th (default: 4)]
+#include <toybridge/detail/pipeline.hpp>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::atomic<std::size_t> allocations(0);
+
+} // namespace
+
+// Out of line, so that the compiler does not take malloc and free for a mismatched new and delete.
+__attribute__((noinline)) void* operator new(std::size_t n)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+int main(const int argc, const char** const argv)
+{
+    namespace detail = toybridge::detail;
+    const std::size_t frames = argc > 1 ? std::strtoul(argv[1], nullptr, 0) : 2000000;
+    const std::size_t ports = argc > 2 ? std::min(std::max(std::strtoul(argv[2], nullptr, 0), 2ul), std::size_t(toybridge::devinfo::max_devices)) : 4;
+    const std::size_t every = argc > 3 ? std::max(std::strtoul(argv[3], nullptr, 0), 1ul) : 4;
+    constexpr std::size_t batch = 32, frame_size = 1518, size = 256, warmup = 1 << 16;
+
+    // The bridge's end of port k is socks[k], the other end peers[k].
+    std::vector<int> socks(ports), peers(ports);
+    std::vector<std::string> devices;
+    for (std::size_t k = 0; k < ports; ++k) {
+        int sp[2];
+        if (::socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, sp) < 0) {
+            std::perror("socketpair");
+            return EXIT_FAILURE;
+        }
+        socks[k] = sp[0];
+        peers[k] = sp[1];
+        devices.push_back("p" + std::to_string(k));
+    }
+
+    toybridge::options opts;
+    opts.mdb_size = 0;
+    opts.capture.sample = every;
+    detail::forwarding_tables tables(opts, devices);
+    const detail::pipeline<detail::stage::capture> p(tables);
+
+    detail::capture_ring capture(1 << 12, 128);
+    std::atomic<bool> running(true);
+    std::size_t captured = 0;
+    std::thread writer([&] {
+        while (running.load(std::memory_order_acquire)) {
+            const std::size_t n = capture.drain([](const detail::capture_ring::slot&, const ::u_char*) {});
+            if (!n) std::this_thread::yield();
+            captured += n;
+        }
+        captured += capture.drain([](const detail::capture_ring::slot&, const ::u_char*) {});
+    });
+
+    detail::worker_stats stats(ports);
+    detail::worker w;
+    w.stats = &stats;
+    w.now = 1;
+    w.capture = &capture;
+    w.pool.reset(new detail::frame_pool(frame_size));
+    if (!*w.pool) return EXIT_FAILURE;
+    w.batch = srook::make_optional(detail::mmsg_batch(batch, frame_size));
+    w.batch->use(w.pool.get());
+    w.egress.assign(ports, detail::egress_queue(detail::egress_config()));
+
+    // Broadcasts from 256 hosts behind port 0, and room for what the other ports' peers take in.
+    std::vector<::u_char> in(256 * size), out(batch * size);
+    std::vector<::iovec> in_iov(batch), out_iov(batch);
+    std::vector<::mmsghdr> in_msgs(batch), out_msgs(batch);
+    for (std::size_t h = 0; h < 256; ++h) {
+        ::u_char* f = &in[h * size];
+        std::memset(f, 0xff, ETH_ALEN);
+        const ::u_char src[ETH_ALEN] = { 0x02, 0, 0, 0, 0, static_cast<::u_char>(h) };
+        std::memcpy(f + ETH_ALEN, src, ETH_ALEN);
+        f[12] = 0x08;
+    }
+    for (std::size_t b = 0; b < batch; ++b) {
+        in_iov[b].iov_len = size;
+        in_msgs[b].msg_hdr.msg_iov = &in_iov[b];
+        in_msgs[b].msg_hdr.msg_iovlen = 1;
+        out_iov[b].iov_base = &out[b * size];
+        out_iov[b].iov_len = size;
+        out_msgs[b].msg_hdr.msg_iov = &out_iov[b];
+        out_msgs[b].msg_hdr.msg_iovlen = 1;
+    }
+
+    std::size_t received = 0, delivered = 0, before = 0, next = 0;
+    bool measuring = false;
+    std::chrono::steady_clock::time_point start;
+    while (received < warmup + frames) {
+        if (!measuring && received >= warmup) {
+            measuring = true;
+            before = allocations.load();
+            start = std::chrono::steady_clock::now();
+        }
+        for (std::size_t b = 0; b < batch; ++b) in_iov[b].iov_base = &in[(next++ & 255) * size];
+        if (::sendmmsg(peers[0], in_msgs.data(), batch, 0) < 0 && errno != EAGAIN) {
+            std::perror("sendmmsg");
+            return EXIT_FAILURE;
+        }
+
+        // What bridge::handle does with a batch, with every odd port taking frames and every even one busy.
+        const srook::optional<int> n = w.batch->recv(socks[0]);
+        if (!n) {
+            std::perror("recvmmsg");
+            return EXIT_FAILURE;
+        }
+        received += std::size_t(*n);
+        toybridge::port_mask route = w.batch->select([&w, &p](::u_char*& data, std::size_t& s, const detail::frame_ref& f) -> toybridge::port_mask {
+            return p.dump(w, 0, data, s) && p.admit(w, 0, data, s) ? p.steer(w, 0, data, s, &f) : 0;
+        });
+        for (std::size_t j = 0; route; ++j, route >>= 1) {
+            if (!(route & 1) || !w.batch->gather(j, [&j, &p](const ::u_char* data) { return p.untagged(j, data); })) continue;
+            if (j % 2) {
+                w.batch->send(socks[j]);
+                continue;
+            }
+            detail::egress_queue& q = w.egress[j];
+            w.batch->for_each_selected([&q](::u_char* data, std::size_t s, const detail::frame_ref& f) {
+                if (f) q.push(f, detail::traffic_class(data, s));
+            });
+            q.drain([&socks, j](detail::frame_ref& f) { return ::write(socks[j], f.data(), f.size()) > 0; });
+        }
+        for (std::size_t j = 1; j < ports; ++j) {
+            for (int m; (m = ::recvmmsg(peers[j], out_msgs.data(), batch, MSG_DONTWAIT, nullptr)) > 0;) delivered += std::size_t(m);
+        }
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    const std::size_t allocated = allocations.load() - before;
+    running = false;
+    writer.join();
+
+    const std::size_t size_of_pool = w.pool->size();
+    w.batch = srook::nullopt;
+    w.egress.clear();
+    const std::size_t available = w.pool->available();
+    std::cout
+        << "pool: " << size_of_pool << " frames of " << w.pool->capacity() << " bytes, " << available << " free at the end\n"
+        << "frames: " << received << " in, " << delivered << " out over " << ports - 1 << " ports, captured: " << captured << '\n'
+        << "rate: " << double(frames) / elapsed.count() / 1e6 << " Mframes/s\n"
+        << "allocations after warm-up: " << allocated << std::endl;
+    for (std::size_t k = 0; k < ports; ++k) {
+        ::close(socks[k]);
+        ::close(peers[k]);
+    }
+    return allocated || available != size_of_pool ? EXIT_FAILURE : EXIT_SUCCESS;
+}
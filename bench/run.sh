@@ -0,0 +1,121 @@
+#!/bin/sh
+# Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#
+# Runs the bridge between network namespaces over a matrix of datapath modes, worker counts,
+# port counts and frame sizes, and prints one JSON object per run as a JSON array. Port 0 is
+# the generator's, every other port has a sink behind it, and the generator sends to the
+# sinks' addresses in turn once the bridge has learned them. Needs root and `make bench`.
+# Usage: bench/run.sh [options]
+#   -m <modes>    name=bridge arguments, separated by ';' (default: "read=;mmsg=-m;ring=-r -t")
+#   -w <workers>  worker counts (default: 1)
+#   -p <ports>    port counts, at least 2 (default: "2 3 4")
+#   -s <sizes>    frame sizes without the FCS (default: "64 128 256 512 1024 1514 9014")
+#   -f <flows>    generator flows (default: 64)
+#   -r <pps>      generator rate, 0 for as fast as possible (default: 0)
+#   -t <seconds>  how long each run sends (default: 3)
+set -eu
+
+modes='read=;mmsg=-m;ring=-r -t'
+workers=1
+ports='2 3 4'
+sizes='64 128 256 512 1024 1514 9014'
+flows=64
+rate=0
+seconds=3
+while getopts m:w:p:s:f:r:t: opt; do
+    case $opt in
+        m) modes=$OPTARG ;;
+        w) workers=$OPTARG ;;
+        p) ports=$OPTARG ;;
+        s) sizes=$OPTARG ;;
+        f) flows=$OPTARG ;;
+        r) rate=$OPTARG ;;
+        t) seconds=$OPTARG ;;
+        *) sed -n 's/^# \{0,1\}//; 8,15p' "$0" >&2; exit 1 ;;
+    esac
+done
+
+dst=$(cd "$(dirname "$0")/.." && pwd)/dst
+for exe in main.o gen.o sink.o; do
+    [ -x "$dst/$exe" ] || { echo "$dst/$exe is missing: run make && make bench" >&2; exit 1; }
+done
+tmp=$(mktemp -d)
+max=0
+for p in $ports; do
+    [ "$p" -ge 2 ] || { echo "a bridge needs at least 2 ports" >&2; exit 1; }
+    if [ "$p" -gt "$max" ]; then max=$p; fi
+done
+
+cleanup() {
+    for k in $(seq 0 $((max - 1))); do
+        ip link del tbb$k 2>/dev/null || true
+        ip netns del tbb$k 2>/dev/null || true
+    done
+    rm -rf "$tmp"
+}
+trap cleanup EXIT INT TERM
+
+# Port k is the veth tbb<k>, whose peer eth0 sits in the namespace tbb<k>. The MTU leaves
+# room for jumbo frames; IPv6 is off so that nothing but probes crosses the bridge.
+for k in $(seq 0 $((max - 1))); do
+    ip netns add tbb$k
+    ip link add tbb$k mtu 9100 type veth peer name eth0 mtu 9100 netns tbb$k
+    sysctl -qw net.ipv6.conf.tbb$k.disable_ipv6=1 || true
+    ip netns exec tbb$k sysctl -qw net.ipv6.conf.eth0.disable_ipv6=1 || true
+    ip link set tbb$k up
+    ip -n tbb$k link set eth0 up
+done
+
+echo '['
+first=1
+set -f
+IFS=';'
+for m in $modes; do
+    unset IFS
+    mode=${m%%=*}
+    args=${m#*=}
+    [ -n "$mode" ] || continue
+    for w in $workers; do
+        for p in $ports; do
+            for size in $sizes; do
+                ifs=
+                sinks=
+                macs=
+                for k in $(seq 0 $((p - 1))); do
+                    ifs="$ifs tbb$k"
+                    [ "$k" -eq 0 ] && continue
+                    mac=$(printf '02:00:00:00:01:%02x' "$k")
+                    sinks="$sinks tbb$k/eth0@$mac"
+                    macs="$macs${macs:+,}$mac"
+                done
+                echo "$mode, $w workers, $p ports, $size bytes" >&2
+
+                # shellcheck disable=SC2086
+                "$dst/main.o" -w "$w" $args $ifs >"$tmp/bridge.log" 2>&1 &
+                bridge=$!
+                sleep 1
+                # shellcheck disable=SC2086
+                "$dst/sink.o" -t $((seconds + 10)) $sinks >"$tmp/sink.json" &
+                sink=$!
+                sleep 0.5
+                ip netns exec tbb0 "$dst/gen.o" -s "$size" -f "$flows" -d "$macs" -r "$rate" -t "$seconds" eth0 >"$tmp/gen.json"
+                wait $sink
+                kill -INT $bridge
+                wait $bridge || echo "bridge exited with $?: $(cat "$tmp/bridge.log")" >&2
+
+                sent=$(sed -n 's/.*"sent": \([0-9]*\).*/\1/p' "$tmp/gen.json")
+                received=$(sed -n 's/.*"received": \([0-9]*\), "bytes".*/\1/p' "$tmp/sink.json")
+                truncated=$(sed -n 's/.*"truncated": \([0-9]*\).*/\1/p' "$tmp/sink.json")
+                # Truncated frames were not delivered as sent, so they count as dropped.
+                drop=$(awk -v s="$sent" -v r="$received" -v t="$truncated" 'BEGIN { printf "%.6f", s ? 1 - (r - t) / s : 0 }')
+
+                [ "$first" -eq 1 ] || echo ','
+                first=0
+                printf '{"mode": "%s", "bridge_args": "%s", "workers": %s, "ports": %s, "size": %s, "drop_rate": %s,\n "generator": %s,\n "sink": %s}' \
+                    "$mode" "$args" "$w" "$p" "$size" "$drop" "$(cat "$tmp/gen.json")" "$(cat "$tmp/sink.json")"
+            done
+        done
+    done
+done
+echo
+echo ']'
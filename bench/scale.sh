@@ -0,0 +1,54 @@
+#!/bin/sh
+# Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#
+# Measures how forwarding scales with --workers over veth: runs bench/run.sh for 1 up to the
+# given number of workers on 2 ports with many flows, and prints the sink's rate at each worker
+# count with its speedup over one worker as JSON. Fails when the speedup at the largest count
+# is below the given share of linear. Exits with 77 without measuring when the host has too few
+# CPUs for the workers and the generator to run on cores of their own. Needs root and `make bench`.
+# Usage: bench/scale.sh [options]
+#   -m <mode>     bridge arguments besides -w (default: -m)
+#   -n <workers>  largest worker count (default: 4)
+#   -s <size>     frame size without the FCS (default: 64)
+#   -f <flows>    generator flows (default: 256)
+#   -e <share>    least speedup at the largest count, as a share of linear (default: 0.75)
+#   -t <seconds>  how long each run sends (default: 5)
+set -eu
+
+mode=-m
+max=4
+size=64
+flows=256
+share=0.75
+seconds=5
+while getopts m:n:s:f:e:t: opt; do
+    case $opt in
+        m) mode=$OPTARG ;;
+        n) max=$OPTARG ;;
+        s) size=$OPTARG ;;
+        f) flows=$OPTARG ;;
+        e) share=$OPTARG ;;
+        t) seconds=$OPTARG ;;
+        *) sed -n 's/^# \{0,1\}//; 9,15p' "$0" >&2; exit 1 ;;
+    esac
+done
+
+cpus=$(nproc)
+if [ "$cpus" -le "$max" ]; then
+    echo "{\"cpus\": $cpus, \"workers\": $max, \"skipped\": \"needs $((max + 1)) CPUs, one per worker and one for the generator\"}"
+    exit 77
+fi
+
+here=$(cd "$(dirname "$0")" && pwd)
+"$here/run.sh" -m "scale=$mode" -w "$(seq -s ' ' 1 "$max")" -p 2 -s "$size" -f "$flows" -t "$seconds" |
+awk -v cpus="$cpus" -v share="$share" -v mode="$mode" '
+    /"workers": / { sub(/.*"workers": /, ""); sub(/,.*/, ""); w = $0 }
+    /"sink": / { sub(/.*"mpps": /, ""); sub(/,.*/, ""); mpps[w] = $0; n = w }
+    END {
+        if (!n || mpps[1] <= 0) { print "no traffic got through" > "/dev/stderr"; exit 1 }
+        printf "{\"mode\": \"%s\", \"cpus\": %d, \"runs\": [", mode, cpus
+        for (k = 1; k <= n; ++k) printf "%s{\"workers\": %d, \"mpps\": %s, \"speedup\": %.3f}", (k > 1 ? ", " : ""), k, mpps[k], mpps[k] / mpps[1]
+        efficiency = mpps[n] / mpps[1] / n
+        printf "], \"efficiency\": %.3f, \"linear\": %s}\n", efficiency, (efficiency >= share ? "true" : "false")
+        exit efficiency < share
+    }'
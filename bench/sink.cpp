@@ -0,0 +1,220 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+//
+// Counts the probe frames (see frame.hpp) that arrive on one or more interfaces and prints
+// the throughput and one-way latency they saw as JSON. An interface may sit in a named
+// network namespace, and may announce an address first so that the bridge learns it there.
+// Usage: sink [options] [<netns>/]<interface>[@<mac>] ...
+//   -t <seconds>  give up after this long (default: 10)
+//   -i <ms>       stop once nothing has arrived for this long after the first probe (default: 1000)
+#include "frame.hpp"
+#include <fcntl.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Latencies with 64 sub-buckets per power of two, about 1.5% apart.
+class latency_histogram {
+public:
+    latency_histogram() : counts_(128 + 57 * 64), n_(0), max_(0) {}
+
+    void add(std::uint64_t v) noexcept
+    {
+        ++counts_[index(v)];
+        ++n_;
+        max_ = std::max(max_, v);
+    }
+
+    std::uint64_t percentile(double p) const noexcept
+    {
+        if (!n_) return 0;
+        const std::uint64_t rank = std::max<std::uint64_t>(1, std::uint64_t(p * double(n_) + 0.5));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < counts_.size(); ++i) {
+            if ((seen += counts_[i]) >= rank) return std::min(value(i), max_);
+        }
+        return max_;
+    }
+
+    std::uint64_t max() const noexcept { return max_; }
+private:
+    static std::size_t index(std::uint64_t v) noexcept
+    {
+        if (v < 128) return std::size_t(v);
+        const unsigned int e = 63 - unsigned(__builtin_clzll(v));
+        return 128 + (e - 7) * 64 + std::size_t((v >> (e - 6)) & 63);
+    }
+
+    // The upper end of bucket i.
+    static std::uint64_t value(std::size_t i) noexcept
+    {
+        if (i < 128) return i;
+        const unsigned int e = unsigned(i - 128) / 64 + 7;
+        return ((64 + std::uint64_t((i - 128) % 64) + 1) << (e - 6)) - 1;
+    }
+
+    std::vector<std::uint64_t> counts_;
+    std::uint64_t n_, max_;
+};
+
+struct port {
+    std::string name;
+    int soc;
+    std::uint64_t received, bytes, truncated;
+};
+
+// A packet socket bound to ifname in the network namespace netns, or in our own when it is empty.
+int open_port(const std::string& netns, const std::string& ifname)
+{
+    const int self = ::open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+    int ns = -1, soc = -1;
+    if (!netns.empty()) {
+        ns = ::open(("/var/run/netns/" + netns).c_str(), O_RDONLY | O_CLOEXEC);
+        if (ns < 0 || ::setns(ns, CLONE_NEWNET) < 0) {
+            std::perror(netns.c_str());
+            return -1;
+        }
+    }
+    soc = ::socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK, htons(ETH_P_IP));
+    ::sockaddr_ll sll{};
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_IP);
+    sll.sll_ifindex = static_cast<int>(::if_nametoindex(ifname.c_str()));
+    if (soc < 0 || !sll.sll_ifindex || ::bind(soc, reinterpret_cast<const ::sockaddr*>(&sll), sizeof(sll)) < 0) {
+        std::perror(ifname.c_str());
+        if (soc >= 0) ::close(soc);
+        soc = -1;
+    }
+    if (ns >= 0) {
+        ::setns(self, CLONE_NEWNET);
+        ::close(ns);
+    }
+    ::close(self);
+    return soc;
+}
+
+// A few broadcast frames from mac, so that every bridge on the way learns where it lives.
+void announce(int soc, const ::u_char* mac)
+{
+    ::u_char f[60] = {};
+    std::fill_n(f, ETH_ALEN, 0xff);
+    std::memcpy(f + ETH_ALEN, mac, ETH_ALEN);
+    f[12] = 0x88;
+    f[13] = 0xb5; // local experimental ethertype
+    for (int i = 0; i < 3; ++i) {
+        if (::send(soc, f, sizeof(f), 0) < 0) std::perror("send");
+    }
+}
+
+} // namespace
+
+int main(const int argc, char** const argv)
+{
+    double timeout = 10;
+    unsigned long idle_ms = 1000;
+    for (int c; (c = ::getopt(argc, argv, "t:i:")) != -1;) {
+        switch (c) {
+            case 't': timeout = std::strtod(optarg, nullptr); break;
+            case 'i': idle_ms = std::strtoul(optarg, nullptr, 0); break;
+            default: optind = argc + 1; break;
+        }
+    }
+    if (optind >= argc) {
+        std::cerr << "Usage: " << argv[0] << " [-t seconds] [-i ms] [<netns>/]<interface>[@<mac>] ..." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<port> ports;
+    std::vector<::pollfd> fds;
+    for (int a = optind; a < argc; ++a) {
+        std::string arg = argv[a], netns, mac;
+        const std::size_t at = arg.find('@');
+        if (at != std::string::npos) {
+            mac = arg.substr(at + 1);
+            arg.resize(at);
+        }
+        const std::size_t slash = arg.find('/');
+        if (slash != std::string::npos) {
+            netns = arg.substr(0, slash);
+            arg.erase(0, slash + 1);
+        }
+        const int soc = open_port(netns, arg);
+        if (soc < 0) return EXIT_FAILURE;
+        if (!mac.empty()) {
+            ::u_char addr[ETH_ALEN];
+            if (!bench::parse_mac(mac.c_str(), addr)) {
+                std::cerr << mac << ": not a MAC address" << std::endl;
+                return EXIT_FAILURE;
+            }
+            announce(soc, addr);
+        }
+        ports.push_back({ arg, soc, 0, 0, 0 });
+        fds.push_back({ soc, POLLIN, 0 });
+    }
+
+    constexpr std::size_t batch = 64;
+    std::vector<std::vector<::u_char>> bufs(batch, std::vector<::u_char>(bench::max_frame));
+    std::vector<::iovec> iov(batch);
+    std::vector<::mmsghdr> msgs(batch);
+    for (std::size_t b = 0; b < batch; ++b) iov[b] = { bufs[b].data(), bufs[b].size() };
+
+    latency_histogram latency;
+    const std::uint64_t start = bench::now();
+    std::uint64_t first = 0, last = 0;
+    for (;;) {
+        const std::uint64_t t = bench::now();
+        if (double(t - start) / 1e9 >= timeout || (first && t - last >= idle_ms * 1000000)) break;
+        if (::poll(fds.data(), fds.size(), 100) <= 0) continue;
+        for (std::size_t k = 0; k < ports.size(); ++k) {
+            if (!fds[k].revents) continue;
+            for (;;) {
+                for (std::size_t b = 0; b < batch; ++b) {
+                    msgs[b] = {};
+                    msgs[b].msg_hdr.msg_iov = &iov[b];
+                    msgs[b].msg_hdr.msg_iovlen = 1;
+                }
+                const int n = ::recvmmsg(ports[k].soc, msgs.data(), batch, MSG_DONTWAIT, nullptr);
+                if (n <= 0) break;
+                const std::uint64_t at = bench::now();
+                for (int b = 0; b < n; ++b) {
+                    bench::probe pr;
+                    bool truncated;
+                    if (!bench::read_probe(bufs[b].data(), msgs[b].msg_len, pr, truncated)) continue;
+                    ++ports[k].received;
+                    ports[k].bytes += msgs[b].msg_len;
+                    ports[k].truncated += truncated;
+                    latency.add(at > pr.timestamp ? at - pr.timestamp : 0);
+                    if (!first) first = at;
+                    last = at;
+                }
+            }
+        }
+    }
+
+    std::uint64_t received = 0, bytes = 0, truncated = 0;
+    std::cout << "{\"ports\": [";
+    for (std::size_t k = 0; k < ports.size(); ++k) {
+        received += ports[k].received;
+        bytes += ports[k].bytes;
+        truncated += ports[k].truncated;
+        std::cout << (k ? ", " : "") << "{\"interface\": \"" << ports[k].name << "\", \"received\": " << ports[k].received << '}';
+        ::close(ports[k].soc);
+    }
+    // From the first probe to the last; a single probe counts as taking no time at all.
+    const double seconds = last > first ? double(last - first) / 1e9 : 0;
+    std::cout << "], \"received\": " << received << ", \"bytes\": " << bytes << ", \"truncated\": " << truncated
+        << ", \"seconds\": " << seconds << ", \"mpps\": " << (seconds ? double(received) / seconds / 1e6 : 0)
+        << ", \"gbps\": " << (seconds ? double(bytes) * 8 / seconds / 1e9 : 0)
+        << ", \"latency_ns\": {\"p50\": " << latency.percentile(0.5) << ", \"p99\": " << latency.percentile(0.99)
+        << ", \"p999\": " << latency.percentile(0.999) << ", \"max\": " << latency.max() << "}}" << std::endl;
+}
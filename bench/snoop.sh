@@ -0,0 +1,188 @@
+#!/bin/sh
+# Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#
+# Checks IGMP and MLD snooping end to end, once for each of the given protocol versions. The
+# generator behind port 0 sends to a group and to a group nobody joins, with a sink behind each
+# of ports 1 to 3, while the kernel of the namespace behind port 1 joins and leaves the group and
+# that behind port 2 joins it and falls silent. A Linux bridge behind port 0 is the querier once
+# it is brought up. Until then, both groups must be flooded. After that, the group must reach
+# port 1 only while it listens, and port 2 only until its membership ages out; the unknown group
+# must reach none of them. The 802.1ad case makes every port a trunk of VLANs 100 and 200 and
+# sends everything behind a service tag, the messages from `mcast.o`: once a query came in on
+# VLAN 100, a report and a leave of each version there must be snooped, while VLAN 200, which has
+# no querier, still floods. Prints one JSON object per check and fails when any of them does not
+# hold. Needs root and `make bench`.
+# Usage: bench/snoop.sh [options]
+#   -v <versions>  protocol versions and 802.1ad (default: "igmp2 igmp3 mld1 mld2 802.1ad")
+#   -a <args>      further bridge arguments (default: none)
+#   -g <seconds>   --mdb-aging of the bridge, which has to outlast the leave check (default: 10)
+set -eu
+
+versions='igmp2 igmp3 mld1 mld2 802.1ad'
+args=
+aging=10
+while getopts v:a:g: opt; do
+    case $opt in
+        v) versions=$OPTARG ;;
+        a) args=$OPTARG ;;
+        g) aging=$OPTARG ;;
+        *) sed -n 's/^# \{0,1\}//; 15,18p' "$0" >&2; exit 1 ;;
+    esac
+done
+
+dst=$(cd "$(dirname "$0")/.." && pwd)/dst
+for exe in main.o gen.o sink.o mcast.o; do
+    [ -x "$dst/$exe" ] || { echo "$dst/$exe is missing: run make && make bench" >&2; exit 1; }
+done
+tmp=$(mktemp -d)
+bridge=
+
+cleanup() {
+    [ -z "$bridge" ] || kill -INT "$bridge" 2>/dev/null || true
+    for k in 0 1 2 3; do
+        ip link del tbs$k 2>/dev/null || true
+        ip netns del tbs$k 2>/dev/null || true
+    done
+    rm -rf "$tmp"
+}
+trap cleanup EXIT INT TERM
+
+# Port k is the veth tbs<k>, whose peer eth0 sits in the namespace tbs<k>. The listeners repeat
+# their unsolicited reports after 100 ms rather than seconds, so that they are done by the time
+# the group is sent to, and skip DAD, so that MLD goes out from a link-local address at once.
+for k in 0 1 2 3; do
+    ip netns add tbs$k
+    ip link add tbs$k type veth peer name eth0 netns tbs$k
+    sysctl -qw net.ipv6.conf.tbs$k.disable_ipv6=1 || true
+    for s in net.ipv4.conf.eth0.igmpv2_unsolicited_report_interval net.ipv4.conf.eth0.igmpv3_unsolicited_report_interval \
+            net.ipv6.conf.eth0.mldv1_unsolicited_report_interval net.ipv6.conf.eth0.mldv2_unsolicited_report_interval; do
+        ip netns exec tbs$k sysctl -qw $s=100
+    done
+    ip netns exec tbs$k sysctl -qw net.ipv6.conf.eth0.accept_dad=0
+    ip -n tbs$k addr add 10.0.9.$((k + 1))/24 dev eth0
+    ip link set tbs$k up
+    ip -n tbs$k link set eth0 up
+done
+
+failed=0
+
+# Sends to the MAC address $3 from port 0, with the generator arguments in $5 if any, and checks
+# that every port in $4 and no other one of ports 1 to 3 received all of it; $1 and $2 name the
+# version and the check.
+expect() {
+    pids=
+    for k in 1 2 3; do
+        "$dst/sink.o" -t 2 tbs$k/eth0 >"$tmp/sink$k.json" &
+        pids="$pids $!"
+    done
+    sleep 0.3
+    # shellcheck disable=SC2086
+    ip netns exec tbs0 "$dst/gen.o" -r 1000 -t 0.5 -d "$3" ${5:-} eth0 >"$tmp/gen.json"
+    # shellcheck disable=SC2086
+    wait $pids
+    sent=$(sed -n 's/.*"sent": \([0-9]*\).*/\1/p' "$tmp/gen.json")
+    got=
+    ok=true
+    for k in 1 2 3; do
+        n=$(sed -n 's/.*"received": \([0-9]*\), "bytes".*/\1/p' "$tmp/sink$k.json")
+        want=0
+        case " $4 " in *" $k "*) want=$sent ;; esac
+        [ "${n:-x}" = "$want" ] || ok=false
+        got="$got${got:+, }${n:-null}"
+    done
+    [ "$ok" = true ] || failed=1
+    printf '{"version": "%s", "check": "%s", "group": "%s", "sent": %s, "received": [%s], "listeners": [%s], "ok": %s}\n' \
+        "$1" "$2" "$3" "${sent:-0}" "$got" "$(echo $4 | sed 's/ /, /g')" "$ok"
+}
+
+# Stops the bridge, and fails when it does not exit cleanly.
+stop() {
+    kill -INT $bridge
+    status=0
+    wait $bridge || status=$?
+    bridge=
+    if [ "$status" -ne 0 ]; then
+        failed=1
+        echo "bridge exited with $status: $(cat "$tmp/bridge.log")" >&2
+    fi
+}
+
+# The group and its MAC address for a version.
+group_of() {
+    case $1 in
+        igmp*) group=239.1.1.1; mac=01:00:5e:01:01:01 ;;
+        mld*) group=ff0e::1:1; mac=33:33:00:01:00:01 ;;
+    esac
+}
+
+stag() {
+    trunks=
+    for k in 0 1 2 3; do trunks="$trunks --trunk tbs$k=100,200"; done
+    # shellcheck disable=SC2086
+    "$dst/main.o" -q $args --mdb-size 16 --mdb-aging "$aging" $trunks tbs0 tbs1 tbs2 tbs3 >"$tmp/bridge.log" 2>&1 &
+    bridge=$!
+    sleep 1
+    expect 802.1ad "no querier" 01:00:5e:01:01:01 "1 2 3" "-q 0x88a8:100"
+    ip netns exec tbs0 "$dst/mcast.o" -q 0x88a8:100 eth0 query
+    sleep 0.5
+    expect 802.1ad "unknown group" 01:00:5e:01:01:02 "" "-q 0x88a8:100"
+    expect 802.1ad "no querier in VLAN 200" 01:00:5e:01:01:02 "1 2 3" "-q 0x88a8:200"
+    for m in igmp2 igmp3 mld1 mld2; do
+        group_of $m
+        ip netns exec tbs1 "$dst/mcast.o" -v $m -q 0x88a8:100 eth0 join $group
+        sleep 0.5
+        expect "802.1ad $m" "join" "$mac" "1" "-q 0x88a8:100"
+        ip netns exec tbs1 "$dst/mcast.o" -v $m -q 0x88a8:100 eth0 leave $group
+        sleep 3
+        expect "802.1ad $m" "leave" "$mac" "" "-q 0x88a8:100"
+    done
+    stop
+}
+
+for v in $versions; do
+    if [ "$v" = 802.1ad ]; then
+        echo "$v" >&2
+        stag
+        continue
+    fi
+    case $v in
+        igmp[23]) group=239.1.1.1/32; mac=01:00:5e:01:01:01; unknown=01:00:5e:01:01:02; force=net.ipv4.conf.eth0.force_igmp_version=${v#igmp} ;;
+        mld[12]) group=ff0e::1:1/128; mac=33:33:00:01:00:01; unknown=33:33:00:01:00:02; force=net.ipv6.conf.eth0.force_mld_version=${v#mld} ;;
+        *) echo "$v: not one of igmp2, igmp3, mld1, mld2 and 802.1ad" >&2; exit 1 ;;
+    esac
+    for k in 1 2; do ip netns exec tbs$k sysctl -qw "$force"; done
+    echo "$v" >&2
+
+    # shellcheck disable=SC2086
+    "$dst/main.o" -q $args --mdb-size 16 --mdb-aging "$aging" tbs0 tbs1 tbs2 tbs3 >"$tmp/bridge.log" 2>&1 &
+    bridge=$!
+    sleep 1
+    expect "$v" "no querier" "$mac" "1 2 3"
+    expect "$v" "no querier, unknown group" "$unknown" "1 2 3"
+
+    ip -n tbs0 link add br0 type bridge mcast_snooping 1 mcast_querier 1 mcast_startup_query_interval 100
+    ip -n tbs0 link set eth0 master br0
+    ip -n tbs0 link set br0 up
+    sleep 1
+    expect "$v" "unknown group" "$unknown" ""
+    ip -n tbs1 addr add "$group" dev eth0 autojoin
+    sleep 1
+    expect "$v" "join" "$mac" "1"
+
+    # A leave shortens the listener's timer to the last member time of 2 seconds, well before
+    # the membership would have aged out.
+    ip -n tbs1 addr del "$group" dev eth0
+    sleep 3
+    expect "$v" "leave" "$mac" ""
+
+    ip -n tbs2 addr add "$group" dev eth0 autojoin
+    sleep 1
+    expect "$v" "second join" "$mac" "2"
+    sleep $((aging + 1))
+    expect "$v" "aged out" "$mac" ""
+
+    stop
+    ip -n tbs2 addr del "$group" dev eth0
+    ip -n tbs0 link del br0
+done
+exit $failed
@@ -0,0 +1,44 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+//
+// Cost per frame of storm control: a given number of threads police 64-byte broadcast frames
+// coming in on one port against a frame and a bit rate limit they all share, as fast as they can.
+// Reports the time per frame and how many frames a second got through against the limit.
+// Usage: storm [frames (default: 50000000)] [threads (default: 1)] [pps (default: 1000000)]
+#include <toybridge/detail/storm.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+int main(const int argc, const char** const argv)
+{
+    const std::size_t frames = argc > 1 ? std::strtoul(argv[1], nullptr, 0) : 50000000;
+    const std::size_t threads = argc > 2 ? std::max(std::strtoul(argv[2], nullptr, 0), 1ul) : 1;
+    const std::size_t pps = argc > 3 ? std::max(std::strtoul(argv[3], nullptr, 0), 1ul) : 1000000;
+
+    toybridge::storm_config cfg;
+    if (!cfg.parse("p0=broadcast:" + std::to_string(pps) + "pps,broadcast:" + std::to_string(pps * 64 * 8) + "bps", std::cerr)) return EXIT_FAILURE;
+    toybridge::detail::storm_control storm(cfg, { "p0" });
+
+    std::vector<std::size_t> passed(threads);
+    std::vector<std::thread> pool;
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t t = 0; t < threads; ++t) {
+        pool.emplace_back([&, t] {
+            std::size_t n = 0;
+            for (std::size_t i = 0; i < frames; ++i) n += storm.admit(0, toybridge::storm_config::broadcast, 64);
+            passed[t] = n;
+        });
+    }
+    for (std::thread& th : pool) th.join();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    const double total = double(frames) * threads, admitted = double(std::accumulate(passed.cbegin(), passed.cend(), std::size_t(0)));
+
+    std::cout
+        << "threads: " << threads << ", frames: " << frames << " each, limit: " << pps << " pps\n"
+        << "cost: " << elapsed.count() * 1e9 * threads / total << " ns/frame\n"
+        << "passed: " << admitted / elapsed.count() << " frames/s (" << admitted << " of " << total << ")" << std::endl;
+}
@@ -0,0 +1,93 @@
+#!/bin/sh
+# Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#
+# Checks that frames with an 802.1ad service tag are admitted in the VLAN of that tag, in each
+# of the given datapath modes. The generator behind port 0 broadcasts frames with an 802.1ad tag,
+# which the veth takes off and the bridge puts back, and sinks sit behind port 1, an access port
+# of VLAN 1, and port 2, one of the tag's VLAN. While port 0 is an access port of VLAN 1, nothing
+# may get through; once it is one of the tag's VLAN, every frame must reach port 2 and none
+# port 1. Fails when a run delivers otherwise or the bridge does not exit cleanly. Needs root
+# and `make bench`.
+# Usage: bench/vlan.sh [options]
+#   -m <modes>    name=bridge arguments, separated by ';' (default: "read=;mmsg=-m;ring=-r")
+#   -v <vid>      VID of the service tag (default: 100)
+#   -n <frames>   frames each run sends (default: 1000)
+set -eu
+
+modes='read=;mmsg=-m;ring=-r'
+vid=100
+frames=1000
+while getopts m:v:n: opt; do
+    case $opt in
+        m) modes=$OPTARG ;;
+        v) vid=$OPTARG ;;
+        n) frames=$OPTARG ;;
+        *) sed -n 's/^# \{0,1\}//; 11,14p' "$0" >&2; exit 1 ;;
+    esac
+done
+
+dst=$(cd "$(dirname "$0")/.." && pwd)/dst
+for exe in main.o gen.o sink.o; do
+    [ -x "$dst/$exe" ] || { echo "$dst/$exe is missing: run make && make bench" >&2; exit 1; }
+done
+tmp=$(mktemp -d)
+
+cleanup() {
+    for k in 0 1 2; do
+        ip link del tbv$k 2>/dev/null || true
+        ip netns del tbv$k 2>/dev/null || true
+    done
+    rm -rf "$tmp"
+}
+trap cleanup EXIT INT TERM
+
+# Port k is the veth tbv<k>, whose peer eth0 sits in the namespace tbv<k>.
+for k in 0 1 2; do
+    ip netns add tbv$k
+    ip link add tbv$k type veth peer name eth0 netns tbv$k
+    sysctl -qw net.ipv6.conf.tbv$k.disable_ipv6=1 || true
+    ip netns exec tbv$k sysctl -qw net.ipv6.conf.eth0.disable_ipv6=1 || true
+    ip link set tbv$k up
+    ip -n tbv$k link set eth0 up
+done
+
+failed=0
+set -f
+IFS=';'
+for m in $modes; do
+    unset IFS
+    mode=${m%%=*}
+    args=${m#*=}
+    [ -n "$mode" ] || continue
+    for port0 in 1 "$vid"; do
+        # shellcheck disable=SC2086
+        "$dst/main.o" $args --access tbv0="$port0" --access tbv1=1 --access tbv2="$vid" tbv0 tbv1 tbv2 >"$tmp/bridge.log" 2>&1 &
+        bridge=$!
+        sleep 1
+        "$dst/sink.o" -t 4 tbv1/eth0 >"$tmp/sink1.json" &
+        sink1=$!
+        "$dst/sink.o" -t 4 tbv2/eth0 >"$tmp/sink2.json" &
+        sink2=$!
+        sleep 0.5
+        ip netns exec tbv0 "$dst/gen.o" -r "$frames" -t 1 -q 0x88a8:"$vid" eth0 >"$tmp/gen.json"
+        wait $sink1 $sink2
+        kill -INT $bridge
+        status=0
+        wait $bridge || status=$?
+
+        sent=$(sed -n 's/.*"sent": \([0-9]*\).*/\1/p' "$tmp/gen.json")
+        got1=$(sed -n 's/.*"received": \([0-9]*\), "bytes".*/\1/p' "$tmp/sink1.json")
+        got2=$(sed -n 's/.*"received": \([0-9]*\), "bytes".*/\1/p' "$tmp/sink2.json")
+        want2=0
+        [ "$port0" -eq "$vid" ] && want2=$sent
+        ok=true
+        if [ "$status" -ne 0 ] || [ "${got1:-x}" != 0 ] || [ "${got2:-x}" != "$want2" ]; then
+            ok=false
+            failed=1
+            echo "bridge exited with $status: $(cat "$tmp/bridge.log")" >&2
+        fi
+        printf '{"mode": "%s", "port0_vid": %s, "sent": %s, "port1": %s, "port2": %s, "ok": %s}\n' \
+            "$mode" "$port0" "${sent:-0}" "${got1:-0}" "${got2:-0}" "$ok"
+    done
+done
+exit $failed
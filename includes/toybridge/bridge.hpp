@@ -3,21 +3,45 @@
 #define INCLUDED_TOYBRIDGE_BRIDGE_HPP
 
 #include <toybridge/devinfo.hpp>
+#include <toybridge/fdb.hpp>
+#include <toybridge/options.hpp>
+#include <toybridge/packet_filter.hpp>
+#include <toybridge/detail/event.hpp>
 #include <toybridge/detail/init.hpp>
+#include <toybridge/detail/log.hpp>
+#include <toybridge/detail/mmsg.hpp>
 #include <toybridge/detail/out.hpp>
+#include <toybridge/detail/pcapng.hpp>
+#include <toybridge/detail/pipeline.hpp>
+#include <toybridge/detail/ring.hpp>
+#include <toybridge/detail/timestamp.hpp>
+#include <toybridge/detail/vlan.hpp>
+#include <toybridge/detail/worker.hpp>
 #include <srook/algorithm/for_each.hpp>
 #include <srook/process/perror.hpp>
 #include <srook/scope/unique_resource.hpp>
-#include <srook/array.hpp>
 #include <srook/type_traits/disjunction.hpp>
 #include <srook/type_traits/is_invocable.hpp>
 #include <srook/type_traits/decay.hpp>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <stdarg.h>
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <memory>
+#include <thread>
 #include <fstream>
 #include <string>
+#include <vector>
+
+#ifndef MCL_ONFAULT
+#   define MCL_ONFAULT 4
+#endif
 
 namespace toybridge {
 SROOK_INLINE_NAMESPACE(v1)
@@ -25,89 +49,838 @@ SROOK_INLINE_NAMESPACE(v1)
 class bridge {
 public:
     SROOK_FORCE_INLINE bridge(const devinfo& di, srook::uint32_t filter = ETH_P_ALL, bool is_promiscous = true, bool is_verbose = false)
-        :bridged_(false), verbose_(srook::move(is_verbose)),
-        sock1_(detail::init(get<0>(di), filter, is_promiscous)), 
-        sock2_(detail::init(get<1>(di), filter, is_promiscous))
+        : bridge(di, make_options(filter, is_promiscous, is_verbose))
     {}
 
+    SROOK_FORCE_INLINE bridge(const devinfo& di, const options& opts)
+        : bridged_(false), verbose_(opts.verbose), pin_(opts.workers > 1 || opts.busy_poll || !opts.cpus.empty()), workers_(opts.workers ? opts.workers : 1),
+        owns_wakeup_(opts.wakeup_fd < 0), wakeup_(owns_wakeup_ ? detail::eventfd() : srook::make_optional(opts.wakeup_fd)),
+        log_file_(opts.log_file), log_ring_(opts.log_ring), port_names_(names(di)), stats_path_(opts.stats_path),
+        vnet_hdr_(0), frame_size_(0), busy_poll_(opts.busy_poll), cpus_(opts.cpus), lock_memory_(opts.lock_memory || opts.busy_poll),
+        hugepages_(opts.hugepages || opts.busy_poll), tags_(false), tables_(opts, port_names_)
+    {
+        const bool stamps = opts.timestamps || opts.busy_poll;
+        stats_.reserve(workers_.size());
+        for (detail::worker& w : workers_) {
+            stats_.emplace_back(new detail::worker_stats(di.size()));
+            w.stats = stats_.back().get();
+        }
+        if (tables_.vlans) {
+            if (opts.xdp || opts.uring || opts.rx_ring || opts.tx_ring || opts.vnet_hdr) {
+                std::cerr << "vlan: needs read(2) or recvmmsg(2) on every port, not using rings, xdp, uring or vnet-hdr" << std::endl;
+            }
+        }
+        if (opts.vnet_hdr && !tables_.vlans && (opts.xdp || opts.uring || opts.rx_ring || opts.tx_ring)) {
+            std::cerr << "vnet-hdr: needs read(2) or recvmmsg(2) on every port, not using it" << std::endl;
+        } else if (opts.vnet_hdr && !tables_.vlans) {
+            vnet_hdr_ = detail::vnet_hdr_size;
+        }
+        // The egress queues classify frames by their tag, which the kernel may have taken off.
+        tags_ = tables_.vlans || (opts.egress.depth && !opts.tx_ring && !vnet_hdr_);
+        if (opts.xdp && !tables_.vlans) {
+            if (!opts.rules.empty()) {
+                std::cerr << "xdp: filter rules need AF_PACKET, not using AF_XDP" << std::endl;
+            } else if (open_xdp(opts)) {
+                if (stamps) std::cerr << "timestamps: AF_XDP frames carry none, not measuring transit latency" << std::endl;
+                return;
+            } else {
+                std::cerr << "xdp: AF_XDP is not available, falling back to AF_PACKET" << std::endl;
+            }
+        }
+
+        const srook::optional<std::vector<::sock_filter>> prog = opts.rules.empty() ? srook::nullopt : opts.rules.compile();
+        if (!opts.rules.empty() && !prog) std::cerr << "filter: a rule is too long to compile" << std::endl;
+        std::vector<srook::optional<srook::uint16_t>> groups(di.size());
+        for (detail::worker& w : workers_) {
+            w.socks.reserve(di.size());
+            w.rings = std::vector<srook::optional<detail::packet_rings>>(di.size());
+            for (std::size_t i = 0; i < di.size(); ++i) {
+                w.socks.push_back(detail::init(di[i], opts.filter, opts.promiscuous, vnet_hdr_ != 0, busy_poll_) >>= detail::nonblock);
+                if (!opts.rules.empty()) {
+                    w.socks[i] = w.socks[i] >>= [&prog](int soc) { return prog ? detail::attach_filter(soc, *prog) : (::close(soc), srook::nullopt); };
+                }
+                if (workers_.size() > 1) w.socks[i] = w.socks[i] >>= [this, i, &w, &opts, &groups](int soc) { return join_fanout(w, soc, opts.fanout, groups[i]); };
+                if (tags_) w.socks[i] = w.socks[i] >>= detail::auxdata;
+                if (stamps) w.socks[i] = w.socks[i] >>= detail::timestamping;
+            }
+        }
+        frame_size_ = max_frame(di);
+        if (opts.uring && !tables_.vlans && busy_poll_) {
+            std::cerr << "busy-poll: spins on the sockets themselves, not using uring" << std::endl;
+        } else if (opts.uring && !tables_.vlans) {
+            if (open_uring()) {
+                if (stamps) std::cerr << "timestamps: io_uring receives carry none, not measuring transit latency" << std::endl;
+                return;
+            }
+            std::cerr << "uring: io_uring is not available, falling back to epoll" << std::endl;
+        }
+        for (detail::worker& w : workers_) {
+            for (std::size_t i = 0; i < di.size(); ++i) {
+                if ((opts.rx_ring || opts.tx_ring) && !tables_.vlans) map_rings(w.socks[i], w.rings[i], opts, frame_size_, tags_);
+            }
+            if (opts.egress.depth) w.egress.assign(di.size(), detail::egress_queue(opts.egress));
+            if (opts.mmsg) w.batch = srook::make_optional(detail::mmsg_batch(opts.batch_size, frame_size_));
+            if (w.batch && tags_) w.batch->restore_tags();
+            if (w.batch && stamps) w.batch->keep_timestamps();
+            w.timestamps = stamps;
+        }
+    }
+
+    SROOK_FORCE_INLINE ~bridge()
+    {
+        if (owns_wakeup_ && wakeup_) ::close(*wakeup_);
+    }
+
+    // Makes run() return as soon as every worker has seen the wakeup. Safe to call from any
+    // thread and from a signal handler; writing to options::wakeup_fd has the same effect.
+    SROOK_FORCE_INLINE void stop() const SROOK_NOEXCEPT_TRUE
+    {
+        if (!wakeup_) return;
+        const srook::uint64_t one = 1;
+        SROOK_ATTRIBUTE_UNUSED const ::ssize_t n = ::write(*wakeup_, &one, sizeof(one));
+    }
+
     SROOK_FORCE_INLINE bool flip_verbose() SROOK_NOEXCEPT_TRUE
     {
         verbose_ = !verbose_;
         return !bridged_;
     }
 
+    // The number of frames dropped because the egress PACKET_TX_RING had no free slot.
+    SROOK_FORCE_INLINE srook::uint64_t tx_ring_drops() const SROOK_NOEXCEPT_TRUE
+    {
+        srook::uint64_t drops = 0;
+        for (const detail::worker& w : workers_) {
+            for (const srook::optional<detail::packet_rings>& rings : w.rings) drops += rings && rings->tx() ? rings->tx()->full_drops() : 0;
+        }
+        return drops;
+    }
+
+    SROOK_FORCE_INLINE std::ostream& report(std::ostream& os) const
+    {
+        const detail::worker& w = workers_.front();
+        if (!w.rings.empty() && w.rings.front() && w.rings.front()->tx()) os << "tx ring full drops: " << tx_ring_drops() << '\n';
+        for (std::size_t k = 0; k < workers_.size(); ++k) {
+            if (!workers_[k].batch) continue;
+            if (workers_.size() > 1) os << "worker " << k << ": ";
+            workers_[k].batch->report(os);
+        }
+        if (log_ && log_->drops()) os << "log records dropped: " << log_->drops() << '\n';
+        if (capture_ && capture_->drops()) os << "captured frames dropped: " << capture_->drops() << '\n';
+        if (w.timestamps) {
+            srook::uint64_t frames = 0;
+            for (const std::unique_ptr<detail::worker_stats>& s : stats_) {
+                for (const detail::counter& c : s->transit.counts) frames += c.get();
+            }
+            os << "transit latency of " << frames << " frames:";
+            for (double q : detail::transit_quantiles) os << " p" << q * 100 << ' ' << detail::percentile(stats_, &detail::worker_stats::transit, q) << " ns";
+            os << '\n';
+        }
+        return os;
+    }
+
     SROOK_FORCE_INLINE bool run(std::ostream& os)
     {
         bridged_ = true;
         ipfwd_config ipfwd;
 
         return bool(ipfwd.disable() >> [&]() -> srook::optional<int> {
-            register_signal();
-            return sock1_ >>= [&ipfwd, &os, this](int soc1) -> srook::optional<int> {
-                return (sock2_ >>= [&os, &soc1, this](int soc2) -> srook::optional<int> {
-                    SROOK_ATTRIBUTE_UNUSED const auto rs1 = srook::scope::make_unique_resource(soc1, ::close);
-                    SROOK_ATTRIBUTE_UNUSED const auto rs2 = srook::scope::make_unique_resource(soc2, ::close);
-
-                    srook::array<int, std::tuple_size<devinfo>::value> socks { soc1, soc2 };
-                    srook::array<::pollfd, std::tuple_size<devinfo>::value> targets;
-                    srook::algorithm::for_each(srook::algorithm::make_counter(socks), [&targets](int s, std::size_t i) { 
-                        targets[i].fd = std::move(s);
-                        targets[i].events = POLLIN | POLLERR;
-                    });
+            if (!wakeup_) return srook::nullopt;
+            ignore_signals();
+
+            // SIGINT, SIGTERM and SIGQUIT are only ever read from a signalfd by worker 0. They are
+            // blocked before any worker thread is started, so that every one of them inherits the mask.
+            ::sigset_t mask, old;
+            ::sigemptyset(&mask);
+            ::sigaddset(&mask, SIGINT);
+            ::sigaddset(&mask, SIGTERM);
+            ::sigaddset(&mask, SIGQUIT);
+            ::pthread_sigmask(SIG_BLOCK, &mask, &old);
+            SROOK_ATTRIBUTE_UNUSED const auto rm = srook::scope::make_unique_resource(&old, [](::sigset_t* m) { ::pthread_sigmask(SIG_SETMASK, m, nullptr); });
 
-                    ::u_char buf[1 << 11]{};
-                    SROOK_CONSTEXPR_OR_CONST int timeout = 100;
-                    for (int nready = ::poll(targets.data(), targets.size(), timeout); 
-                            !end; 
-                            nready = ::poll(targets.data(), targets.size(), timeout)) {
-                        switch (nready) {
-                            case -1:
-                                if (errno != EINTR) {
-                                    srook::process::perror("poll");
-                                    return srook::nullopt;
-                                }
-                                break;
-                            case 0:
-                                break;
-                            default: {
-                                bool bt = false;
-                                srook::algorithm::for_each(srook::algorithm::make_counter(targets), [&bt, &buf, &socks, &os, this](const ::pollfd& t, std::size_t i) {
-                                    if (t.revents & (POLLIN | POLLERR)) {
-                                        srook::optional<int> ops = io(::read, socks[i], buf, sizeof(buf));
-                                        if (!ops) {
-                                            bt = true;
-                                            srook::process::perror("read");
-                                            return;
-                                        }
-                                        ops = ops >>= [&bt, &buf, &i, &socks, &os, this](int s) -> srook::optional<int> {
-                                            if (detail::dump(os, i, buf, s, verbose_)) {
-                                                if (!io(::write, socks[!i], buf, s)) { // TODO: This implementation allow only two devices.
-                                                    bt = true;
-                                                    srook::process::perror("write");
-                                                    return srook::nullopt;
-                                                }
-                                            }
-                                            return { s };
-                                        };
-                                        if (!ops) return; 
-                                    }
-                                });
-                            }
+            return (detail::signalfd(mask) >>= [&os, this](int sig) -> srook::optional<int> {
+                SROOK_ATTRIBUTE_UNUSED const auto rsig = srook::scope::make_unique_resource(sig, ::close);
+                return sockets() >>= [&os, sig, this](std::vector<std::vector<int>> socks) -> srook::optional<int> {
+                    SROOK_ATTRIBUTE_UNUSED const auto rs = srook::scope::make_unique_resource(&socks, [](std::vector<std::vector<int>>* s) {
+                        for (const std::vector<int>& ws : *s) {
+                            for (int soc : ws) ::close(soc);
                         }
+                    });
+                    std::ofstream log_file;
+                    // The stats server comes last: once started, it only ever stops on the wakeup.
+                    detail::stats_server server(stats_, port_names_);
+                    if (!start_log(os, log_file) || !start_capture() || (!stats_path_.empty() && !server.start(stats_path_, *wakeup_))) return srook::nullopt;
+
+                    // Every page stays in memory until the workers are done. Pages are locked as they are faulted
+                    // in, not as they are mapped, which would be before map_anonymous() asks for huge pages.
+                    if (lock_memory_ && ::mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) < 0 && ::mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+                        srook::process::perror("mlockall");
                     }
-                    return { soc1 };
-                }) >>= [&ipfwd](int sock) -> srook::optional<int> {
-                    return ipfwd.undo() ? srook::make_optional(sock) : srook::nullopt;
+
+                    // The calling thread is worker 0, every other worker gets a thread of its own.
+                    std::atomic<bool> failed(false);
+                    std::vector<std::thread> threads;
+                    threads.reserve(workers_.size() - 1);
+                    for (std::size_t k = 1; k < workers_.size(); ++k) {
+                        threads.emplace_back([&socks, &failed, k, this] {
+                            if (!run_worker(k, socks[k], -1)) failed = true;
+                        });
+                    }
+                    if (!run_worker(0, socks[0], sig)) failed = true;
+                    for (std::thread& t : threads) t.join();
+                    if (lock_memory_) ::munlockall();
+                    if (log_) log_->stop();
+                    if (capture_) capture_->stop();
+                    server.join();
+
+                    // Consume the wakeup, so that the bridge can be run again.
+                    srook::uint64_t count;
+                    SROOK_ATTRIBUTE_UNUSED const ::ssize_t n = ::read(*wakeup_, &count, sizeof(count));
+                    return failed ? srook::nullopt : srook::make_optional(int(socks.front().size()));
                 };
+            }) >>= [&ipfwd](int n) -> srook::optional<int> {
+                return ipfwd.undo() ? srook::make_optional(n) : srook::nullopt;
             };
         });
     }
 private:
-    SROOK_FORCE_INLINE void register_signal() SROOK_NOEXCEPT_TRUE
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t fdb_sweep = 16;
+    // How many rounds over its ports a busy-polling worker makes between looks at the wakeup.
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t spin_rounds = 256;
+    // The largest GSO super-packet, without its link-layer header.
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t gso_max_size = 1 << 16;
+    // What the wakeup eventfd and the signalfd are told apart from the ports by.
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t wakeup_tag = devinfo::max_devices, signal_tag = wakeup_tag + 1;
+
+    SROOK_FORCE_INLINE static options make_options(srook::uint32_t filter, bool is_promiscous, bool is_verbose) SROOK_NOEXCEPT_TRUE
+    {
+        options opts;
+        opts.filter = filter;
+        opts.promiscuous = is_promiscous;
+        opts.verbose = is_verbose;
+        return opts;
+    }
+
+    SROOK_FORCE_INLINE static fdb::time_type now() SROOK_NOEXCEPT_TRUE
+    {
+        ::timespec ts{};
+        ::clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return static_cast<fdb::time_type>(ts.tv_sec);
+    }
+
+    // Lets the forwarding database and the multicast database forget a little of what has aged.
+    SROOK_FORCE_INLINE void age() SROOK_NOEXCEPT_TRUE
+    {
+        const fdb::time_type t = now();
+        tables_.addresses.age(t, fdb_sweep);
+        if (tables_.groups) tables_.groups->age(t, fdb_sweep);
+    }
+
+    // The device names of the ports, in port order.
+    SROOK_FORCE_INLINE static std::vector<std::string> names(const devinfo& di)
+    {
+        std::vector<std::string> v;
+        for (std::size_t i = 0; i < di.size(); ++i) v.emplace_back(di[i].data(), di[i].size());
+        return v;
+    }
+
+    // Puts the socket of w on a port into the fanout group of that port, which the socket of the
+    // first worker creates so that no other process on the host can be in it. The socket of any
+    // other worker is closed when there is no such group.
+    SROOK_FORCE_INLINE srook::optional<int>
+    join_fanout(const detail::worker& w, int soc, int mode, srook::optional<srook::uint16_t>& group) const SROOK_NOEXCEPT_TRUE
+    {
+        if (&w == &workers_.front()) return detail::create_fanout(soc, mode, group);
+        return group ? detail::join_fanout(soc, *group, mode) : (::close(soc), srook::nullopt);
+    }
+
+    // The largest frame any port can carry: its MTU behind an Ethernet header with one 802.1Q tag
+    // or, with PACKET_VNET_HDR, a whole GSO super-packet behind its virtio_net_hdr.
+    SROOK_FORCE_INLINE std::size_t max_frame(const devinfo& di) const SROOK_NOEXCEPT_TRUE
+    {
+        std::size_t mtu = vnet_hdr_ ? gso_max_size : ETH_DATA_LEN;
+        const std::vector<srook::optional<int>>& socks = workers_.front().socks;
+        for (std::size_t i = 0; !vnet_hdr_ && i < socks.size(); ++i) {
+            if (socks[i]) mtu = std::max(mtu, detail::mtu(*socks[i], di[i]));
+        }
+        return (vnet_hdr_ + ETH_HLEN + 4 + mtu + 63) & ~std::size_t(63);
+    }
+
+    // TX ring slots are grown to hold a frame of frame_size whole, as long as they still tile a block.
+    SROOK_FORCE_INLINE static void 
+    map_rings(srook::optional<int>& sock, srook::optional<detail::packet_rings>& rings, const options& opts, std::size_t frame_size, bool tags) 
+    SROOK_NOEXCEPT_TRUE
+    {
+        detail::ring_config cfg = opts.ring;
+        std::size_t slot = cfg.frame_size;
+        while (slot < TPACKET3_HDRLEN + (tags ? detail::vlan_tag_size : 0) + frame_size) slot <<= 1;
+        if (cfg.block_size % slot == 0) cfg.frame_size = slot;
+        rings = sock >>= [&opts, &cfg, tags](int soc) { return detail::make_rings(soc, cfg, opts.rx_ring, opts.tx_ring, tags); };
+        if (!rings) sock = srook::nullopt;
+    }
+
+    // With verbose on, gives every worker a log ring and starts the logger thread on os,
+    // or on log_file_ in binary when there is one.
+    SROOK_FORCE_INLINE bool start_log(std::ostream& os, std::ofstream& file)
+    {
+        log_.reset();
+        for (detail::worker& w : workers_) w.log = nullptr;
+        if (!verbose_) return true;
+        if (!log_file_.empty()) {
+            file.open(log_file_, std::ios::binary | std::ios::trunc);
+            if (!file) {
+                srook::process::perror(log_file_.c_str());
+                return false;
+            }
+        }
+        log_.reset(new detail::logger(workers_.size(), log_ring_));
+        for (std::size_t k = 0; k < workers_.size(); ++k) workers_[k].log = &log_->ring(k);
+        log_->start(log_file_.empty() ? os : file, !log_file_.empty());
+        return true;
+    }
+
+    // When a capture file is set, gives every worker a capture ring and starts the writer thread.
+    SROOK_FORCE_INLINE bool start_capture()
+    {
+        capture_.reset();
+        for (detail::worker& w : workers_) w.capture = nullptr;
+        if (tables_.capture.path.empty()) return true;
+
+        capture_.reset(new detail::capture(workers_.size(), tables_.capture, port_names_));
+        for (std::size_t k = 0; k < workers_.size(); ++k) workers_[k].capture = &capture_->ring(k);
+        return capture_->start();
+    }
+
+    // The port sockets of every worker, or nothing when any of them failed to come up.
+    SROOK_FORCE_INLINE srook::optional<std::vector<std::vector<int>>> sockets() const
+    {
+        std::vector<std::vector<int>> socks(workers_.size());
+        bool ok = true;
+        for (std::size_t k = 0; k < workers_.size(); ++k) {
+            for (const srook::optional<int>& sock : workers_[k].socks) {
+                if (sock) socks[k].push_back(*sock);
+                ok = ok && sock;
+            }
+        }
+        if (ok) return { srook::move(socks) };
+        for (const std::vector<int>& ws : socks) {
+            for (int soc : ws) ::close(soc);
+        }
+        return srook::nullopt;
+    }
+
+    // Runs the forwarding loop of worker k with a pipeline of just the stages in use. Plain forwarding,
+    // with or without snooping, gets a loop of its own; any other configuration the loop that has
+    // every stage and tests for each.
+    SROOK_FORCE_INLINE bool run_worker(std::size_t k, const std::vector<int>& socks, int sig)
+    {
+        switch (tables_.stages() | (log_ ? detail::stage::log : 0) | (capture_ ? detail::stage::capture : 0)) {
+            case 0: return work<0>(k, socks, sig);
+            case detail::stage::snoop: return work<detail::stage::snoop>(k, socks, sig);
+            default: return work<detail::stage::all>(k, socks, sig);
+        }
+    }
+
+    // The forwarding loop of worker k: sleeps in epoll_wait(2) until a port has frames,
+    // the wakeup eventfd is written or, for the worker that holds it, a signal arrives.
+    template <unsigned S>
+    SROOK_FORCE_INLINE bool work(std::size_t k, const std::vector<int>& socks, int sig)
+    {
+        detail::worker& w = workers_[k];
+        if (pin_ && !(cpus_.empty() ? detail::pin(k) : detail::pin_to(cpus_[k % cpus_.size()]))) srook::process::perror("pthread_setaffinity_np");
+        if (w.uring) return work_uring<S>(k, socks, sig);
+        if (!w.xdp && !w.pool) {
+            w.pool.reset(new detail::frame_pool(frame_size_, detail::frame_pool::default_count, hugepages_));
+            if (!*w.pool) w.pool.reset();
+            if (w.batch) w.batch->use(w.pool.get());
+        }
+        if (busy_poll_) return spin<S>(k, socks, sig);
+
+        detail::epoll ep;
+        bool ok = bool(ep) && ep.add(*wakeup_, wakeup_tag) && (sig < 0 || ep.add(sig, signal_tag));
+        for (std::size_t i = 0; ok && i < socks.size(); ++i) ok = ep.add(socks[i], i);
+
+        // With room for an 802.1Q tag in front of the frame.
+        std::vector<::u_char> buf(detail::vlan_tag_size + frame_size_);
+        for (bool running = ok; running;) {
+            // A port whose queue is held up by ENOBUFS rather than a full socket, or whose AF_XDP TX
+            // ring the device has yet to take, is tried again in a millisecond.
+            ok = ep.wait([&](srook::uint64_t tag, srook::uint32_t events) {
+                if (tag == wakeup_tag) {
+                    running = false;
+                } else if (tag == signal_tag) {
+                    ::signalfd_siginfo si;
+                    while (::read(sig, &si, sizeof(si)) > 0);
+                    stop();
+                } else {
+                    if (events & EPOLLOUT) {
+                        w.blocked &= ~(port_mask(1) << tag);
+                        ep.writable(socks[tag], tag, false);
+                    }
+                    if (events & ~srook::uint32_t(EPOLLOUT)) {
+                        w.now = now();
+                        receive<S>(w, socks, std::size_t(tag), buf.data() + detail::vlan_tag_size, frame_size_);
+                    }
+                }
+            }, (w.backlog & ~w.blocked) || w.pending ? 1 : -1);
+            w.stats->wakeups.add();
+            running = running && ok;
+            if (!k) age();
+            kick(w, socks);
+            if (w.backlog & ~w.blocked) flush_egress<S>(w, socks, &ep);
+        }
+        if (!ok) stop();
+        return ok;
+    }
+
+    // The forwarding loop of worker k when it busy polls: never sleeps, but goes round its ports
+    // with a non-blocking receive on each, or a look at the status word of the next RX ring block,
+    // and with SO_BUSY_POLL each receive polls the device queue as well. Only every spin_rounds
+    // rounds are the wakeup eventfd and, for the worker that holds it, the signalfd polled, without
+    // waiting. A full port is tried again every round rather than waited for.
+    template <unsigned S>
+    SROOK_FORCE_INLINE bool spin(std::size_t k, const std::vector<int>& socks, int sig)
+    {
+        detail::worker& w = workers_[k];
+        std::vector<::u_char> buf(detail::vlan_tag_size + frame_size_);
+        ::pollfd fds[] = { { *wakeup_, POLLIN, 0 }, { sig, POLLIN, 0 } };
+        for (std::size_t round = 0;; ++round) {
+            if (!(round % spin_rounds)) {
+                if (::poll(fds, sig < 0 ? 1 : 2, 0) < 0 && errno != EINTR) {
+                    srook::process::perror("poll");
+                    stop();
+                    return false;
+                }
+                if (fds[0].revents) return true;
+                if (sig >= 0 && fds[1].revents) {
+                    ::signalfd_siginfo si;
+                    while (::read(sig, &si, sizeof(si)) > 0);
+                    stop();
+                }
+                if (!k) age();
+            }
+            w.now = now();
+            srook::uint64_t frames = 0;
+            for (std::size_t i = 0; i < socks.size(); ++i) frames += receive<S>(w, socks, i, buf.data() + detail::vlan_tag_size, frame_size_);
+            if (frames) w.stats->wakeups.add();
+            kick(w, socks);
+            if (w.backlog) flush_egress<S>(w, socks, nullptr);
+        }
+    }
+
+    // Kicks every TX ring that frames were pushed on, and takes back the frames AF_XDP is done with.
+    // An AF_XDP port whose device could not take all of its frames stays pending, to be kicked again
+    // on the next round rather than retried here.
+    SROOK_FORCE_INLINE static void kick(detail::worker& w, const std::vector<int>& socks) SROOK_NOEXCEPT_TRUE
+    {
+        port_mask left = 0;
+        for (port_mask p = w.pending; p; p &= p - 1) {
+            const std::size_t j = std::size_t(__builtin_ctzll(p));
+            if (!(w.xdp ? w.xdp->sockets[j]->kick() : w.rings[j]->tx()->flush(socks[j]))) srook::process::perror("sendto");
+            if (w.xdp && w.xdp->sockets[j]->busy()) left |= port_mask(1) << j;
+        }
+        w.pending = left;
+        if (w.xdp) w.xdp->recycle();
+    }
+
+    // The forwarding loop of worker k on io_uring. Every port has a multishot receive armed, and the
+    // wakeup eventfd and, for the worker that holds it, the signalfd a multishot poll. Each iteration
+    // submits whatever was queued and waits for completions in one io_uring_enter(2); a receive that
+    // has stopped, for want of buffers or otherwise, is armed again once there are buffers.
+    template <unsigned S>
+    SROOK_FORCE_INLINE bool work_uring(std::size_t k, const std::vector<int>& socks, int sig)
+    {
+        detail::worker& w = workers_[k];
+        detail::uring_engine& ring = *w.uring;
+        bool ok = ring.enable() && ring.poll(*wakeup_, wakeup_tag) && (sig < 0 || ring.poll(sig, signal_tag));
+        port_mask idle = tables_.ports;
+        for (bool running = ok; running;) {
+            for (std::size_t i = 0; i < socks.size() && ring.has_buffers(); ++i) {
+                if (((idle >> i) & 1) && ring.recv(socks[i], i)) idle &= ~(port_mask(1) << i);
+            }
+            if (!ring.enter(true)) {
+                srook::process::perror("io_uring_enter");
+                ok = false;
+                break;
+            }
+            w.stats->wakeups.add();
+            w.now = now();
+            const srook::uint64_t start = clock();
+            srook::uint64_t frames = 0;
+            ring.reap([&](const ::io_uring_cqe& cqe) {
+                const std::size_t i = detail::uring_engine::port(cqe.user_data);
+                switch (detail::uring_engine::op(cqe.user_data)) {
+                    case detail::uring_engine::poll_op:
+                        if (i == wakeup_tag) {
+                            running = false;
+                        } else {
+                            ::signalfd_siginfo si;
+                            while (::read(sig, &si, sizeof(si)) > 0);
+                            if (!(cqe.flags & IORING_CQE_F_MORE)) ring.poll(sig, signal_tag);
+                            stop();
+                        }
+                        break;
+                    case detail::uring_engine::recv_op:
+                        if (!(cqe.flags & IORING_CQE_F_MORE)) idle |= port_mask(1) << i;
+                        if (cqe.res < 0 && cqe.res != -ENOBUFS) {
+                            w.stats->ports[i].rx_errors.add();
+                            errno = -cqe.res;
+                            srook::process::perror("recv");
+                        } else if (cqe.res >= 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+                            ++frames;
+                            forward_uring<S>(w, socks, i, static_cast<srook::uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT), std::size_t(cqe.res));
+                        }
+                        break;
+                    case detail::uring_engine::send_op: {
+                        detail::port_counters& c = w.stats->ports[i];
+                        if (cqe.res >= 0) {
+                            c.tx_packets.add();
+                            c.tx_bytes.add(std::size_t(cqe.res));
+                        } else {
+                            (cqe.res == -EAGAIN || cqe.res == -ENOBUFS ? c.tx_drops : c.tx_errors).add();
+                        }
+                        ring.returned(detail::uring_engine::buffer(cqe.user_data));
+                        break;
+                    }
+                }
+            });
+            ring.publish();
+            if (frames) {
+                w.stats->batch.add(frames);
+                w.stats->batch_time.add(clock() - start);
+            }
+            if (!k) age();
+        }
+        if (!ok) stop();
+        return ok;
+    }
+
+    // Queues a send of buffer b for every egress port of the frame in it; the buffer goes back
+    // to the kernel once the last of those has completed. len is the frame's whole length, which
+    // may be more than the buffer holds.
+    template <unsigned S>
+    SROOK_FORCE_INLINE void forward_uring(detail::worker& w, const std::vector<int>& socks, std::size_t in, srook::uint16_t b, std::size_t len) SROOK_NOEXCEPT_TRUE
+    {
+        detail::uring_engine& ring = *w.uring;
+        if (len > ring.buffer_size()) {
+            w.stats->ports[in].rx_errors.add();
+            ring.lend(b, 0);
+            return;
+        }
+        ::u_char* data = ring.data(b);
+        const detail::pipeline<S> p(tables_);
+        port_mask out = p.dump(w, in, data, len) ? p.steer(w, in, data, len) : 0;
+        std::size_t n = 0;
+        for (std::size_t j = 0; out; ++j, out >>= 1) {
+            if (!(out & 1)) continue;
+            if (ring.send(socks[j], j, b, len)) ++n;
+            else w.stats->ports[j].tx_drops.add();
+        }
+        ring.lend(b, n);
+    }
+
+    // Gives every worker an io_uring, or none when any of them cannot have one.
+    SROOK_FORCE_INLINE bool open_uring()
+    {
+        bool ok = true;
+        for (detail::worker& w : workers_) {
+            w.uring.reset(ok ? new detail::uring_engine(frame_size_, hugepages_) : nullptr);
+            ok = w.uring && *w.uring;
+        }
+        if (!ok) {
+            for (detail::worker& w : workers_) w.uring.reset();
+        }
+        return ok;
+    }
+
+    // Takes whatever is pending on port i and forwards it. A frame is received once and
+    // handed to each of its egress ports from the same buffer. Returns how many frames there were.
+    template <unsigned S>
+    SROOK_FORCE_INLINE srook::uint64_t receive(detail::worker& w, const std::vector<int>& socks, std::size_t i, ::u_char* buf, std::size_t bufsize)
+    {
+        const srook::uint64_t start = clock(), frames = w.stats->ports[i].rx_packets.get();
+        handle<S>(w, socks, i, buf, bufsize);
+        const srook::uint64_t n = w.stats->ports[i].rx_packets.get() - frames;
+        if (n) {
+            w.stats->batch.add(n);
+            w.stats->batch_time.add(clock() - start);
+        }
+        return n;
+    }
+
+    // Counts the transit of a frame the kernel timestamped with stamp and which was handed to its
+    // egress sockets by t, both on CLOCK_REALTIME. A frame without a timestamp is not counted.
+    SROOK_FORCE_INLINE static void transit(detail::worker& w, srook::uint64_t stamp, srook::uint64_t t = detail::real_time()) SROOK_NOEXCEPT_TRUE
+    {
+        if (stamp && t >= stamp) w.stats->transit.add(t - stamp);
+    }
+
+    // CLOCK_MONOTONIC, in nanoseconds.
+    SROOK_FORCE_INLINE static srook::uint64_t clock() SROOK_NOEXCEPT_TRUE
+    {
+        ::timespec ts{};
+        ::clock_gettime(CLOCK_MONOTONIC, &ts);
+        return srook::uint64_t(ts.tv_sec) * 1000000000 + srook::uint64_t(ts.tv_nsec);
+    }
+
+    template <unsigned S>
+    SROOK_FORCE_INLINE void handle(detail::worker& w, const std::vector<int>& socks, std::size_t i, ::u_char* buf, std::size_t bufsize)
+    {
+        const detail::pipeline<S> p(tables_);
+        if (w.xdp) {
+            xdp_receive<S>(w, i);
+        } else if (w.rings[i] && w.rings[i]->rx()) {
+            w.rings[i]->rx()->drain([&w, &socks, &i, &p, this](::u_char* data, std::size_t s, srook::uint64_t stamp) {
+                if (p.dump(w, i, data, s) && forward<S>(w, socks, i, data, s) && w.timestamps) transit(w, stamp);
+                return true;
+            });
+        } else if (w.batch) {
+            if (!w.batch->recv(socks[i])) {
+                w.stats->ports[i].rx_errors.add();
+                srook::process::perror("recvmmsg");
+                return;
+            }
+            port_mask out = w.batch->select([&w, &i, &p, this](::u_char*& data, std::size_t& s, const detail::frame_ref& f) -> port_mask {
+                return p.dump(w, i, data + vnet_hdr_, s - vnet_hdr_) && p.admit(w, i, data, s) ? p.steer(w, i, data + vnet_hdr_, s - vnet_hdr_, &f) : 0;
+            });
+            w.stats->ports[i].rx_errors.add(w.batch->truncated());
+            for (std::size_t j = 0; out; ++j, out >>= 1) {
+                if ((out & 1) && w.batch->gather(j, [&j, &p](const ::u_char* data) { return p.untagged(j, data); })) {
+                    const auto queue = [&w, &j, this](::u_char* data, std::size_t s, const detail::frame_ref& f) { enqueue(w, j, data, s, &f); };
+                    if (w.rings[j] && w.rings[j]->tx()) {
+                        w.batch->for_each_selected([&w, &socks, &j, this](::u_char* data, std::size_t s, const detail::frame_ref& f) { transmit<S>(w, socks[j], j, data, s, &f); });
+                    } else if ((w.backlog >> j) & 1) {
+                        w.batch->for_each_selected(queue);
+                    } else {
+                        detail::port_counters& c = w.stats->ports[j];
+                        const srook::optional<std::size_t> sent = w.batch->send(socks[j]);
+                        const std::size_t n = sent ? *sent : 0;
+                        c.tx_packets.add(n);
+                        c.tx_bytes.add(w.batch->bytes(n) - n * vnet_hdr_);
+                        if (sent && !w.egress.empty()) w.batch->for_each_selected(queue, n);
+                        else (sent ? c.tx_drops : c.tx_errors).add(w.batch->selected() - n);
+                        if (!sent) srook::process::perror("sendmmsg");
+                    }
+                }
+            }
+            if (w.timestamps) {
+                const srook::uint64_t t = detail::real_time();
+                w.batch->for_each_timestamp([&w, t](srook::uint64_t stamp) { transit(w, stamp, t); });
+            }
+        } else {
+            // Into a frame of the pool, which the capture may keep, or into buf while the pool has none.
+            // With tags_, a tag the kernel took off is put back, which moves the frame's beginning.
+            detail::frame_ref f = w.pool ? w.pool->alloc() : detail::frame_ref();
+            ::u_char* const start = f ? f.data() : buf;
+            ::u_char* data = start;
+            srook::uint64_t stamp = 0;
+            srook::optional<int> ops = tags_ || w.timestamps ?
+                detail::recv_tagged(socks[i], data, bufsize, w.timestamps ? &stamp : nullptr) : io(recv_whole, socks[i], data, bufsize);
+            if (!ops) {
+                if (errno != EAGAIN) {
+                    w.stats->ports[i].rx_errors.add();
+                    srook::process::perror("recv");
+                }
+                return;
+            }
+            // A frame that did not fit the buffer is never forwarded cut short.
+            std::size_t len = std::size_t(*ops);
+            if (len > bufsize + std::size_t(start - data)) {
+                w.stats->ports[i].rx_errors.add();
+                return;
+            }
+            if (!p.dump(w, i, data + vnet_hdr_, len - vnet_hdr_) || !p.admit(w, i, data, len)) return;
+            if (f) {
+                f.push(f.data() - data);
+                f.resize(len);
+            }
+            if (forward<S>(w, socks, i, data, len, &f) && w.timestamps) transit(w, stamp);
+        }
+    }
+
+    // Frames arrive in the worker's UMEM. The last egress port of a frame gets the frame itself and
+    // every other one a copy, so nothing is copied for a frame that goes to a single port.
+    template <unsigned S>
+    SROOK_FORCE_INLINE void xdp_receive(detail::worker& w, std::size_t i) SROOK_NOEXCEPT_TRUE
+    {
+        detail::xdp_ports& x = *w.xdp;
+        const detail::pipeline<S> p(tables_);
+        x.sockets[i]->receive([&w, &x, &p, i](srook::uint64_t addr, srook::uint32_t len) {
+            ::u_char* data = x.umem.data(addr);
+            port_mask out = p.dump(w, i, data, len) ? p.steer(w, i, data, len) : 0;
+            if (!out) x.umem.release(addr);
+            for (std::size_t j = 0; out; ++j, out >>= 1) {
+                if (!(out & 1)) continue;
+                detail::port_counters& c = w.stats->ports[j];
+                srook::uint64_t frame = addr;
+                if (out != 1 && !x.umem.copy(addr, len, frame)) {
+                    c.tx_drops.add();
+                } else if (x.sockets[j]->send(frame, len)) {
+                    w.pending |= port_mask(1) << j;
+                    c.tx_packets.add();
+                    c.tx_bytes.add(len);
+                } else {
+                    c.tx_drops.add();
+                    x.umem.release(frame);
+                }
+            }
+        });
+    }
+
+    // Opens an AF_XDP socket on queue k of every port for every worker k behind an XDP program per
+    // port. When any of it fails, everything is undone and the bridge is left to use AF_PACKET.
+    SROOK_FORCE_INLINE bool open_xdp(const options& opts)
+    {
+        std::vector<unsigned int> ifindex;
+        bool ok = true;
+        for (std::size_t i = 0; ok && i < port_names_.size(); ++i) {
+            ifindex.push_back(detail::ifindex(port_names_[i]));
+            xdp_.emplace_back(new detail::xdp_program(ifindex.back(), workers_.size(), opts.xdp_native));
+            ok = ifindex.back() && *xdp_.back() && (!opts.promiscuous || detail::promiscuous(port_names_[i]));
+        }
+        for (std::size_t k = 0; ok && k < workers_.size(); ++k) {
+            detail::worker& w = workers_[k];
+            w.xdp.reset(new detail::xdp_ports(port_names_.size(), hugepages_));
+            w.rings = std::vector<srook::optional<detail::packet_rings>>(port_names_.size());
+            ok = bool(w.xdp->umem);
+            for (std::size_t i = 0; ok && i < port_names_.size(); ++i) {
+                w.socks.push_back(w.xdp->add(ifindex[i], static_cast<srook::uint32_t>(k)));
+                ok = w.socks.back() && xdp_[i]->add(static_cast<srook::uint32_t>(k), *w.socks.back());
+            }
+        }
+        if (ok) return true;
+
+        xdp_.clear();
+        for (detail::worker& w : workers_) {
+            for (const srook::optional<int>& soc : w.socks) {
+                if (soc) ::close(*soc);
+            }
+            w.socks.clear();
+            w.xdp.reset();
+        }
+        return false;
+    }
+
+    // With PACKET_VNET_HDR, data starts with the virtio_net_hdr, which goes out along with the frame.
+    // f is the frame data is in, when it is in the worker's pool. Returns the ports the frame went to.
+    template <unsigned S>
+    SROOK_FORCE_INLINE port_mask
+    forward(detail::worker& w, const std::vector<int>& socks, std::size_t in, ::u_char* data, std::size_t len, const detail::frame_ref* f = nullptr)
+    {
+        const port_mask to = detail::pipeline<S>(tables_).steer(w, in, data + vnet_hdr_, len - vnet_hdr_, f);
+        std::size_t j = 0;
+        for (port_mask out = to; out; ++j, out >>= 1) {
+            if ((out & 1) && !transmit<S>(w, socks[j], j, data, len, f) && errno != EAGAIN && errno != ENOBUFS) srook::process::perror("write");
+        }
+        return to;
+    }
+
+    // Queues a frame on the TX ring of port j when there is one, otherwise writes it out directly,
+    // unless the port's egress queue already holds frames or the socket cannot take it right now: then
+    // the frame joins the egress queue. A ring or queued frame is sent when the worker flushes the ring
+    // or queue after it has handled every ready port. A frame that finds no room on the ring or queue
+    // is counted as dropped, any other failure as an error. f is as for forward().
+    template <unsigned S>
+    SROOK_FORCE_INLINE srook::optional<int>
+    transmit(detail::worker& w, int soc, std::size_t j, ::u_char* buf, std::size_t len, const detail::frame_ref* f = nullptr) SROOK_NOEXCEPT_TRUE
+    {
+        detail::port_counters& c = w.stats->ports[j];
+        srook::optional<detail::packet_rings>& rings = w.rings[j];
+        srook::optional<int> sent = { int(len) };
+        if (rings && rings->tx() && len <= rings->tx()->capacity()) {
+            if (!rings->tx()->push(buf, len)) {
+                c.tx_drops.add();
+                errno = ENOBUFS;
+                return srook::nullopt;
+            }
+            w.pending |= port_mask(1) << j;
+        } else if (((w.backlog >> j) & 1) || !(sent = put<S>(soc, j, buf, len))) {
+            if (!w.egress.empty() && (((w.backlog >> j) & 1) || errno == EAGAIN || errno == ENOBUFS)) {
+                if (enqueue(w, j, buf, len, f)) return { int(len) };
+                errno = ENOBUFS;
+                return srook::nullopt;
+            }
+            (errno == EAGAIN || errno == ENOBUFS ? c.tx_drops : c.tx_errors).add();
+            return srook::nullopt;
+        }
+        c.tx_packets.add();
+        c.tx_bytes.add(std::size_t(*sent) - vnet_hdr_);
+        return { int(len) };
+    }
+
+    // write(2) of a frame out of port j, without its 802.1Q tag when the port sends the frame's VLAN
+    // untagged. The tag is skipped with writev(2), so the frame itself is left as it is for the other ports.
+    template <unsigned S>
+    SROOK_FORCE_INLINE srook::optional<int> put(int soc, std::size_t j, ::u_char* frame, std::size_t len) SROOK_NOEXCEPT_TRUE
+    {
+        if (!detail::pipeline<S>(tables_).untagged(j, frame)) return io(::write, soc, frame, len);
+        ::iovec iov[] = { { frame, 2 * ETH_ALEN }, { frame + 2 * ETH_ALEN + detail::vlan_tag_size, len - 2 * ETH_ALEN - detail::vlan_tag_size } };
+        const ::ssize_t n = ::writev(soc, iov, 2);
+        return n <= 0 ? srook::nullopt : srook::make_optional(int(n));
+    }
+
+    // Puts a frame on the egress queue of port j: by reference when it is in the worker's pool, as a
+    // copy in the pool otherwise. Returns whether it was queued; the frame dropped to make room, if
+    // any, is counted under its class.
+    SROOK_FORCE_INLINE bool enqueue(detail::worker& w, std::size_t j, const ::u_char* data, std::size_t len, const detail::frame_ref* f) SROOK_NOEXCEPT_TRUE
+    {
+        detail::port_counters& c = w.stats->ports[j];
+        detail::egress_queue& q = w.egress[j];
+        const std::size_t cls = detail::traffic_class(data + vnet_hdr_, len - vnet_hdr_);
+        std::size_t dropped = cls;
+        if (f && *f) {
+            dropped = q.push(*f, cls);
+        } else if (detail::frame_ref g = w.pool ? w.pool->alloc() : detail::frame_ref()) {
+            std::memcpy(g.data(), data, len);
+            g.resize(len);
+            dropped = q.push(srook::move(g), cls);
+        }
+        if (!q.empty()) w.backlog |= port_mask(1) << j;
+        c.queue_depth[cls].set(q.size(cls));
+        if (dropped == detail::egress_queue::none) return true;
+        c.tx_drops.add();
+        c.queue_drops[dropped].add();
+        c.queue_depth[dropped].set(q.size(dropped));
+        return dropped != cls;
+    }
+
+    // Sends what the egress queues of w hold out of every port not known to be full. A port that
+    // turns out to be full is watched until it is writable again, with ep.
+    template <unsigned S>
+    SROOK_FORCE_INLINE void flush_egress(detail::worker& w, const std::vector<int>& socks, detail::epoll* ep) SROOK_NOEXCEPT_TRUE
+    {
+        for (port_mask ready = w.backlog & ~w.blocked; ready; ready &= ready - 1) {
+            const std::size_t j = std::size_t(__builtin_ctzll(ready));
+            detail::port_counters& c = w.stats->ports[j];
+            detail::egress_queue& q = w.egress[j];
+            int full = 0;
+            q.drain([&](detail::frame_ref& f) {
+                if (const srook::optional<int> sent = put<S>(socks[j], j, f.data(), f.size())) {
+                    c.tx_packets.add();
+                    c.tx_bytes.add(std::size_t(*sent) - vnet_hdr_);
+                    return true;
+                }
+                if (errno == EAGAIN || errno == ENOBUFS) {
+                    full = errno;
+                    return false;
+                }
+                c.tx_errors.add();
+                return true;
+            });
+            for (std::size_t cls = 0; cls < detail::traffic_classes; ++cls) c.queue_depth[cls].set(q.size(cls));
+            if (q.empty()) w.backlog &= ~(port_mask(1) << j);
+            else if (full == EAGAIN && ep && ep->writable(socks[j], j, true)) w.blocked |= port_mask(1) << j;
+        }
+    }
+
+    // recv(2) that returns the whole length of a frame even when it was cut to fit the buffer.
+    SROOK_FORCE_INLINE static int recv_whole(int soc, ::u_char* buf, std::size_t len) SROOK_NOEXCEPT_TRUE
+    {
+        return static_cast<int>(::recv(soc, buf, len, MSG_TRUNC));
+    }
+
+    SROOK_FORCE_INLINE void ignore_signals() SROOK_NOEXCEPT_TRUE
     {
-        ::signal(SIGINT, end_signal);
-        ::signal(SIGTERM, end_signal);
-        ::signal(SIGQUIT, end_signal);
         ::signal(SIGPIPE, SIG_IGN);
         ::signal(SIGTTIN, SIG_IGN);
         ::signal(SIGTTOU, SIG_IGN);
@@ -169,15 +942,32 @@ private:
     };
 
 
-    bool bridged_, verbose_;
-    srook::optional<int> sock1_, sock2_;
-    
-    static bool end;
-    static void end_signal(int) SROOK_NOEXCEPT_TRUE { end = true; }
+    bool bridged_, verbose_, pin_;
+    std::vector<detail::worker> workers_;
+    bool owns_wakeup_;
+    srook::optional<int> wakeup_;
+    std::string log_file_;
+    std::size_t log_ring_;
+    std::unique_ptr<detail::logger> log_;
+    std::vector<std::string> port_names_;
+    std::unique_ptr<detail::capture> capture_;
+    std::string stats_path_;
+    std::vector<std::unique_ptr<detail::worker_stats>> stats_;
+    std::vector<std::unique_ptr<detail::xdp_program>> xdp_;
+    // The size of the virtio_net_hdr in front of every frame with PACKET_VNET_HDR, 0 otherwise.
+    std::size_t vnet_hdr_;
+    // How large a buffer has to be for any frame on any port.
+    std::size_t frame_size_;
+    // SO_BUSY_POLL microseconds when the workers busy poll, 0 when they sleep.
+    unsigned int busy_poll_;
+    std::vector<int> cpus_;
+    bool lock_memory_, hugepages_;
+    // Whether the tags the kernel takes off received frames are put back.
+    bool tags_;
+    // The forwarding database and whatever else the per-frame path looks frames up in.
+    detail::forwarding_tables tables_;
 };
 
-bool bridge::end = false;
-
 SROOK_INLINE_NAMESPACE_END
 } // namespace toybridge
 
@@ -0,0 +1,127 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_DETAIL_BPF_HPP
+#define INCLUDED_TOYBRIDGE_DETAIL_BPF_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <linux/filter.h>
+#include <cstring>
+#include <vector>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+namespace detail {
+
+// What the kernel knows about a frame besides its bytes, as far as classic BPF ancillary
+// loads can see it: the 802.1Q tag that the driver took out of the frame, if any.
+struct bpf_metadata {
+    bool vlan_tag_present = false;
+    srook::uint16_t vlan_tci = 0;
+};
+
+// Runs a classic BPF program over a frame the way the kernel's interpreter does and returns
+// how many bytes of it the program keeps. A load beyond the end of the frame, a division by
+// zero or running off the end of the program drops the frame.
+srook::uint32_t bpf_run(const std::vector<::sock_filter>& prog, const ::u_char* pkt, std::size_t len, const bpf_metadata& meta = bpf_metadata())
+SROOK_NOEXCEPT_TRUE
+{
+    srook::uint32_t a = 0, x = 0, mem[BPF_MEMWORDS]{};
+
+    const auto load = [&](srook::uint32_t off, srook::uint32_t size, srook::uint32_t& v) -> bool {
+        if (off >= srook::uint32_t(SKF_AD_OFF) && size == 4) {
+            switch (off - srook::uint32_t(SKF_AD_OFF)) {
+                case SKF_AD_VLAN_TAG: v = meta.vlan_tci; return true;
+                case SKF_AD_VLAN_TAG_PRESENT: v = meta.vlan_tag_present; return true;
+                case SKF_AD_PKTTYPE: v = 0; return true;
+                default: return false;
+            }
+        }
+        if (off > len || size > len - off) return false;
+        v = 0;
+        for (srook::uint32_t i = 0; i < size; ++i) v = v << 8 | pkt[off + i];
+        return true;
+    };
+
+    for (std::size_t pc = 0; pc < prog.size(); ++pc) {
+        const ::sock_filter& f = prog[pc];
+        switch (BPF_CLASS(f.code)) {
+            case BPF_LD: {
+                const srook::uint32_t size = BPF_SIZE(f.code) == BPF_W ? 4 : BPF_SIZE(f.code) == BPF_H ? 2 : 1;
+                switch (BPF_MODE(f.code)) {
+                    case BPF_ABS: if (!load(f.k, size, a)) return 0; break;
+                    case BPF_IND: if (!load(x + f.k, size, a)) return 0; break;
+                    case BPF_IMM: a = f.k; break;
+                    case BPF_LEN: a = srook::uint32_t(len); break;
+                    case BPF_MEM: a = mem[f.k % BPF_MEMWORDS]; break;
+                    default: return 0;
+                }
+                break;
+            }
+            case BPF_LDX:
+                switch (BPF_MODE(f.code)) {
+                    case BPF_IMM: x = f.k; break;
+                    case BPF_LEN: x = srook::uint32_t(len); break;
+                    case BPF_MEM: x = mem[f.k % BPF_MEMWORDS]; break;
+                    case BPF_MSH: {
+                        srook::uint32_t b;
+                        if (!load(f.k, 1, b)) return 0;
+                        x = (b & 0xf) << 2;
+                        break;
+                    }
+                    default: return 0;
+                }
+                break;
+            case BPF_ST: mem[f.k % BPF_MEMWORDS] = a; break;
+            case BPF_STX: mem[f.k % BPF_MEMWORDS] = x; break;
+            case BPF_ALU: {
+                const srook::uint32_t v = BPF_SRC(f.code) == BPF_X ? x : f.k;
+                switch (BPF_OP(f.code)) {
+                    case BPF_ADD: a += v; break;
+                    case BPF_SUB: a -= v; break;
+                    case BPF_MUL: a *= v; break;
+                    case BPF_DIV: if (!v) return 0; a /= v; break;
+                    case BPF_MOD: if (!v) return 0; a %= v; break;
+                    case BPF_AND: a &= v; break;
+                    case BPF_OR: a |= v; break;
+                    case BPF_XOR: a ^= v; break;
+                    case BPF_LSH: a = v < 32 ? a << v : 0; break;
+                    case BPF_RSH: a = v < 32 ? a >> v : 0; break;
+                    case BPF_NEG: a = -a; break;
+                    default: return 0;
+                }
+                break;
+            }
+            case BPF_JMP: {
+                if (BPF_OP(f.code) == BPF_JA) {
+                    pc += f.k;
+                    break;
+                }
+                const srook::uint32_t v = BPF_SRC(f.code) == BPF_X ? x : f.k;
+                bool taken;
+                switch (BPF_OP(f.code)) {
+                    case BPF_JEQ: taken = a == v; break;
+                    case BPF_JGT: taken = a > v; break;
+                    case BPF_JGE: taken = a >= v; break;
+                    case BPF_JSET: taken = a & v; break;
+                    default: return 0;
+                }
+                pc += taken ? f.jt : f.jf;
+                break;
+            }
+            case BPF_RET: return BPF_RVAL(f.code) == BPF_A ? a : f.k;
+            case BPF_MISC:
+                if (BPF_MISCOP(f.code) == BPF_TAX) x = a;
+                else a = x;
+                break;
+            default: return 0;
+        }
+    }
+    return 0;
+}
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
@@ -0,0 +1,152 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_DETAIL_EGRESS_HPP
+#define INCLUDED_TOYBRIDGE_DETAIL_EGRESS_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/detail/frame_pool.hpp>
+#include <net/ethernet.h>
+#include <vector>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+namespace detail {
+
+SROOK_INLINE_VARIABLE SROOK_CONSTEXPR_OR_CONST std::size_t traffic_classes = 8;
+
+// The traffic class of a frame, 0 being the lowest: the PCP of its outermost 802.1Q tag, where
+// PCP 1 (background) ranks below PCP 0 (best effort) as 802.1Q recommends for eight queues.
+// Untagged frames are best effort.
+SROOK_FORCE_INLINE std::size_t traffic_class(const ::u_char* frame, std::size_t len) SROOK_NOEXCEPT_TRUE
+{
+    if (len < sizeof(::ether_header) + 2) return 1;
+    const srook::uint16_t type = static_cast<srook::uint16_t>(frame[12] << 8 | frame[13]);
+    if (type != ETHERTYPE_VLAN && type != 0x88a8) return 1;
+    const std::size_t pcp = frame[14] >> 5;
+    return pcp == 0 ? 1 : pcp == 1 ? 0 : pcp;
+}
+
+// What a full queue drops: the frame that arrives (tail), or the newest frame of the lowest
+// class below it that has one, and the arriving frame only when there is no such class.
+enum class egress_drop { tail, lowest };
+// Strict priority always sends from the highest class that has frames; weighted is deficit
+// round robin, each class getting weights[class] full-sized frames' worth of bytes per round.
+enum class egress_sched { strict, weighted };
+
+struct egress_config {
+    // Frames one port's queue of one worker holds, over all classes.
+    std::size_t depth = 1024;
+    egress_drop drop = egress_drop::tail;
+    egress_sched sched = egress_sched::strict;
+    srook::uint32_t weights[traffic_classes] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+};
+
+// The frames a worker has for one port that the port could not take yet, in one ring per traffic
+// class. Only its worker ever touches it.
+class egress_queue {
+public:
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t none = traffic_classes;
+
+    SROOK_FORCE_INLINE explicit egress_queue(const egress_config& cfg)
+        : cfg_(cfg), mask_(capacity(cfg.depth) - 1), slots_(traffic_classes * (mask_ + 1)), size_(0), current_(0), visited_(false)
+    {
+        for (std::size_t c = 0; c < traffic_classes; ++c) head_[c] = tail_[c] = deficit_[c] = 0;
+    }
+
+    SROOK_FORCE_INLINE bool empty() const SROOK_NOEXCEPT_TRUE
+    {
+        return !size_;
+    }
+
+    SROOK_FORCE_INLINE std::size_t size(std::size_t c) const SROOK_NOEXCEPT_TRUE
+    {
+        return tail_[c] - head_[c];
+    }
+
+    // Queues f in class c and returns the class of the frame dropped to make room, which may
+    // be f itself, or none when nothing was dropped.
+    SROOK_FORCE_INLINE std::size_t push(frame_ref f, std::size_t c) SROOK_NOEXCEPT_TRUE
+    {
+        std::size_t dropped = none;
+        if (size_ >= cfg_.depth) {
+            if (cfg_.drop == egress_drop::tail) return c;
+            std::size_t low = 0;
+            while (low < c && !size(low)) ++low;
+            if (low == c) return c;
+            slot(low, --tail_[low]).reset();
+            --size_;
+            dropped = low;
+        }
+        slot(c, tail_[c]++) = srook::move(f);
+        ++size_;
+        return dropped;
+    }
+
+    // Hands queued frames to send(frame) in scheduling order for as long as it returns true, which
+    // it does once it is done with the frame. Returns how many it took.
+    template <class F>
+    SROOK_FORCE_INLINE std::size_t drain(F&& send)
+    {
+        std::size_t n = 0;
+        if (cfg_.sched == egress_sched::strict) {
+            for (std::size_t c = traffic_classes; c-- > 0;) {
+                for (; size(c); ++n) {
+                    if (!send(slot(c, head_[c]))) return n;
+                    pop(c);
+                }
+            }
+            return n;
+        }
+        while (size_) {
+            const std::size_t c = current_;
+            if (!visited_) {
+                deficit_[c] += cfg_.weights[c] * quantum;
+                visited_ = true;
+            }
+            for (; size(c) && slot(c, head_[c]).size() <= deficit_[c]; ++n) {
+                if (!send(slot(c, head_[c]))) return n;
+                deficit_[c] -= slot(c, head_[c]).size();
+                pop(c);
+            }
+            if (!size(c)) deficit_[c] = 0;
+            current_ = (c + 1) % traffic_classes;
+            visited_ = false;
+        }
+        return n;
+    }
+private:
+    // Bytes of one full-sized Ethernet frame.
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t quantum = 1514;
+
+    SROOK_FORCE_INLINE static std::size_t capacity(std::size_t n) SROOK_NOEXCEPT_TRUE
+    {
+        std::size_t c = 2;
+        while (c < n) c <<= 1;
+        return c;
+    }
+
+    SROOK_FORCE_INLINE frame_ref& slot(std::size_t c, std::size_t i) SROOK_NOEXCEPT_TRUE
+    {
+        return slots_[c * (mask_ + 1) + (i & mask_)];
+    }
+
+    SROOK_FORCE_INLINE void pop(std::size_t c) SROOK_NOEXCEPT_TRUE
+    {
+        slot(c, head_[c]++).reset();
+        --size_;
+    }
+
+    egress_config cfg_;
+    std::size_t mask_;
+    std::vector<frame_ref> slots_;
+    std::size_t head_[traffic_classes], tail_[traffic_classes], deficit_[traffic_classes];
+    std::size_t size_, current_;
+    bool visited_;
+};
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
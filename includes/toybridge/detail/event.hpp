@@ -0,0 +1,123 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_DETAIL_EVENT_HPP
+#define INCLUDED_TOYBRIDGE_DETAIL_EVENT_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/detail/init.hpp>
+#include <srook/optional.hpp>
+#include <srook/process/perror.hpp>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cerrno>
+#include <vector>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+namespace detail {
+
+// An epoll(7) instance whose ready list is read in batches of up to the number of
+// registered descriptors. Each descriptor is registered with a tag that wait() hands back.
+class epoll {
+public:
+    SROOK_FORCE_INLINE epoll() SROOK_NOEXCEPT_TRUE
+        : fd_(::epoll_create1(EPOLL_CLOEXEC))
+    {
+        if (fd_ < 0) srook::process::perror("epoll_create1");
+    }
+
+    epoll(const epoll&) = delete;
+    epoll& operator=(const epoll&) = delete;
+
+    SROOK_FORCE_INLINE ~epoll()
+    {
+        if (fd_ >= 0) ::close(fd_);
+    }
+
+    SROOK_FORCE_INLINE explicit operator bool() const SROOK_NOEXCEPT_TRUE
+    {
+        return fd_ >= 0;
+    }
+
+    SROOK_FORCE_INLINE bool add(int fd, srook::uint64_t tag)
+    {
+        ::epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = tag;
+        if (::epoll_ctl(fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            srook::process::perror("epoll_ctl");
+            return false;
+        }
+        ready_.emplace_back();
+        return true;
+    }
+
+    // Whether fd, registered with tag, is also waited for to become writable.
+    SROOK_FORCE_INLINE bool writable(int fd, srook::uint64_t tag, bool on)
+    {
+        ::epoll_event ev{};
+        ev.events = EPOLLIN | (on ? srook::uint32_t(EPOLLOUT) : 0);
+        ev.data.u64 = tag;
+        if (::epoll_ctl(fd_, EPOLL_CTL_MOD, fd, &ev) < 0) {
+            srook::process::perror("epoll_ctl");
+            return false;
+        }
+        return true;
+    }
+
+    // Blocks until at least one descriptor is ready, or for timeout milliseconds when it is not
+    // negative, and calls fn(tag, events) for each of them. Returns false when epoll_wait(2) fails
+    // for any reason but a signal.
+    template <class F>
+    SROOK_FORCE_INLINE bool wait(F&& fn, int timeout = -1)
+    {
+        const int n = ::epoll_wait(fd_, ready_.data(), static_cast<int>(ready_.size()), timeout);
+        if (n < 0) {
+            if (errno == EINTR) return true;
+            srook::process::perror("epoll_wait");
+            return false;
+        }
+        for (int i = 0; i < n; ++i) fn(ready_[i].data.u64, ready_[i].events);
+        return true;
+    }
+private:
+    int fd_;
+    std::vector<::epoll_event> ready_;
+};
+
+// Switches soc to non-blocking mode.
+srook::optional<int> nonblock(int soc)
+SROOK_NOEXCEPT_TRUE
+{
+    const int flags = ::fcntl(soc, F_GETFL);
+    return flags < 0 || ::fcntl(soc, F_SETFL, flags | O_NONBLOCK) < 0 ? error_close("fcntl", soc), srook::nullopt : srook::make_optional(soc);
+}
+
+srook::optional<int> eventfd()
+SROOK_NOEXCEPT_TRUE
+{
+    const int fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd < 0) srook::process::perror("eventfd");
+    return fd < 0 ? srook::nullopt : srook::make_optional(fd);
+}
+
+// A descriptor that becomes readable when any signal of mask is delivered. The signals
+// must be blocked in every thread, so that none of them is delivered the usual way.
+srook::optional<int> signalfd(const ::sigset_t& mask)
+SROOK_NOEXCEPT_TRUE
+{
+    const int fd = ::signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (fd < 0) srook::process::perror("signalfd");
+    return fd < 0 ? srook::nullopt : srook::make_optional(fd);
+}
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
@@ -0,0 +1,245 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_DETAIL_FRAME_POOL_HPP
+#define INCLUDED_TOYBRIDGE_DETAIL_FRAME_POOL_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/detail/memory.hpp>
+#include <srook/process/perror.hpp>
+#include <sys/mman.h>
+#include <atomic>
+#include <cstring>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+namespace detail {
+
+class frame_pool;
+
+// What precedes every buffer of a frame_pool.
+struct frame_header {
+    std::atomic<srook::uint32_t> refs;
+    // The next free buffer while this one is on the free list.
+    srook::uint32_t next;
+    // Where the frame begins, counted from the start of the buffer, and how long it is.
+    srook::uint32_t offset, length;
+    frame_pool* pool;
+};
+
+// A reference to a frame in a frame_pool. Copies share the frame, which goes back to its pool when
+// the last of them is gone, on whatever thread that happens.
+class frame_ref {
+public:
+    SROOK_FORCE_INLINE frame_ref() SROOK_NOEXCEPT_TRUE : h_(nullptr) {}
+    SROOK_FORCE_INLINE explicit frame_ref(frame_header* h) SROOK_NOEXCEPT_TRUE : h_(h) {}
+
+    SROOK_FORCE_INLINE frame_ref(const frame_ref& other) SROOK_NOEXCEPT_TRUE : h_(other.h_)
+    {
+        if (h_) h_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    SROOK_FORCE_INLINE frame_ref(frame_ref&& other) SROOK_NOEXCEPT_TRUE : h_(other.h_)
+    {
+        other.h_ = nullptr;
+    }
+
+    SROOK_FORCE_INLINE frame_ref& operator=(frame_ref other) SROOK_NOEXCEPT_TRUE
+    {
+        std::swap(h_, other.h_);
+        return *this;
+    }
+
+    SROOK_FORCE_INLINE ~frame_ref()
+    {
+        reset();
+    }
+
+    SROOK_FORCE_INLINE void reset() SROOK_NOEXCEPT_TRUE;
+
+    // Gives up the reference without dropping it, for adopting it again with frame_ref(h).
+    SROOK_FORCE_INLINE frame_header* release() SROOK_NOEXCEPT_TRUE
+    {
+        frame_header* h = h_;
+        h_ = nullptr;
+        return h;
+    }
+
+    SROOK_FORCE_INLINE explicit operator bool() const SROOK_NOEXCEPT_TRUE
+    {
+        return h_ != nullptr;
+    }
+
+    // Whether this is the only reference, so that the frame may be written to.
+    SROOK_FORCE_INLINE bool unique() const SROOK_NOEXCEPT_TRUE
+    {
+        return h_->refs.load(std::memory_order_acquire) == 1;
+    }
+
+    SROOK_FORCE_INLINE ::u_char* data() const SROOK_NOEXCEPT_TRUE
+    {
+        return reinterpret_cast<::u_char*>(h_) + h_->offset;
+    }
+
+    SROOK_FORCE_INLINE std::size_t size() const SROOK_NOEXCEPT_TRUE
+    {
+        return h_->length;
+    }
+
+    SROOK_FORCE_INLINE void resize(std::size_t n) SROOK_NOEXCEPT_TRUE
+    {
+        h_->length = static_cast<srook::uint32_t>(n);
+    }
+
+    // How long the frame may grow, from where it begins.
+    SROOK_FORCE_INLINE std::size_t capacity() const SROOK_NOEXCEPT_TRUE;
+
+    // How many bytes there are in front of the frame.
+    SROOK_FORCE_INLINE std::size_t headroom() const SROOK_NOEXCEPT_TRUE
+    {
+        return h_->offset - sizeof(frame_header);
+    }
+
+    // Empties the frame and moves its beginning back to where frame_pool::alloc() put it.
+    SROOK_FORCE_INLINE void rewind() SROOK_NOEXCEPT_TRUE;
+
+    // Moves the beginning of the frame n bytes towards the front of the buffer, or back with a
+    // negative n, and returns the new beginning. The bytes uncovered are left as they were.
+    SROOK_FORCE_INLINE ::u_char* push(std::ptrdiff_t n) SROOK_NOEXCEPT_TRUE
+    {
+        h_->offset = static_cast<srook::uint32_t>(std::ptrdiff_t(h_->offset) - n);
+        h_->length = static_cast<srook::uint32_t>(std::ptrdiff_t(h_->length) + n);
+        return data();
+    }
+private:
+    frame_header* h_;
+};
+
+// A fixed number of buffers of one size, mapped and faulted in all at once by the thread that makes
+// the pool, so that under the default first-touch policy they sit on that thread's NUMA node and the
+// thread never allocates again. Each buffer holds its frame_header, headroom bytes and then the frame.
+// Only the thread that makes the pool takes buffers from it; any thread may give them back, which
+// pushes them on a lock-free stack. Since nothing else pops, a pop can never see ABA.
+class frame_pool {
+public:
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t headroom = 64, default_count = 8192;
+
+    // Buffers for frames of up to frame_size bytes, as many as fit in about 32 MiB, but no fewer than
+    // 256 and no more than count, on huge pages with huge.
+    SROOK_FORCE_INLINE explicit frame_pool(std::size_t frame_size, std::size_t count = default_count, bool huge = false) SROOK_NOEXCEPT_TRUE
+        : stride_((sizeof(frame_header) + headroom + frame_size + 63) & ~std::size_t(63)), count_(pool_count(stride_, count)),
+        mapped_(stride_ * count_), base_(map_anonymous(mapped_, huge)), free_(none), available_(0)
+    {
+        if (base_ == MAP_FAILED) {
+            srook::process::perror("mmap");
+            return;
+        }
+        for (std::size_t i = count_; i-- > 0;) {
+            frame_header* h = header(static_cast<srook::uint32_t>(i));
+            h->refs.store(0, std::memory_order_relaxed);
+            h->pool = this;
+            give_back(h);
+        }
+    }
+
+    frame_pool(const frame_pool&) = delete;
+    frame_pool& operator=(const frame_pool&) = delete;
+
+    SROOK_FORCE_INLINE ~frame_pool()
+    {
+        if (base_ != MAP_FAILED) ::munmap(base_, mapped_);
+    }
+
+    SROOK_FORCE_INLINE explicit operator bool() const SROOK_NOEXCEPT_TRUE
+    {
+        return base_ != MAP_FAILED;
+    }
+
+    // An empty frame with headroom bytes in front of it, or nothing when every buffer is in use.
+    SROOK_FORCE_INLINE frame_ref alloc() SROOK_NOEXCEPT_TRUE
+    {
+        srook::uint32_t h = free_.load(std::memory_order_acquire);
+        do {
+            if (h == none) return frame_ref();
+        } while (!free_.compare_exchange_weak(h, header(h)->next, std::memory_order_acquire, std::memory_order_acquire));
+        available_.fetch_sub(1, std::memory_order_relaxed);
+        frame_header* f = header(h);
+        f->refs.store(1, std::memory_order_relaxed);
+        frame_ref r(f);
+        r.rewind();
+        return r;
+    }
+
+    SROOK_FORCE_INLINE void give_back(frame_header* f) SROOK_NOEXCEPT_TRUE
+    {
+        const srook::uint32_t i = static_cast<srook::uint32_t>((reinterpret_cast<char*>(f) - static_cast<char*>(base_)) / stride_);
+        srook::uint32_t h = free_.load(std::memory_order_relaxed);
+        do {
+            f->next = h;
+        } while (!free_.compare_exchange_weak(h, i, std::memory_order_release, std::memory_order_relaxed));
+        available_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    SROOK_FORCE_INLINE std::size_t capacity() const SROOK_NOEXCEPT_TRUE
+    {
+        return stride_ - sizeof(frame_header) - headroom;
+    }
+
+    SROOK_FORCE_INLINE std::size_t size() const SROOK_NOEXCEPT_TRUE
+    {
+        return count_;
+    }
+
+    // How many buffers are free; only a hint while other threads give buffers back.
+    SROOK_FORCE_INLINE std::size_t available() const SROOK_NOEXCEPT_TRUE
+    {
+        return available_.load(std::memory_order_relaxed);
+    }
+
+    SROOK_FORCE_INLINE std::size_t stride() const SROOK_NOEXCEPT_TRUE
+    {
+        return stride_;
+    }
+private:
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST srook::uint32_t none = ~srook::uint32_t(0);
+
+    SROOK_FORCE_INLINE static std::size_t pool_count(std::size_t stride, std::size_t count) SROOK_NOEXCEPT_TRUE
+    {
+        const std::size_t fit = (std::size_t(1) << 25) / stride;
+        return fit < 256 ? 256 : fit < count ? fit : count;
+    }
+
+    SROOK_FORCE_INLINE frame_header* header(srook::uint32_t i) const SROOK_NOEXCEPT_TRUE
+    {
+        return reinterpret_cast<frame_header*>(static_cast<char*>(base_) + std::size_t(i) * stride_);
+    }
+
+    std::size_t stride_, count_, mapped_;
+    void* base_;
+    char pad0_[64];
+    std::atomic<srook::uint32_t> free_;
+    std::atomic<std::size_t> available_;
+};
+
+SROOK_FORCE_INLINE void frame_ref::reset() SROOK_NOEXCEPT_TRUE
+{
+    if (h_ && h_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) h_->pool->give_back(h_);
+    h_ = nullptr;
+}
+
+SROOK_FORCE_INLINE void frame_ref::rewind() SROOK_NOEXCEPT_TRUE
+{
+    h_->offset = static_cast<srook::uint32_t>(sizeof(frame_header) + frame_pool::headroom);
+    h_->length = 0;
+}
+
+SROOK_FORCE_INLINE std::size_t frame_ref::capacity() const SROOK_NOEXCEPT_TRUE
+{
+    return h_->pool->stride() - h_->offset;
+}
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
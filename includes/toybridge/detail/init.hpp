@@ -5,7 +5,7 @@
 #include <linux/if.h>
 #include <sys/ioctl.h>
 #include <net/ethernet.h>
-#include <netpacket/packet.h>
+#include <linux/if_packet.h>
 #include <algorithm>
 #include <iomanip>
 #include <iostream>
@@ -17,6 +17,10 @@
 #include <srook/range/adaptor/transformed.hpp>
 #include <srook/string/string_view.hpp>
 
+#ifndef SO_PREFER_BUSY_POLL
+#   define SO_PREFER_BUSY_POLL 69
+#endif
+
 namespace toybridge {
 SROOK_INLINE_NAMESPACE(v1)
 
@@ -48,10 +52,41 @@ SROOK_NOEXCEPT_TRUE
     return ::bind(sockfd, addr, addrlen) < 0 ? error_close("bind", sockfd), srook::nullopt : srook::make_optional(sockfd);
 }
 
-srook::optional<int> init(srook::string_view device, srook::uint32_t filter = ETH_P_ALL, bool pb = false) 
+srook::optional<int> setsockopt(int soc, int level, int name, const void* val, ::socklen_t len)
+SROOK_NOEXCEPT_TRUE
+{
+    return ::setsockopt(soc, level, name, val, len) < 0 ? error_close("setsockopt", soc), srook::nullopt : srook::make_optional(soc);
+}
+
+// Has every receive on soc poll the device queue for up to usecs microseconds before it sleeps or,
+// when it would not block, returns empty, and asks for the device's interrupts to stay off while
+// it is polled that way (SO_PREFER_BUSY_POLL, Linux 5.11), where the kernel knows how.
+srook::optional<int> busy_poll(int soc, unsigned int usecs)
 SROOK_NOEXCEPT_TRUE
 {
-    return toybridge::detail::socket(PF_PACKET, SOCK_RAW, htons(filter)) >>= [&](int soc) -> srook::optional<int> {
+    const int v = static_cast<int>(usecs), one = 1;
+    return toybridge::detail::setsockopt(soc, SOL_SOCKET, SO_BUSY_POLL, &v, sizeof(v)) >>= [&one](int soc) -> srook::optional<int> {
+        SROOK_ATTRIBUTE_UNUSED const int r = ::setsockopt(soc, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one));
+        return { soc };
+    };
+}
+
+// sizeof(struct virtio_net_hdr); <linux/virtio_net.h> does not compile as C++.
+SROOK_INLINE_VARIABLE SROOK_CONSTEXPR_OR_CONST std::size_t vnet_hdr_size = 10;
+
+// With vnet_hdr, every frame read from or written to the socket is preceded by a virtio_net_hdr,
+// so that GSO super-packets pass through it whole instead of being segmented first. A busy_poll of
+// more than 0 microseconds has receives busy poll the device as busy_poll() does.
+srook::optional<int> 
+init(srook::string_view device, srook::uint32_t filter = ETH_P_ALL, bool pb = false, bool vnet_hdr = false, unsigned int busy_usecs = 0) 
+SROOK_NOEXCEPT_TRUE
+{
+    const int one = 1;
+    return ((toybridge::detail::socket(PF_PACKET, SOCK_RAW, htons(filter)) >>= [&](int soc) -> srook::optional<int> {
+        return vnet_hdr ? toybridge::detail::setsockopt(soc, SOL_PACKET, PACKET_VNET_HDR, &one, sizeof(one)) : srook::make_optional(soc);
+    }) >>= [&](int soc) -> srook::optional<int> {
+        return busy_usecs ? toybridge::detail::busy_poll(soc, busy_usecs) : srook::make_optional(soc);
+    }) >>= [&](int soc) -> srook::optional<int> {
         ::ifreq ifr{};
         std::size_t devsize = device.size() < sizeof(ifr.ifr_name) - 1 ? device.size() : sizeof(ifr.ifr_name) - 1;
         std::copy_n(device.cbegin(), srook::move(devsize), ifr.ifr_name);
@@ -75,6 +110,14 @@ SROOK_NOEXCEPT_TRUE
     };
 }
 
+// The MTU of device, asked through soc, or 0 when it cannot be told.
+SROOK_FORCE_INLINE std::size_t mtu(int soc, srook::string_view device) SROOK_NOEXCEPT_TRUE
+{
+    ::ifreq ifr{};
+    std::copy_n(device.cbegin(), std::min(device.size(), sizeof(ifr.ifr_name) - 1), ifr.ifr_name);
+    return ::ioctl(soc, SIOCGIFMTU, &ifr) < 0 ? 0 : std::size_t(ifr.ifr_mtu);
+}
+
 } // namespace detail
 
 SROOK_INLINE_NAMESPACE_END
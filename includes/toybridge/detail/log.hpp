@@ -0,0 +1,184 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_DETAIL_LOG_HPP
+#define INCLUDED_TOYBRIDGE_DETAIL_LOG_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/detail/out.hpp>
+#include <srook/cstring/memcpy.hpp>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+namespace detail {
+
+// What is logged about one received frame: its Ethernet header as it was on the wire,
+// and enough to tell where and when it came in. A binary log file is a log_magic
+// followed by nothing but these, in host byte order.
+struct log_record {
+    srook::uint64_t timestamp; // CLOCK_REALTIME, in nanoseconds
+    srook::uint32_t length;
+    srook::uint16_t port;
+    ::u_char header[ETH_HLEN];
+};
+static_assert(sizeof(log_record) == 32, "log_record is written to files as is");
+
+SROOK_INLINE_VARIABLE SROOK_CONSTEXPR_OR_CONST char log_magic[8] = { 'T', 'B', 'L', 'O', 'G', '1', '\0', '\0' };
+
+// Formats a record exactly as dump() would have printed the frame.
+SROOK_FORCE_INLINE std::ostream& out(std::ostream& os, const log_record& r)
+{
+    if (r.length < sizeof(::ether_header)) return os << '[' << r.port << "]: size(" << r.length << ") < sizeof(::ether_header)\n";
+    ::ether_header eh {};
+    srook::cstring::memcpy(&eh, r.header, sizeof(eh));
+    os << '[' << r.port << ']';
+    return out(os, eh) << '\n';
+}
+
+// A bounded single-producer, single-consumer queue of log records. The producer never
+// waits: a record that finds the ring full is dropped and counted.
+class log_ring {
+public:
+    SROOK_FORCE_INLINE explicit log_ring(std::size_t n)
+        : records_(capacity(n)), mask_(records_.size() - 1), head_(0), tail_(0), drops_(0)
+    {}
+
+    SROOK_FORCE_INLINE bool push(std::size_t port, const ::u_char* data, std::size_t len) SROOK_NOEXCEPT_TRUE
+    {
+        const std::size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) > mask_) {
+            drops_.store(drops_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        log_record& r = records_[tail & mask_];
+        ::timespec ts{};
+        ::clock_gettime(CLOCK_REALTIME, &ts);
+        r.timestamp = srook::uint64_t(ts.tv_sec) * 1000000000 + srook::uint64_t(ts.tv_nsec);
+        r.length = static_cast<srook::uint32_t>(len);
+        r.port = static_cast<srook::uint16_t>(port);
+        std::memcpy(r.header, data, std::min(len, sizeof(r.header)));
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Hands every queued record to fn and returns how many there were.
+    template <class F>
+    SROOK_FORCE_INLINE std::size_t drain(F&& fn)
+    {
+        const std::size_t head = head_.load(std::memory_order_relaxed), tail = tail_.load(std::memory_order_acquire);
+        for (std::size_t i = head; i != tail; ++i) fn(records_[i & mask_]);
+        head_.store(tail, std::memory_order_release);
+        return tail - head;
+    }
+
+    SROOK_FORCE_INLINE srook::uint64_t drops() const SROOK_NOEXCEPT_TRUE
+    {
+        return drops_.load(std::memory_order_relaxed);
+    }
+private:
+    SROOK_FORCE_INLINE static std::size_t capacity(std::size_t n) SROOK_NOEXCEPT_TRUE
+    {
+        std::size_t c = 2;
+        while (c < n) c <<= 1;
+        return c;
+    }
+
+    std::vector<log_record> records_;
+    std::size_t mask_;
+    // The consumer's and the producer's side sit a cache line apart. The padding is explicit
+    // because rings are heap-allocated, and C++14 new ignores extended alignment.
+    char pad0_[64];
+    std::atomic<std::size_t> head_;
+    char pad1_[64];
+    std::atomic<std::size_t> tail_;
+    std::atomic<srook::uint64_t> drops_;
+};
+
+// Owns one log_ring per forwarding thread and the thread that empties them, either as
+// text or, when binary, as raw records behind a log_magic. While every ring stays empty
+// the logger backs off to sleeping max_idle at a time.
+class logger {
+public:
+    SROOK_FORCE_INLINE logger(std::size_t producers, std::size_t ring_size)
+    {
+        rings_.reserve(producers);
+        for (std::size_t i = 0; i < producers; ++i) rings_.emplace_back(new log_ring(ring_size));
+    }
+
+    SROOK_FORCE_INLINE log_ring& ring(std::size_t i) SROOK_NOEXCEPT_TRUE
+    {
+        return *rings_[i];
+    }
+
+    SROOK_FORCE_INLINE void start(std::ostream& os, bool binary)
+    {
+        running_ = true;
+        if (binary) os.write(log_magic, sizeof(log_magic));
+        thread_ = std::thread([&os, binary, this] {
+            long idle = 0;
+            for (bool last = false; !last;) {
+                last = !running_.load(std::memory_order_acquire);
+                if (drain(os, binary)) {
+                    idle = 0;
+                } else if (!last) {
+                    idle = !idle ? min_idle : idle * 2 < max_idle ? idle * 2 : max_idle;
+                    std::this_thread::sleep_for(std::chrono::microseconds(idle));
+                }
+            }
+            os.flush();
+        });
+    }
+
+    // Writes out whatever is still queued and joins the logger thread.
+    SROOK_FORCE_INLINE void stop()
+    {
+        running_ = false;
+        if (thread_.joinable()) thread_.join();
+    }
+
+    SROOK_FORCE_INLINE ~logger()
+    {
+        stop();
+    }
+
+    SROOK_FORCE_INLINE srook::uint64_t drops() const SROOK_NOEXCEPT_TRUE
+    {
+        srook::uint64_t n = 0;
+        for (const std::unique_ptr<log_ring>& r : rings_) n += r->drops();
+        return n;
+    }
+private:
+    // Microseconds.
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST long min_idle = 50, max_idle = 20000;
+
+    SROOK_FORCE_INLINE std::size_t drain(std::ostream& os, bool binary)
+    {
+        std::size_t n = 0;
+        for (const std::unique_ptr<log_ring>& r : rings_) {
+            n += r->drain([&os, binary](const log_record& rec) {
+                if (binary) os.write(reinterpret_cast<const char*>(&rec), sizeof(rec));
+                else out(os, rec);
+            });
+        }
+        return n;
+    }
+
+    std::vector<std::unique_ptr<log_ring>> rings_;
+    std::atomic<bool> running_{ false };
+    std::thread thread_;
+};
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
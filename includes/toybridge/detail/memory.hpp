@@ -0,0 +1,46 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_DETAIL_MEMORY_HPP
+#define INCLUDED_TOYBRIDGE_DETAIL_MEMORY_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <sys/mman.h>
+#include <cstdint>
+#include <cstring>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+namespace detail {
+
+SROOK_INLINE_VARIABLE SROOK_CONSTEXPR_OR_CONST std::size_t huge_page_size = std::size_t(1) << 21;
+
+// size bytes of private anonymous memory, faulted in at once by the calling thread. With huge,
+// size is rounded up to whole 2 MiB pages, which come from the hugetlbfs pool when it has enough
+// of them, or else are aligned to 2 MiB and left to transparent huge pages. Returns MAP_FAILED
+// when there is no memory; size is then what has to be unmapped.
+SROOK_FORCE_INLINE void* map_anonymous(std::size_t& size, bool huge) SROOK_NOEXCEPT_TRUE
+{
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (!huge) return ::mmap(nullptr, size, PROT_READ | PROT_WRITE, flags | MAP_POPULATE, -1, 0);
+
+    size = (size + huge_page_size - 1) & ~(huge_page_size - 1);
+    void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, flags | MAP_POPULATE | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) return p;
+
+    // Transparent huge pages only back whole aligned 2 MiB ranges: map one more and trim both ends.
+    char* const raw = static_cast<char*>(::mmap(nullptr, size + huge_page_size, PROT_READ | PROT_WRITE, flags, -1, 0));
+    if (raw == MAP_FAILED) return MAP_FAILED;
+    char* const aligned = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(raw) + huge_page_size - 1) & ~(huge_page_size - 1));
+    if (aligned != raw) ::munmap(raw, std::size_t(aligned - raw));
+    if (const std::size_t tail = huge_page_size - std::size_t(aligned - raw)) ::munmap(aligned + size, tail);
+    ::madvise(aligned, size, MADV_HUGEPAGE);
+    std::memset(aligned, 0, size);
+    return aligned;
+}
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
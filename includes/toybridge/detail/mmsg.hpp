@@ -0,0 +1,251 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_DETAIL_MMSG_HPP
+#define INCLUDED_TOYBRIDGE_DETAIL_MMSG_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/detail/frame_pool.hpp>
+#include <toybridge/detail/vlan.hpp>
+#include <toybridge/devinfo.hpp>
+#include <srook/optional.hpp>
+#include <sys/uio.h>
+#include <cerrno>
+#include <numeric>
+#include <ostream>
+#include <vector>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+namespace detail {
+
+// A pool of frame buffers that is filled by one recvmmsg(2) and flushed by one
+// sendmmsg(2) per egress port. Every batch that is received is also recorded by its fill level,
+// so that it can be told whether the loop is syscall-bound (mostly full batches)
+// or idle (mostly single frames). Once given a frame_pool, the batch receives into frames of
+// the pool, and a frame that is still referenced elsewhere when the next batch comes in is
+// swapped for a fresh one; the batch's own buffers are only used while the pool has none. Every
+// buffer has room for an 802.1Q tag in front of it.
+class mmsg_batch {
+public:
+    SROOK_FORCE_INLINE explicit mmsg_batch(std::size_t n, std::size_t frame_size = 1 << 11)
+        : frames_(n * (vlan_tag_size + frame_size)), refs_(n), iov_(n), msgs_(n), routes_(n), out_iov_(2 * n), out_(n), picked_(n), fill_(n + 1),
+        frame_size_(frame_size), received_(0), selected_(0), truncated_(0), pool_(nullptr)
+    {
+        for (std::size_t i = 0; i < n; ++i) {
+            iov_[i].iov_base = own(i);
+            iov_[i].iov_len = frame_size;
+            msgs_[i].msg_hdr.msg_iov = &iov_[i];
+            msgs_[i].msg_hdr.msg_iovlen = 1;
+            out_[i].msg_hdr.msg_iov = &out_iov_[2 * i];
+        }
+    }
+
+    SROOK_FORCE_INLINE std::size_t size() const SROOK_NOEXCEPT_TRUE
+    {
+        return msgs_.size();
+    }
+
+    SROOK_FORCE_INLINE void use(frame_pool* pool) SROOK_NOEXCEPT_TRUE
+    {
+        pool_ = pool;
+    }
+
+    // Has every frame that the kernel took an 802.1Q tag off tagged again, for sockets with
+    // PACKET_AUXDATA on.
+    SROOK_FORCE_INLINE void restore_tags() SROOK_NOEXCEPT_TRUE
+    {
+        tags_ = true;
+        control(auxdata_space);
+    }
+
+    // Keeps the receive timestamps of the frames, for sockets with timestamping() on.
+    SROOK_FORCE_INLINE void keep_timestamps() SROOK_NOEXCEPT_TRUE
+    {
+        control(timestamping_space);
+    }
+
+    // Drains up to size() frames from soc without blocking.
+    SROOK_FORCE_INLINE srook::optional<int> recv(int soc) SROOK_NOEXCEPT_TRUE
+    {
+        // The last batch may have moved where its frames begin.
+        for (std::size_t i = 0; i < refs_.size(); ++i) {
+            if (refs_[i] && refs_[i].unique()) refs_[i].rewind();
+            else if (pool_) refs_[i] = pool_->alloc();
+            iov_[i].iov_base = refs_[i] ? refs_[i].data() : own(i);
+        }
+        for (std::size_t i = 0; control_space_ && i < msgs_.size(); ++i) {
+            msgs_[i].msg_hdr.msg_control = &control_[i * control_space_];
+            msgs_[i].msg_hdr.msg_controllen = control_space_;
+        }
+        const int n = ::recvmmsg(soc, msgs_.data(), static_cast<unsigned int>(msgs_.size()), MSG_DONTWAIT, nullptr);
+        received_ = n < 0 ? 0 : std::size_t(n);
+        if (n < 0) return errno == EAGAIN ? srook::make_optional(0) : srook::nullopt;
+        ++fill_[received_];
+        return { n };
+    }
+
+    // Asks route(data, length, frame) for the egress ports of every received frame, frame being
+    // its frame_ref when it is in the pool and empty otherwise, and returns every port that at
+    // least one of them goes to. route may move the beginning of the frame into the room in front
+    // of it through data and length. A frame that did not fit its buffer goes nowhere and is only
+    // counted by truncated().
+    template <class F>
+    SROOK_FORCE_INLINE port_mask select(F&& route)
+    {
+        port_mask any = 0;
+        truncated_ = 0;
+        for (std::size_t i = 0; i < received_; ++i) {
+            if (msgs_[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                routes_[i] = 0;
+                ++truncated_;
+                continue;
+            }
+            ::u_char* data = static_cast<::u_char*>(iov_[i].iov_base);
+            std::size_t len = msgs_[i].msg_len;
+            if (tags_) data = restore_tag(msgs_[i].msg_hdr, data, len);
+            if (refs_[i]) {
+                refs_[i].push(refs_[i].data() - data);
+                refs_[i].resize(len);
+            }
+            routes_[i] = route(data, len, static_cast<const frame_ref&>(refs_[i]));
+            if (refs_[i]) {
+                refs_[i].push(refs_[i].data() - data);
+                refs_[i].resize(len);
+            }
+            iov_[i].iov_base = data;
+            msgs_[i].msg_len = static_cast<unsigned int>(len);
+            any |= routes_[i];
+        }
+        return any;
+    }
+
+    SROOK_FORCE_INLINE std::size_t truncated() const SROOK_NOEXCEPT_TRUE
+    {
+        return truncated_;
+    }
+
+    // Calls fn(timestamp) with the receive timestamp of every selected frame that went anywhere
+    // and has one, with keep_timestamps().
+    template <class F>
+    SROOK_FORCE_INLINE void for_each_timestamp(F&& fn) const
+    {
+        for (std::size_t i = 0; control_space_ && i < received_; ++i) {
+            if (!routes_[i]) continue;
+            if (const srook::uint64_t t = rx_timestamp(msgs_[i].msg_hdr)) fn(t);
+        }
+    }
+
+    // Queues for send() every received frame that is routed to port. A frame for which
+    // untag(data) holds goes out without its 802.1Q tag, which is skipped rather than moved.
+    template <class F>
+    SROOK_FORCE_INLINE std::size_t gather(std::size_t port, F&& untag)
+    {
+        selected_ = 0;
+        for (std::size_t i = 0; i < received_; ++i) {
+            if (!(routes_[i] & (port_mask(1) << port))) continue;
+            ::u_char* const data = static_cast<::u_char*>(iov_[i].iov_base);
+            ::iovec* const iov = &out_iov_[2 * selected_];
+            if (untag(static_cast<const ::u_char*>(data))) {
+                iov[0].iov_base = data;
+                iov[0].iov_len = 2 * ETH_ALEN;
+                iov[1].iov_base = data + 2 * ETH_ALEN + vlan_tag_size;
+                iov[1].iov_len = msgs_[i].msg_len - 2 * ETH_ALEN - vlan_tag_size;
+                out_[selected_].msg_hdr.msg_iovlen = 2;
+            } else {
+                iov[0].iov_base = data;
+                iov[0].iov_len = msgs_[i].msg_len;
+                out_[selected_].msg_hdr.msg_iovlen = 1;
+            }
+            picked_[selected_++] = i;
+        }
+        return selected_;
+    }
+
+    // Calls fn(data, length, frame) for every gathered frame from the first-th on, as it was
+    // received, frame being as for select().
+    template <class F>
+    SROOK_FORCE_INLINE void for_each_selected(F&& fn, std::size_t first = 0)
+    {
+        for (std::size_t i = first; i < selected_; ++i) {
+            const std::size_t k = picked_[i];
+            fn(static_cast<::u_char*>(iov_[k].iov_base), std::size_t(msgs_[k].msg_len), static_cast<const frame_ref&>(refs_[k]));
+        }
+    }
+
+    // Sends gathered frames out of soc until one fails and returns how many went out; when the
+    // socket could not take the rest right now, errno tells EAGAIN or ENOBUFS.
+    SROOK_FORCE_INLINE srook::optional<std::size_t> send(int soc) SROOK_NOEXCEPT_TRUE
+    {
+        std::size_t sent = 0;
+        while (sent < selected_) {
+            const int n = ::sendmmsg(soc, &out_[sent], static_cast<unsigned int>(selected_ - sent), MSG_DONTWAIT);
+            if (n < 0) return errno == EAGAIN || errno == ENOBUFS ? srook::make_optional(sent) : srook::nullopt;
+            sent += std::size_t(n);
+        }
+        return { sent };
+    }
+
+    // The total length of the first n gathered frames, as they are sent.
+    SROOK_FORCE_INLINE std::size_t bytes(std::size_t n) const SROOK_NOEXCEPT_TRUE
+    {
+        std::size_t b = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            for (std::size_t j = 0; j < out_[i].msg_hdr.msg_iovlen; ++j) b += out_iov_[2 * i + j].iov_len;
+        }
+        return b;
+    }
+
+    SROOK_FORCE_INLINE std::size_t selected() const SROOK_NOEXCEPT_TRUE
+    {
+        return selected_;
+    }
+
+    SROOK_FORCE_INLINE std::ostream& report(std::ostream& os) const
+    {
+        const srook::uint64_t batches = std::accumulate(std::next(fill_.cbegin()), fill_.cend(), srook::uint64_t(0));
+        srook::uint64_t frames = 0;
+        for (std::size_t i = 1; i < fill_.size(); ++i) frames += i * fill_[i];
+        os << "recvmmsg batches: " << batches << ", frames: " << frames;
+        if (batches) {
+            os << ", mean fill: " << double(frames) / batches << '/' << size()
+                << ", full: " << 100.0 * fill_.back() / batches << '%';
+        }
+        return os << '\n';
+    }
+private:
+    // Adds room for a control message of space bytes to that of every frame.
+    SROOK_FORCE_INLINE void control(std::size_t space)
+    {
+        control_space_ += space;
+        control_.resize(msgs_.size() * control_space_);
+    }
+
+    SROOK_FORCE_INLINE ::u_char* own(std::size_t i) SROOK_NOEXCEPT_TRUE
+    {
+        return &frames_[i * (vlan_tag_size + frame_size_) + vlan_tag_size];
+    }
+
+    std::vector<::u_char> frames_;
+    std::vector<frame_ref> refs_;
+    std::vector<::iovec> iov_;
+    std::vector<::mmsghdr> msgs_;
+    std::vector<port_mask> routes_;
+    std::vector<::iovec> out_iov_;
+    std::vector<::mmsghdr> out_;
+    std::vector<std::size_t> picked_;
+    std::vector<srook::uint64_t> fill_;
+    // Per frame, room for a PACKET_AUXDATA message with restore_tags() and an SCM_TIMESTAMPING one
+    // with keep_timestamps().
+    std::vector<char> control_;
+    std::size_t control_space_ = 0;
+    bool tags_ = false;
+    std::size_t frame_size_, received_, selected_, truncated_;
+    frame_pool* pool_;
+};
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
@@ -0,0 +1,342 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_DETAIL_PCAPNG_HPP
+#define INCLUDED_TOYBRIDGE_DETAIL_PCAPNG_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/detail/frame_pool.hpp>
+#include <srook/process/perror.hpp>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+namespace detail {
+
+// What and where to capture. Frames are cut to snaplen bytes. With rotation on, files are named
+// path.0, path.1, ... and the next one is begun once the current one has reached rotate_size
+// bytes or is rotate_seconds old, checked whenever the buffer is written out.
+struct capture_config {
+    std::string path;
+    std::size_t snaplen = 256;
+    std::size_t ring = 1 << 12;
+    std::size_t rotate_size = 0;
+    unsigned int rotate_seconds = 0;
+    // Only every sample-th frame of a worker is captured, and only frames of ethertype when it is set.
+    std::size_t sample = 1;
+    srook::uint16_t ethertype = 0;
+};
+
+// A bounded single-producer, single-consumer queue of captured frames, each in a slot of
+// the same size. A frame that finds the ring full is dropped and counted. A frame in a
+// frame_pool may be queued by reference instead, which the ring holds until it is drained.
+class capture_ring {
+public:
+    struct slot {
+        srook::uint64_t timestamp; // CLOCK_REALTIME, in nanoseconds
+        srook::uint32_t length;
+        srook::uint16_t port;
+        srook::uint16_t caplen;
+        // The referenced frame and where in it the captured bytes begin, or null when they were copied.
+        frame_header* frame;
+        const ::u_char* data;
+    };
+
+    SROOK_FORCE_INLINE capture_ring(std::size_t n, std::size_t snaplen)
+        : snaplen_(snaplen < max_snaplen ? snaplen : max_snaplen), stride_((sizeof(slot) + snaplen_ + 7) & ~std::size_t(7)), mask_(capacity(n) - 1),
+        slots_((mask_ + 1) * stride_), head_(0), tail_(0), drops_(0)
+    {}
+
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t max_snaplen = 0xffff;
+
+    SROOK_FORCE_INLINE bool push(std::size_t port, const ::u_char* data, std::size_t len) SROOK_NOEXCEPT_TRUE
+    {
+        return enqueue(port, data, len, nullptr);
+    }
+
+    // Queues data, len bytes of the frame f, without copying it.
+    SROOK_FORCE_INLINE bool push(std::size_t port, frame_ref f, const ::u_char* data, std::size_t len) SROOK_NOEXCEPT_TRUE
+    {
+        return enqueue(port, data, len, f.release());
+    }
+
+    // Hands every queued frame to fn(slot, data) and returns how many there were.
+    template <class F>
+    SROOK_FORCE_INLINE std::size_t drain(F&& fn)
+    {
+        const std::size_t head = head_.load(std::memory_order_relaxed), tail = tail_.load(std::memory_order_acquire);
+        for (std::size_t i = head; i != tail; ++i) {
+            const ::u_char* p = &slots_[(i & mask_) * stride_];
+            slot s;
+            std::memcpy(&s, p, sizeof(s));
+            fn(s, s.frame ? s.data : p + sizeof(s));
+            if (s.frame) frame_ref(s.frame).reset();
+        }
+        head_.store(tail, std::memory_order_release);
+        return tail - head;
+    }
+
+    SROOK_FORCE_INLINE srook::uint64_t drops() const SROOK_NOEXCEPT_TRUE
+    {
+        return drops_.load(std::memory_order_relaxed);
+    }
+private:
+    // Takes over the reference to frame, if any, when there is room; drops it otherwise.
+    SROOK_FORCE_INLINE bool enqueue(std::size_t port, const ::u_char* data, std::size_t len, frame_header* frame) SROOK_NOEXCEPT_TRUE
+    {
+        const std::size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) > mask_) {
+            drops_.store(drops_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            frame_ref(frame).reset();
+            return false;
+        }
+        ::u_char* p = &slots_[(tail & mask_) * stride_];
+        slot s;
+        ::timespec ts{};
+        ::clock_gettime(CLOCK_REALTIME, &ts);
+        s.timestamp = srook::uint64_t(ts.tv_sec) * 1000000000 + srook::uint64_t(ts.tv_nsec);
+        s.length = static_cast<srook::uint32_t>(len);
+        s.port = static_cast<srook::uint16_t>(port);
+        s.caplen = static_cast<srook::uint16_t>(std::min(len, snaplen_));
+        s.frame = frame;
+        s.data = frame ? data : nullptr;
+        std::memcpy(p, &s, sizeof(s));
+        if (!frame) std::memcpy(p + sizeof(s), data, s.caplen);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    SROOK_FORCE_INLINE static std::size_t capacity(std::size_t n) SROOK_NOEXCEPT_TRUE
+    {
+        std::size_t c = 2;
+        while (c < n) c <<= 1;
+        return c;
+    }
+
+    std::size_t snaplen_, stride_, mask_;
+    std::vector<::u_char> slots_;
+    char pad0_[64];
+    std::atomic<std::size_t> head_;
+    char pad1_[64];
+    std::atomic<std::size_t> tail_;
+    std::atomic<srook::uint64_t> drops_;
+};
+
+// Owns one capture_ring per forwarding thread and the thread that writes them out as pcapng,
+// one interface description per bridge port, so that the interface ID of every packet is
+// the port it came in on. Blocks are gathered in a buffer and appended write_size bytes at a time.
+class capture {
+public:
+    SROOK_FORCE_INLINE capture(std::size_t producers, const capture_config& cfg, std::vector<std::string> ports)
+        : cfg_(cfg), ports_(srook::move(ports)), fd_(-1), files_(0), written_(0)
+    {
+        if (cfg_.snaplen > capture_ring::max_snaplen) cfg_.snaplen = capture_ring::max_snaplen;
+        rings_.reserve(producers);
+        for (std::size_t i = 0; i < producers; ++i) rings_.emplace_back(new capture_ring(cfg_.ring, cfg_.snaplen));
+        buf_.reserve(write_size + block_size(cfg_.snaplen));
+    }
+
+    SROOK_FORCE_INLINE capture_ring& ring(std::size_t i) SROOK_NOEXCEPT_TRUE
+    {
+        return *rings_[i];
+    }
+
+    SROOK_FORCE_INLINE bool start()
+    {
+        if (!open()) return false;
+        running_ = true;
+        thread_ = std::thread([this] {
+            long idle = 0;
+            for (bool last = false; !last;) {
+                last = !running_.load(std::memory_order_acquire);
+                std::size_t n = 0;
+                for (const std::unique_ptr<capture_ring>& r : rings_) {
+                    n += r->drain([this](const capture_ring::slot& s, const ::u_char* data) {
+                        packet(s, data);
+                        if (buf_.size() >= write_size) flush();
+                    });
+                }
+                if (n && !last) {
+                    idle = 0;
+                    continue;
+                }
+                // Nothing came in: this is when a partly filled buffer goes to disk.
+                flush();
+                if (!last) {
+                    idle = !idle ? min_idle : idle * 2 < max_idle ? idle * 2 : max_idle;
+                    std::this_thread::sleep_for(std::chrono::microseconds(idle));
+                }
+            }
+            if (fd_ >= 0) ::close(fd_);
+            fd_ = -1;
+        });
+        return true;
+    }
+
+    // Writes out whatever is still queued and joins the writer thread.
+    SROOK_FORCE_INLINE void stop()
+    {
+        running_ = false;
+        if (thread_.joinable()) thread_.join();
+    }
+
+    SROOK_FORCE_INLINE ~capture()
+    {
+        stop();
+        if (fd_ >= 0) ::close(fd_);
+    }
+
+    SROOK_FORCE_INLINE srook::uint64_t drops() const SROOK_NOEXCEPT_TRUE
+    {
+        srook::uint64_t n = 0;
+        for (const std::unique_ptr<capture_ring>& r : rings_) n += r->drops();
+        return n;
+    }
+private:
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t write_size = 1 << 20;
+    // Microseconds.
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST long min_idle = 50, max_idle = 20000;
+
+    SROOK_FORCE_INLINE static std::size_t pad(std::size_t n) SROOK_NOEXCEPT_TRUE
+    {
+        return (n + 3) & ~std::size_t(3);
+    }
+
+    // The size of an enhanced packet block that carries n bytes of packet data.
+    SROOK_FORCE_INLINE static std::size_t block_size(std::size_t n) SROOK_NOEXCEPT_TRUE
+    {
+        return 32 + pad(n);
+    }
+
+    SROOK_FORCE_INLINE void put(const void* p, std::size_t n)
+    {
+        const char* c = static_cast<const char*>(p);
+        buf_.insert(buf_.end(), c, c + n);
+    }
+
+    SROOK_FORCE_INLINE void put32(srook::uint32_t v) { put(&v, sizeof(v)); }
+    SROOK_FORCE_INLINE void put16(srook::uint16_t v) { put(&v, sizeof(v)); }
+
+    SROOK_FORCE_INLINE void option(srook::uint16_t code, const void* p, std::size_t n)
+    {
+        put16(code);
+        put16(static_cast<srook::uint16_t>(n));
+        put(p, n);
+        buf_.resize(buf_.size() + pad(n) - n);
+    }
+
+    // A section header block followed by an interface description block per port.
+    SROOK_FORCE_INLINE void header()
+    {
+        put32(0x0a0d0d0a);
+        put32(28);
+        put32(0x1a2b3c4d);
+        put16(1);
+        put16(0);
+        const srook::uint64_t unknown_length = ~srook::uint64_t(0);
+        put(&unknown_length, sizeof(unknown_length));
+        put32(28);
+
+        for (const std::string& name : ports_) {
+            const std::size_t start = buf_.size();
+            put32(1);
+            put32(0);
+            put16(1); // LINKTYPE_ETHERNET
+            put16(0);
+            put32(static_cast<srook::uint32_t>(cfg_.snaplen));
+            option(2, name.data(), name.size()); // if_name
+            const ::u_char nanoseconds = 9;
+            option(9, &nanoseconds, 1); // if_tsresol
+            option(0, nullptr, 0);
+            put32(static_cast<srook::uint32_t>(buf_.size() - start + 4));
+            const srook::uint32_t len = static_cast<srook::uint32_t>(buf_.size() - start);
+            std::memcpy(&buf_[start + 4], &len, sizeof(len));
+        }
+    }
+
+    // An enhanced packet block.
+    SROOK_FORCE_INLINE void packet(const capture_ring::slot& s, const ::u_char* data)
+    {
+        const srook::uint32_t len = static_cast<srook::uint32_t>(block_size(s.caplen));
+        put32(6);
+        put32(len);
+        put32(s.port);
+        put32(static_cast<srook::uint32_t>(s.timestamp >> 32));
+        put32(static_cast<srook::uint32_t>(s.timestamp));
+        put32(s.caplen);
+        put32(s.length);
+        put(data, s.caplen);
+        buf_.resize(buf_.size() + pad(s.caplen) - s.caplen);
+        put32(len);
+    }
+
+    SROOK_FORCE_INLINE bool open()
+    {
+        const std::string path = cfg_.rotate_size || cfg_.rotate_seconds ? cfg_.path + '.' + std::to_string(files_) : cfg_.path;
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ < 0) {
+            srook::process::perror(path.c_str());
+            return false;
+        }
+        ++files_;
+        written_ = 0;
+        opened_ = std::chrono::steady_clock::now();
+        header();
+        return true;
+    }
+
+    // Appends the buffer to the current file and moves on to the next one when it is due.
+    // Once a file cannot be written to, everything captured after that is discarded.
+    SROOK_FORCE_INLINE void flush()
+    {
+        if (fd_ < 0) {
+            buf_.clear();
+            return;
+        }
+        for (std::size_t off = 0; off < buf_.size();) {
+            const ::ssize_t n = ::write(fd_, buf_.data() + off, buf_.size() - off);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                srook::process::perror("write");
+                ::close(fd_);
+                fd_ = -1;
+                break;
+            }
+            off += std::size_t(n);
+        }
+        written_ += buf_.size();
+        buf_.clear();
+
+        if (fd_ >= 0 && ((cfg_.rotate_size && written_ >= cfg_.rotate_size) ||
+                    (cfg_.rotate_seconds && std::chrono::steady_clock::now() - opened_ >= std::chrono::seconds(cfg_.rotate_seconds)))) {
+            ::close(fd_);
+            open();
+        }
+    }
+
+    capture_config cfg_;
+    std::vector<std::string> ports_;
+    std::vector<std::unique_ptr<capture_ring>> rings_;
+    std::vector<char> buf_;
+    int fd_;
+    std::size_t files_, written_;
+    std::chrono::steady_clock::time_point opened_;
+    std::atomic<bool> running_{ false };
+    std::thread thread_;
+};
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
@@ -0,0 +1,186 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_DETAIL_PIPELINE_HPP
+#define INCLUDED_TOYBRIDGE_DETAIL_PIPELINE_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/devinfo.hpp>
+#include <toybridge/fdb.hpp>
+#include <toybridge/mdb.hpp>
+#include <toybridge/options.hpp>
+#include <toybridge/storm_config.hpp>
+#include <toybridge/detail/frame_pool.hpp>
+#include <toybridge/detail/snoop.hpp>
+#include <toybridge/detail/storm.hpp>
+#include <toybridge/detail/vlan.hpp>
+#include <toybridge/detail/worker.hpp>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+namespace detail {
+
+// The optional stages of the per-frame path, as bits of the set a pipeline is instantiated with.
+struct stage {
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST unsigned log = 1, capture = 2, vlan = 4, snoop = 8, storm = 16;
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST unsigned all = log | capture | vlan | snoop | storm;
+};
+
+// What the stages of the per-frame path look frames up in. Every table but the forwarding database
+// is there only when its stage is configured.
+struct forwarding_tables {
+    SROOK_FORCE_INLINE forwarding_tables(const options& opts, const std::vector<std::string>& devices)
+        : addresses(opts.fdb_size, opts.fdb_aging),
+        ports(devices.size() < devinfo::max_devices ? (port_mask(1) << devices.size()) - 1 : ~port_mask(0)),
+        capture(opts.capture)
+    {
+        if (!opts.vlans.empty()) vlans.reset(new vlan_table(opts.vlans, devices));
+        if (opts.mdb_size) groups.reset(new mdb(opts.mdb_size, devices.size(), opts.mdb_aging));
+        if (!opts.storm.empty()) storm.reset(new storm_control(opts.storm, devices));
+    }
+
+    // The stages these tables call for; logging and capturing depend on the workers.
+    SROOK_FORCE_INLINE unsigned stages() const SROOK_NOEXCEPT_TRUE
+    {
+        return (vlans ? stage::vlan : 0) | (groups ? stage::snoop : 0) | (storm ? stage::storm : 0);
+    }
+
+    fdb addresses;
+    port_mask ports;
+    capture_config capture;
+    std::unique_ptr<vlan_table> vlans;
+    // The snooped multicast groups, unless snooping is off.
+    std::unique_ptr<mdb> groups;
+    // The storm control buckets, when any port is limited.
+    std::unique_ptr<storm_control> storm;
+};
+
+// The per-frame path of a worker, from counting a frame in to the ports it goes out of, composed at
+// compile time from the stages in Stages. A stage that is left out is not tested for per frame; it
+// is compiled away. One that is in still does nothing when its table or ring is missing, so that
+// pipeline<stage::all> does whatever the configuration asks for.
+template <unsigned Stages>
+class pipeline {
+public:
+    SROOK_FORCE_INLINE explicit pipeline(forwarding_tables& t) SROOK_NOEXCEPT_TRUE : t_(t) {}
+
+    // Whether frames are tagged with their VLAN on the way in.
+    SROOK_FORCE_INLINE bool vlan_aware() const SROOK_NOEXCEPT_TRUE
+    {
+        return (Stages & stage::vlan) && t_.vlans;
+    }
+
+    // Counts a received frame and tells whether it is long enough to be forwarded. With verbose
+    // on, it is also queued for the logger thread, which formats what detail::dump would have printed.
+    SROOK_FORCE_INLINE bool dump(worker& w, std::size_t i, const ::u_char* data, std::size_t s) const SROOK_NOEXCEPT_TRUE
+    {
+        port_counters& c = w.stats->ports[i];
+        c.rx_packets.add();
+        c.rx_bytes.add(s);
+        if ((Stages & stage::log) && w.log) w.log->push(i, data, s);
+        if (s >= sizeof(::ether_header)) return true;
+        c.rx_short.add();
+        return false;
+    }
+
+    // With VLANs, tags a frame that came in on port in with its VLAN as vlan_table::admit() does,
+    // and counts it as dropped when the port is not a member of that VLAN.
+    SROOK_FORCE_INLINE bool admit(worker& w, std::size_t in, ::u_char*& data, std::size_t& len) const SROOK_NOEXCEPT_TRUE
+    {
+        if (!vlan_aware() || t_.vlans->admit(in, data, len)) return true;
+        w.stats->ports[in].vlan_drops.add();
+        return false;
+    }
+
+    // Learns the source address of a frame that came in on port in, and decides where it goes:
+    // the one port its destination was learned on, or every other port when the destination
+    // is a group address or unknown. A frame whose destination sits behind in goes nowhere.
+    // With VLANs, every frame carries the tag of its VLAN by now, and all of this happens
+    // among the ports of that VLAN only. With snooping, multicast goes as multicast() has it.
+    // Flooded frames are then subject to storm control.
+    SROOK_FORCE_INLINE port_mask route(const worker& w, std::size_t in, const ::u_char* data, std::size_t len) const SROOK_NOEXCEPT_TRUE
+    {
+        const ::u_char* dst = data;
+        const ::u_char* src = data + ETH_ALEN;
+        const srook::uint16_t vid = vlan_aware() ? vlan_vid(data) : 0;
+        const port_mask scope = (vlan_aware() ? t_.vlans->members(vid) : t_.ports) & ~(port_mask(1) << in);
+        if (!(src[0] & 1)) t_.addresses.learn(src, static_cast<fdb::port_type>(in), w.now, vid);
+        if (dst[0] & 1) {
+            const port_mask out = (Stages & stage::snoop) && t_.groups ? multicast(w, in, data, len, vid, scope) : scope;
+            if (!(Stages & stage::storm)) return out;
+            const bool broadcast = std::all_of(dst, dst + ETH_ALEN, [](::u_char b) { return b == 0xff; });
+            return out && police(w, in, broadcast ? storm_config::broadcast : storm_config::multicast, len) ? out : 0;
+        }
+
+        const fdb::port_type out = t_.addresses.lookup(dst, w.now, vid);
+        if (out != fdb::npos) return scope & (port_mask(1) << out);
+        return scope && police(w, in, storm_config::unknown_unicast, len) ? scope : 0;
+    }
+
+    // route(), and the frame for the capture when it goes anywhere and is picked. A frame in the
+    // worker's pool is handed over by reference, as long as that leaves at least half of the pool
+    // free for receiving into; any other frame is copied.
+    SROOK_FORCE_INLINE port_mask
+    steer(worker& w, std::size_t in, const ::u_char* data, std::size_t len, const frame_ref* f = nullptr) const SROOK_NOEXCEPT_TRUE
+    {
+        const port_mask out = route(w, in, data, len);
+        if ((Stages & stage::capture) && out && w.capture &&
+                (!t_.capture.ethertype || t_.capture.ethertype == (data[12] << 8 | data[13])) &&
+                ++w.unsampled >= t_.capture.sample) {
+            w.unsampled = 0;
+            if (f && *f && w.pool->available() > w.pool->size() / 2) w.capture->push(in, *f, data, len);
+            else w.capture->push(in, data, len);
+        }
+        return out;
+    }
+
+    // Whether port j sends a frame, which carries the tag of its VLAN, without the tag.
+    SROOK_FORCE_INLINE bool untagged(std::size_t j, const ::u_char* frame) const SROOK_NOEXCEPT_TRUE
+    {
+        return vlan_aware() && ((t_.vlans->untagged(vlan_vid(frame)) >> j) & 1);
+    }
+private:
+    // Whether storm control lets a frame of class c and len bytes that came in on port in through.
+    // One it does not is counted.
+    SROOK_FORCE_INLINE bool police(const worker& w, std::size_t in, std::size_t c, std::size_t len) const SROOK_NOEXCEPT_TRUE
+    {
+        if (!(Stages & stage::storm) || !t_.storm || !t_.storm->limited(in, c) || t_.storm->admit(in, c, len)) return true;
+        w.stats->ports[in].storm_drops[c].add();
+        return false;
+    }
+
+    // Keeps the multicast database up to date with the IGMP and MLD messages that pass, and decides
+    // where a frame to a group address in scope goes. Reports and leaves go to the router ports only,
+    // queries and link-local groups everywhere, and any other group to its listeners and the router
+    // ports. Everything in a VLAN is flooded until a querier has been seen in that VLAN, since
+    // without one listeners are never asked to report again, and so is a group the full table had
+    // no room for.
+    SROOK_FORCE_INLINE port_mask
+    multicast(const worker& w, std::size_t in, const ::u_char* data, std::size_t len, srook::uint16_t vid, port_mask scope) const SROOK_NOEXCEPT_TRUE
+    {
+        mdb& groups = *t_.groups;
+        const snoop_kind kind = snoop(data, len, [&w, &groups, in, vid](snoop_kind k, const ::u_char* group) {
+            if (k == snoop_kind::report) groups.join(group, vid, in, w.now);
+            else groups.leave(group, vid, in, w.now);
+        });
+        if (kind == snoop_kind::query) groups.query(in, vid, w.now);
+        const port_mask routers = groups.routers(vid, w.now);
+        if (!routers || kind == snoop_kind::query) return scope;
+        if (kind != snoop_kind::none) return scope & routers;
+        if (!snooped(data)) return scope;
+        const srook::optional<port_mask> listeners = groups.lookup(data, vid, w.now);
+        return listeners ? scope & (*listeners | routers) : groups.full() ? scope : scope & routers;
+    }
+
+    forwarding_tables& t_;
+};
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
@@ -0,0 +1,206 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_DETAIL_RING_HPP
+#define INCLUDED_TOYBRIDGE_DETAIL_RING_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/detail/init.hpp>
+#include <toybridge/detail/vlan.hpp>
+#include <srook/optional.hpp>
+#include <srook/process/perror.hpp>
+#include <linux/if_packet.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+namespace detail {
+
+// The geometry of a TPACKET_V3 ring. The kernel fills one block at a time and
+// retires it either when it is full or when retire_timeout (milliseconds) elapses.
+// A TX ring of the same geometry is carved into block_size * block_count / frame_size slots.
+struct ring_config {
+    std::size_t block_size = 1 << 18;
+    std::size_t block_count = 64;
+    std::size_t frame_size = 1 << 11;
+    unsigned int retire_timeout = 8;
+
+    SROOK_FORCE_INLINE std::size_t size() const SROOK_NOEXCEPT_TRUE
+    {
+        return block_size * block_count;
+    }
+};
+
+class rx_ring {
+public:
+    SROOK_FORCE_INLINE rx_ring(::u_char* base, const ring_config& cfg, bool tags = false) SROOK_NOEXCEPT_TRUE
+        : base_(base), block_size_(cfg.block_size), block_count_(cfg.block_count), current_(0), tags_(tags) {}
+
+    // Hands every block the kernel has retired to fn(data, length, timestamp) frame by frame,
+    // directly out of the mapping, and gives each block back once it is walked. timestamp is when
+    // the frame was received, in nanoseconds of CLOCK_REALTIME. Returns false as soon as fn does.
+    // With tags, a tag the kernel took off a frame is put back in front of it first.
+    template <class F>
+    SROOK_FORCE_INLINE bool drain(F&& fn)
+    {
+        for (::tpacket_block_desc* bd = block(); __atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER; bd = block()) {
+            bool ok = true;
+            ::u_char* p = reinterpret_cast<::u_char*>(bd) + bd->hdr.bh1.offset_to_first_pkt;
+            for (srook::uint32_t n = bd->hdr.bh1.num_pkts; ok && n; --n) {
+                const ::tpacket3_hdr* hdr = reinterpret_cast<const ::tpacket3_hdr*>(p);
+                ::u_char* data = p + hdr->tp_mac;
+                std::size_t len = hdr->tp_snaplen;
+                if (tags_ && (hdr->tp_status & TP_STATUS_VLAN_VALID) && len >= 2 * ETH_ALEN && hdr->tp_mac >= TPACKET3_HDRLEN + vlan_tag_size) {
+                    const srook::uint16_t tpid = hdr->tp_status & TP_STATUS_VLAN_TPID_VALID ? hdr->hv1.tp_vlan_tpid : srook::uint16_t(ETH_P_8021Q);
+                    data = push_tag(data, len, tpid, static_cast<srook::uint16_t>(hdr->hv1.tp_vlan_tci));
+                }
+                ok = fn(data, len, srook::uint64_t(hdr->tp_sec) * 1000000000 + hdr->tp_nsec);
+                p += hdr->tp_next_offset;
+            }
+            __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+            current_ = (current_ + 1) % block_count_;
+            if (!ok) return false;
+        }
+        return true;
+    }
+private:
+    SROOK_FORCE_INLINE ::tpacket_block_desc* block() const SROOK_NOEXCEPT_TRUE
+    {
+        return reinterpret_cast<::tpacket_block_desc*>(base_ + current_ * block_size_);
+    }
+
+    ::u_char* base_;
+    std::size_t block_size_, block_count_, current_;
+    bool tags_;
+};
+
+class tx_ring {
+public:
+    SROOK_FORCE_INLINE tx_ring(::u_char* base, const ring_config& cfg) SROOK_NOEXCEPT_TRUE
+        : base_(base), frame_size_(cfg.frame_size), frame_count_(cfg.size() / cfg.frame_size),
+        current_(0), pending_(0), full_(0) {}
+
+    SROOK_FORCE_INLINE std::size_t capacity() const SROOK_NOEXCEPT_TRUE
+    {
+        return frame_size_ - data_offset;
+    }
+
+    // Copies a frame into the next free slot and marks it for sending. When the
+    // kernel has not yet released that slot the frame is dropped and counted.
+    SROOK_FORCE_INLINE bool push(const ::u_char* data, std::size_t len) SROOK_NOEXCEPT_TRUE
+    {
+        ::u_char* frame = base_ + current_ * frame_size_;
+        ::tpacket3_hdr* hdr = reinterpret_cast<::tpacket3_hdr*>(frame);
+        if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+            ++full_;
+            return false;
+        }
+        std::memcpy(frame + data_offset, data, len);
+        hdr->tp_len = static_cast<srook::uint32_t>(len);
+        hdr->tp_next_offset = 0;
+        __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+        current_ = (current_ + 1) % frame_count_;
+        ++pending_;
+        return true;
+    }
+
+    // Kicks the kernel once for everything pushed since the last flush.
+    SROOK_FORCE_INLINE bool flush(int soc) SROOK_NOEXCEPT_TRUE
+    {
+        if (!pending_) return true;
+        pending_ = 0;
+        return ::sendto(soc, nullptr, 0, MSG_DONTWAIT, nullptr, 0) >= 0 || errno == EAGAIN || errno == ENOBUFS;
+    }
+
+    SROOK_FORCE_INLINE srook::uint64_t full_drops() const SROOK_NOEXCEPT_TRUE
+    {
+        return full_;
+    }
+private:
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t data_offset = TPACKET3_HDRLEN - sizeof(::sockaddr_ll);
+
+    ::u_char* base_;
+    std::size_t frame_size_, frame_count_, current_, pending_;
+    srook::uint64_t full_;
+};
+
+// The mapping of the RX and/or TX ring of one socket. The kernel lays the TX ring
+// out right after the RX ring in a single mmap(2) region.
+class packet_rings {
+public:
+    SROOK_FORCE_INLINE packet_rings(::u_char* map, const ring_config& cfg, bool rx, bool tx, bool tags = false) SROOK_NOEXCEPT_TRUE
+        : map_(map), size_((rx + tx) * cfg.size()),
+        rx_(rx ? srook::make_optional(rx_ring(map, cfg, tags)) : srook::nullopt),
+        tx_(tx ? srook::make_optional(tx_ring(map + rx * cfg.size(), cfg)) : srook::nullopt)
+    {}
+
+    packet_rings(const packet_rings&) = delete;
+    packet_rings& operator=(const packet_rings&) = delete;
+
+    SROOK_FORCE_INLINE packet_rings(packet_rings&& other) SROOK_NOEXCEPT_TRUE
+        : map_(other.map_), size_(other.size_), rx_(srook::move(other.rx_)), tx_(srook::move(other.tx_))
+    {
+        other.map_ = nullptr;
+    }
+
+    SROOK_FORCE_INLINE ~packet_rings()
+    {
+        if (map_) ::munmap(map_, size_);
+    }
+
+    SROOK_FORCE_INLINE srook::optional<rx_ring>& rx() SROOK_NOEXCEPT_TRUE { return rx_; }
+    SROOK_FORCE_INLINE srook::optional<tx_ring>& tx() SROOK_NOEXCEPT_TRUE { return tx_; }
+    SROOK_FORCE_INLINE const srook::optional<tx_ring>& tx() const SROOK_NOEXCEPT_TRUE { return tx_; }
+private:
+    ::u_char* map_;
+    std::size_t size_;
+    srook::optional<rx_ring> rx_;
+    srook::optional<tx_ring> tx_;
+};
+
+// Switches soc to TPACKET_V3 and maps a PACKET_RX_RING and/or a PACKET_TX_RING of
+// the given geometry onto it. Frames sent through the TX ring of a socket are not
+// looped back into the RX side of that same socket. With tags, every RX slot has room
+// in front of its frame, into which the RX ring puts back the tag the kernel took off.
+srook::optional<packet_rings> make_rings(int soc, const ring_config& cfg, bool rx, bool tx, bool tags = false)
+SROOK_NOEXCEPT_TRUE
+{
+    const int version = TPACKET_V3;
+    const unsigned int reserve = static_cast<unsigned int>(vlan_tag_size);
+    return ((toybridge::detail::setsockopt(soc, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) >>= [&cfg, &reserve, rx, tags](int soc) -> srook::optional<int> {
+        if (!rx) return { soc };
+        if (tags && !toybridge::detail::setsockopt(soc, SOL_PACKET, PACKET_RESERVE, &reserve, sizeof(reserve))) return srook::nullopt;
+        ::tpacket_req3 req{};
+        req.tp_block_size = static_cast<unsigned int>(cfg.block_size);
+        req.tp_block_nr = static_cast<unsigned int>(cfg.block_count);
+        req.tp_frame_size = static_cast<unsigned int>(cfg.frame_size);
+        req.tp_frame_nr = static_cast<unsigned int>(cfg.size() / cfg.frame_size);
+        req.tp_retire_blk_tov = cfg.retire_timeout;
+        return toybridge::detail::setsockopt(soc, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+    }) >>= [&cfg, tx](int soc) -> srook::optional<int> {
+        if (!tx) return { soc };
+        ::tpacket_req3 req{};
+        req.tp_block_size = static_cast<unsigned int>(cfg.block_size);
+        req.tp_block_nr = static_cast<unsigned int>(cfg.block_count);
+        req.tp_frame_size = static_cast<unsigned int>(cfg.frame_size);
+        req.tp_frame_nr = static_cast<unsigned int>(cfg.size() / cfg.frame_size);
+        return toybridge::detail::setsockopt(soc, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req));
+    }) >>= [&cfg, rx, tx, tags](int soc) -> srook::optional<packet_rings> {
+        void* map = ::mmap(nullptr, (rx + tx) * cfg.size(), PROT_READ | PROT_WRITE, MAP_SHARED, soc, 0);
+        if (map == MAP_FAILED) {
+            error_close("mmap", soc);
+            return srook::nullopt;
+        }
+        return { packet_rings(static_cast<::u_char*>(map), cfg, rx, tx, tags) };
+    };
+}
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
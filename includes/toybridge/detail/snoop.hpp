@@ -0,0 +1,146 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_DETAIL_SNOOP_HPP
+#define INCLUDED_TOYBRIDGE_DETAIL_SNOOP_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/detail/vlan.hpp>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+namespace detail {
+
+// What an IGMP or MLD message asks of a snooping bridge.
+enum class snoop_kind { none, query, report, leave };
+
+// Whether frames to the multicast address mac are forwarded by group membership: IPv4 and IPv6
+// multicast, except the link-local groups 224.0.0.0/24 and ff02::/112 (which also take in their
+// aliases), which must reach every port.
+SROOK_FORCE_INLINE bool snooped(const ::u_char* mac) SROOK_NOEXCEPT_TRUE
+{
+    if (mac[0] == 0x01 && mac[1] == 0x00 && mac[2] == 0x5e) return (mac[3] & 0x7f) || mac[4];
+    if (mac[0] == 0x33 && mac[1] == 0x33) return mac[2] || mac[3] || mac[4];
+    return false;
+}
+
+namespace snoop_detail {
+
+SROOK_FORCE_INLINE srook::uint16_t be16(const ::u_char* p) SROOK_NOEXCEPT_TRUE
+{
+    return static_cast<srook::uint16_t>(p[0] << 8 | p[1]);
+}
+
+// The multicast MAC address of an IPv4 group.
+SROOK_FORCE_INLINE void mac4(const ::u_char* group, ::u_char* mac) SROOK_NOEXCEPT_TRUE
+{
+    mac[0] = 0x01;
+    mac[1] = 0x00;
+    mac[2] = 0x5e;
+    mac[3] = group[1] & 0x7f;
+    mac[4] = group[2];
+    mac[5] = group[3];
+}
+
+// The multicast MAC address of an IPv6 group.
+SROOK_FORCE_INLINE void mac6(const ::u_char* group, ::u_char* mac) SROOK_NOEXCEPT_TRUE
+{
+    mac[0] = mac[1] = 0x33;
+    mac[2] = group[12];
+    mac[3] = group[13];
+    mac[4] = group[14];
+    mac[5] = group[15];
+}
+
+// IGMPv3 and MLDv2 records: a record of the include mode without sources says there is no
+// listener left, any other that there is one.
+template <class F>
+SROOK_FORCE_INLINE snoop_kind records(const ::u_char* p, const ::u_char* end, std::size_t addr, void (*to_mac)(const ::u_char*, ::u_char*), F&& fn)
+{
+    enum { mode_is_include = 1, change_to_include = 3 };
+    if (end - p < 8) return snoop_kind::none;
+    std::size_t n = be16(p + 6);
+    for (p += 8; n && std::size_t(end - p) >= 4 + addr; --n) {
+        const std::size_t sources = be16(p + 2), length = 4 + addr + sources * addr + std::size_t(p[1]) * 4;
+        if (std::size_t(end - p) < length) break;
+        ::u_char mac[ETH_ALEN];
+        to_mac(p + 4, mac);
+        if (snooped(mac)) fn((p[0] == mode_is_include || p[0] == change_to_include) && !sources ? snoop_kind::leave : snoop_kind::report, mac);
+        p += length;
+    }
+    return snoop_kind::report;
+}
+
+} // namespace snoop_detail
+
+// Reads an IGMPv1/v2/v3 or MLDv1/v2 message out of a frame, behind any VLAN tags vlan_tagged()
+// knows, stacked ones included, and calls fn(snoop_kind::report or snoop_kind::leave, group MAC address) for every group it
+// reports on. Returns what kind of message it is, or snoop_kind::none for any other frame.
+template <class F>
+SROOK_FORCE_INLINE snoop_kind snoop(const ::u_char* frame, std::size_t len, F&& fn)
+{
+    using namespace snoop_detail;
+    enum {
+        igmp_query = 0x11, igmp_v1_report = 0x12, igmp_v2_report = 0x16, igmp_leave = 0x17, igmp_v3_report = 0x22,
+        mld_query = 130, mld_report = 131, mld_done = 132, mld_v2_report = 143
+    };
+    if (len < ETH_HLEN) return snoop_kind::none;
+    const ::u_char* const end = frame + len;
+    const ::u_char* p = frame;
+    while (vlan_tagged(p, std::size_t(end - p))) p += vlan_tag_size;
+    const srook::uint16_t type = be16(p + 12);
+    p += ETH_HLEN;
+    ::u_char mac[ETH_ALEN];
+
+    if (type == ETH_P_IP) {
+        if (end - p < 20 || (p[0] >> 4) != 4 || p[9] != IPPROTO_IGMP || (be16(p + 6) & 0x3fff)) return snoop_kind::none;
+        p += std::size_t(p[0] & 0xf) * 4;
+        if (end - p < 8) return snoop_kind::none;
+        switch (p[0]) {
+            case igmp_query:
+                return snoop_kind::query;
+            case igmp_v1_report:
+            case igmp_v2_report:
+            case igmp_leave:
+                mac4(p + 4, mac);
+                if (!snooped(mac)) return snoop_kind::none;
+                fn(p[0] == igmp_leave ? snoop_kind::leave : snoop_kind::report, mac);
+                return p[0] == igmp_leave ? snoop_kind::leave : snoop_kind::report;
+            case igmp_v3_report:
+                return records(p, end, 4, mac4, fn);
+            default:
+                return snoop_kind::none;
+        }
+    }
+    if (type != ETH_P_IPV6 || end - p < 40 || (p[0] >> 4) != 6) return snoop_kind::none;
+    // MLD comes behind a hop-by-hop options header with the router alert option.
+    srook::uint8_t next = p[6];
+    for (p += 40; next == IPPROTO_HOPOPTS || next == IPPROTO_ROUTING || next == IPPROTO_DSTOPTS;) {
+        if (end - p < 8) return snoop_kind::none;
+        next = p[0];
+        p += (std::size_t(p[1]) + 1) * 8;
+    }
+    if (next != IPPROTO_ICMPV6 || end - p < 24) return snoop_kind::none;
+    switch (p[0]) {
+        case mld_query:
+            return snoop_kind::query;
+        case mld_report:
+        case mld_done:
+            mac6(p + 8, mac);
+            if (!snooped(mac)) return snoop_kind::none;
+            fn(p[0] == mld_done ? snoop_kind::leave : snoop_kind::report, mac);
+            return p[0] == mld_done ? snoop_kind::leave : snoop_kind::report;
+        case mld_v2_report:
+            return records(p, end, 16, mac6, fn);
+        default:
+            return snoop_kind::none;
+    }
+}
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
@@ -0,0 +1,443 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_DETAIL_STATS_HPP
+#define INCLUDED_TOYBRIDGE_DETAIL_STATS_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/storm_config.hpp>
+#include <toybridge/detail/egress.hpp>
+#include <srook/process/perror.hpp>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+namespace detail {
+
+// A counter that only its own forwarding thread writes to. Adding to it is a plain load and
+// store, never a locked read-modify-write; any other thread may read it at any time.
+class counter {
+public:
+    SROOK_FORCE_INLINE counter() SROOK_NOEXCEPT_TRUE : v_(0) {}
+
+    SROOK_FORCE_INLINE void add(srook::uint64_t n = 1) SROOK_NOEXCEPT_TRUE
+    {
+        v_.store(v_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    SROOK_FORCE_INLINE void set(srook::uint64_t n) SROOK_NOEXCEPT_TRUE
+    {
+        v_.store(n, std::memory_order_relaxed);
+    }
+
+    SROOK_FORCE_INLINE srook::uint64_t get() const SROOK_NOEXCEPT_TRUE
+    {
+        return v_.load(std::memory_order_relaxed);
+    }
+private:
+    std::atomic<srook::uint64_t> v_;
+};
+
+// Values bucketed by their bit length: bucket 0 counts zeros, bucket b counts values in [2^(b-1), 2^b).
+// Values of 2^38 and more count in the last, which has no upper bound.
+struct histogram {
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t buckets = 40;
+
+    SROOK_FORCE_INLINE void add(srook::uint64_t v) SROOK_NOEXCEPT_TRUE
+    {
+        const std::size_t b = v ? std::size_t(64 - __builtin_clzll(v)) : 0;
+        counts[b < buckets ? b : buckets - 1].add();
+        sum.add(v);
+    }
+
+    counter counts[buckets];
+    counter sum;
+};
+
+// Values bucketed finely enough for percentiles: bucket v counts v below 64, and above that each
+// power of two is split into 32 buckets, about 3% apart. Values of 2^40 and more count in the last.
+struct fine_histogram {
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t buckets = 64 + 32 * (40 - 6);
+
+    SROOK_FORCE_INLINE void add(srook::uint64_t v) SROOK_NOEXCEPT_TRUE
+    {
+        counts[index(v)].add();
+        sum.add(v);
+    }
+
+    SROOK_FORCE_INLINE static std::size_t index(srook::uint64_t v) SROOK_NOEXCEPT_TRUE
+    {
+        if (v < 64) return std::size_t(v);
+        const std::size_t e = std::size_t(63 - __builtin_clzll(v)), b = 64 + 32 * (e - 6) + std::size_t((v >> (e - 5)) & 31);
+        return b < buckets ? b : buckets - 1;
+    }
+
+    // The largest value bucket b counts.
+    SROOK_FORCE_INLINE static srook::uint64_t upper(std::size_t b) SROOK_NOEXCEPT_TRUE
+    {
+        if (b < 64) return b;
+        const std::size_t e = (b - 64) / 32 + 6;
+        return ((32 + srook::uint64_t((b - 64) % 32) + 1) << (e - 5)) - 1;
+    }
+
+    counter counts[buckets];
+    counter sum;
+};
+
+// What happened on one port, as seen by one worker. The counters of a port take whole cache lines.
+struct alignas(64) port_counters {
+    counter rx_packets, rx_bytes, tx_packets, tx_bytes;
+    // Frames too short for an Ethernet header, which are never forwarded.
+    counter rx_short;
+    counter rx_errors, tx_errors;
+    // Frames dropped because the TX ring, the socket or the egress queue had no room for them.
+    counter tx_drops;
+    // Frames dropped because the port they came in on is not a member of their VLAN.
+    counter vlan_drops;
+    // Per traffic class, the frames in the egress queue and those the queue dropped.
+    counter queue_depth[traffic_classes], queue_drops[traffic_classes];
+    // Per storm control class, the frames that came in on the port above its limit and were dropped.
+    counter storm_drops[storm_config::classes];
+};
+
+// Allocates whole cache lines, so that nothing else ever shares a line with what it allocates.
+template <class T>
+struct cache_line_allocator {
+    typedef T value_type;
+
+    SROOK_FORCE_INLINE cache_line_allocator() SROOK_NOEXCEPT_TRUE {}
+    template <class U>
+    SROOK_FORCE_INLINE cache_line_allocator(const cache_line_allocator<U>&) SROOK_NOEXCEPT_TRUE {}
+
+    T* allocate(std::size_t n)
+    {
+        void* p = nullptr;
+        if (::posix_memalign(&p, 64, (n * sizeof(T) + 63) & ~std::size_t(63))) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+
+    SROOK_FORCE_INLINE void deallocate(T* p, std::size_t) SROOK_NOEXCEPT_TRUE
+    {
+        std::free(p);
+    }
+
+    template <class U>
+    SROOK_FORCE_INLINE bool operator==(const cache_line_allocator<U>&) const SROOK_NOEXCEPT_TRUE { return true; }
+    template <class U>
+    SROOK_FORCE_INLINE bool operator!=(const cache_line_allocator<U>&) const SROOK_NOEXCEPT_TRUE { return false; }
+};
+
+// Everything one worker counts. Each worker's lives in an allocation of its own, padded on both
+// ends, and its port counters in whole cache lines of their own, so that no two workers ever write
+// to the same cache line.
+struct worker_stats {
+    SROOK_FORCE_INLINE explicit worker_stats(std::size_t ports) : ports(ports) {}
+
+    char pad0[64];
+    std::vector<port_counters, cache_line_allocator<port_counters>> ports;
+    counter wakeups;
+    // Frames handled per receive from a ready port.
+    histogram batch;
+    // Nanoseconds from the start of such a receive until its last frame was handed to the egress
+    // sockets, once per receive rather than per frame.
+    histogram batch_time;
+    // With timestamps, nanoseconds from the kernel's receive timestamp of a forwarded frame until it
+    // was handed to the egress sockets.
+    fine_histogram transit;
+    char pad1[64];
+};
+
+// The value that a fraction p of what the fine histograms h of every worker counted is at most,
+// to within a bucket, and 0 with nothing counted.
+SROOK_FORCE_INLINE srook::uint64_t
+percentile(const std::vector<std::unique_ptr<worker_stats>>& stats, fine_histogram worker_stats::* h, double p) SROOK_NOEXCEPT_TRUE
+{
+    srook::uint64_t total = 0;
+    for (const std::unique_ptr<worker_stats>& w : stats) {
+        for (const counter& c : ((*w).*h).counts) total += c.get();
+    }
+    if (!total) return 0;
+    const srook::uint64_t rank = std::max<srook::uint64_t>(1, srook::uint64_t(p * double(total) + 0.5));
+    srook::uint64_t seen = 0;
+    for (std::size_t b = 0; b < fine_histogram::buckets; ++b) {
+        for (const std::unique_ptr<worker_stats>& w : stats) seen += ((*w).*h).counts[b].get();
+        if (seen >= rank) return fine_histogram::upper(b);
+    }
+    return fine_histogram::upper(fine_histogram::buckets - 1);
+}
+
+SROOK_INLINE_VARIABLE SROOK_CONSTEXPR_OR_CONST double transit_quantiles[] = { 0.5, 0.99, 0.999 };
+
+SROOK_INLINE_VARIABLE SROOK_CONSTEXPR_OR_CONST char stats_magic[8] = { 'T', 'B', 'S', 'T', 'A', 'T', '1', '\0' };
+
+// The binary snapshot, in host byte order: stats_magic, then the number of ports, of counters per
+// port, of histogram buckets and of traffic classes as four uint32, then per port the nine
+// port_counters in declaration order before queue_depth, summed over all workers, then wakeups,
+// then the batch size and batch time histograms, each as its buckets followed by its sum, then per port
+// the queue depth and then the queue drops of every traffic class, and per port the storm control
+// drops of broadcast, multicast and unknown unicast. Every value is a uint64.
+SROOK_FORCE_INLINE std::string binary_snapshot(const std::vector<std::unique_ptr<worker_stats>>& stats)
+{
+    std::string s(stats_magic, sizeof(stats_magic));
+    const auto put32 = [&s](srook::uint32_t v) { s.append(reinterpret_cast<const char*>(&v), sizeof(v)); };
+    const auto put64 = [&s](srook::uint64_t v) { s.append(reinterpret_cast<const char*>(&v), sizeof(v)); };
+    const std::size_t ports = stats.empty() ? 0 : stats.front()->ports.size();
+    put32(static_cast<srook::uint32_t>(ports));
+    put32(9);
+    put32(static_cast<srook::uint32_t>(histogram::buckets));
+    put32(static_cast<srook::uint32_t>(traffic_classes));
+
+    for (std::size_t i = 0; i < ports; ++i) {
+        for (counter port_counters::* c : { &port_counters::rx_packets, &port_counters::rx_bytes, &port_counters::tx_packets, &port_counters::tx_bytes,
+                &port_counters::rx_short, &port_counters::rx_errors, &port_counters::tx_errors, &port_counters::tx_drops,
+                &port_counters::vlan_drops }) {
+            srook::uint64_t n = 0;
+            for (const std::unique_ptr<worker_stats>& w : stats) n += (w->ports[i].*c).get();
+            put64(n);
+        }
+    }
+    srook::uint64_t wakeups = 0;
+    for (const std::unique_ptr<worker_stats>& w : stats) wakeups += w->wakeups.get();
+    put64(wakeups);
+    for (histogram worker_stats::* h : { &worker_stats::batch, &worker_stats::batch_time }) {
+        for (std::size_t b = 0; b <= histogram::buckets; ++b) {
+            srook::uint64_t n = 0;
+            for (const std::unique_ptr<worker_stats>& w : stats) n += b < histogram::buckets ? ((*w).*h).counts[b].get() : ((*w).*h).sum.get();
+            put64(n);
+        }
+    }
+    for (std::size_t i = 0; i < ports; ++i) {
+        for (counter (port_counters::* a)[traffic_classes] : { &port_counters::queue_depth, &port_counters::queue_drops }) {
+            for (std::size_t c = 0; c < traffic_classes; ++c) {
+                srook::uint64_t n = 0;
+                for (const std::unique_ptr<worker_stats>& w : stats) n += (w->ports[i].*a)[c].get();
+                put64(n);
+            }
+        }
+    }
+    for (std::size_t i = 0; i < ports; ++i) {
+        for (std::size_t c = 0; c < storm_config::classes; ++c) {
+            srook::uint64_t n = 0;
+            for (const std::unique_ptr<worker_stats>& w : stats) n += w->ports[i].storm_drops[c].get();
+            put64(n);
+        }
+    }
+    return s;
+}
+
+// The same numbers in the Prometheus text exposition format, with ports labelled by device name.
+SROOK_FORCE_INLINE std::string prometheus_text(const std::vector<std::unique_ptr<worker_stats>>& stats, const std::vector<std::string>& names)
+{
+    std::ostringstream os;
+    const struct {
+        const char* name;
+        const char* help;
+        counter port_counters::* c;
+    } port_metrics[] = {
+        { "rx_packets", "Frames received.", &port_counters::rx_packets },
+        { "rx_bytes", "Bytes received.", &port_counters::rx_bytes },
+        { "tx_packets", "Frames sent.", &port_counters::tx_packets },
+        { "tx_bytes", "Bytes sent.", &port_counters::tx_bytes },
+        { "rx_short", "Frames received too short for an Ethernet header.", &port_counters::rx_short },
+        { "rx_errors", "Failed receives.", &port_counters::rx_errors },
+        { "tx_errors", "Failed sends.", &port_counters::tx_errors },
+        { "tx_drops", "Frames dropped for lack of room on the egress side.", &port_counters::tx_drops },
+        { "vlan_drops", "Frames dropped for a VLAN the port is not a member of.", &port_counters::vlan_drops },
+    };
+    for (const auto& m : port_metrics) {
+        os << "# HELP toybridge_" << m.name << "_total " << m.help << "\n# TYPE toybridge_" << m.name << "_total counter\n";
+        for (std::size_t i = 0; i < names.size(); ++i) {
+            srook::uint64_t n = 0;
+            for (const std::unique_ptr<worker_stats>& w : stats) n += (w->ports[i].*m.c).get();
+            os << "toybridge_" << m.name << "_total{port=\"" << names[i] << "\"} " << n << '\n';
+        }
+    }
+
+    const struct {
+        const char* name;
+        const char* help;
+        const char* type;
+        counter (port_counters::* a)[traffic_classes];
+    } class_metrics[] = {
+        { "egress_queue_frames", "Frames waiting in the egress queue.", "gauge", &port_counters::queue_depth },
+        { "egress_queue_drops_total", "Frames the egress queue dropped.", "counter", &port_counters::queue_drops },
+    };
+    for (const auto& m : class_metrics) {
+        os << "# HELP toybridge_" << m.name << ' ' << m.help << "\n# TYPE toybridge_" << m.name << ' ' << m.type << '\n';
+        for (std::size_t i = 0; i < names.size(); ++i) {
+            for (std::size_t c = 0; c < traffic_classes; ++c) {
+                srook::uint64_t n = 0;
+                for (const std::unique_ptr<worker_stats>& w : stats) n += (w->ports[i].*m.a)[c].get();
+                os << "toybridge_" << m.name << "{port=\"" << names[i] << "\",class=\"" << c << "\"} " << n << '\n';
+            }
+        }
+    }
+
+    os << "# HELP toybridge_storm_drops_total Frames storm control dropped.\n# TYPE toybridge_storm_drops_total counter\n";
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        for (std::size_t c = 0; c < storm_config::classes; ++c) {
+            srook::uint64_t n = 0;
+            for (const std::unique_ptr<worker_stats>& w : stats) n += w->ports[i].storm_drops[c].get();
+            os << "toybridge_storm_drops_total{port=\"" << names[i] << "\",class=\"" << storm_config::name(c) << "\"} " << n << '\n';
+        }
+    }
+
+    srook::uint64_t wakeups = 0;
+    for (const std::unique_ptr<worker_stats>& w : stats) wakeups += w->wakeups.get();
+    os << "# HELP toybridge_wakeups_total Times a worker woke up with something to do.\n# TYPE toybridge_wakeups_total counter\ntoybridge_wakeups_total " << wakeups << '\n';
+
+    const struct {
+        const char* name;
+        const char* help;
+        histogram worker_stats::* h;
+    } histograms[] = {
+        { "batch_frames", "Frames handled per receive from a ready port.", &worker_stats::batch },
+        { "batch_duration_nanoseconds", "Time from receiving a batch to handing its last frame to the egress sockets, once per batch.", &worker_stats::batch_time },
+    };
+    for (const auto& m : histograms) {
+        os << "# HELP toybridge_" << m.name << ' ' << m.help << "\n# TYPE toybridge_" << m.name << " histogram\n";
+        srook::uint64_t cumulative = 0, sum = 0;
+        for (std::size_t b = 0; b < histogram::buckets; ++b) {
+            for (const std::unique_ptr<worker_stats>& w : stats) cumulative += ((*w).*m.h).counts[b].get();
+            // The last bucket takes everything larger as well, so it is only the +Inf one.
+            if (b + 1 < histogram::buckets) os << "toybridge_" << m.name << "_bucket{le=\"" << ((srook::uint64_t(1) << b) - 1) << "\"} " << cumulative << '\n';
+        }
+        for (const std::unique_ptr<worker_stats>& w : stats) sum += ((*w).*m.h).sum.get();
+        os << "toybridge_" << m.name << "_bucket{le=\"+Inf\"} " << cumulative << '\n'
+            << "toybridge_" << m.name << "_sum " << sum << '\n'
+            << "toybridge_" << m.name << "_count " << cumulative << '\n';
+    }
+
+    srook::uint64_t transits = 0, transit_sum = 0;
+    for (const std::unique_ptr<worker_stats>& w : stats) {
+        for (const counter& c : w->transit.counts) transits += c.get();
+        transit_sum += w->transit.sum.get();
+    }
+    if (transits) {
+        os << "# HELP toybridge_transit_latency_nanoseconds Time from the kernel's receive timestamp of a forwarded frame to handing it to the egress sockets.\n"
+            << "# TYPE toybridge_transit_latency_nanoseconds summary\n";
+        for (double q : transit_quantiles) {
+            os << "toybridge_transit_latency_nanoseconds{quantile=\"" << q << "\"} " << percentile(stats, &worker_stats::transit, q) << '\n';
+        }
+        os << "toybridge_transit_latency_nanoseconds_sum " << transit_sum << '\n'
+            << "toybridge_transit_latency_nanoseconds_count " << transits << '\n';
+    }
+    return os.str();
+}
+
+// Serves the counters on a Unix domain socket from a thread of its own. A client sends one line:
+// "snapshot" gets binary_snapshot(), an HTTP GET request gets prometheus_text() as an HTTP
+// response, and anything else gets the bare text. The thread stops once stop_fd is readable;
+// join() waits for that.
+class stats_server {
+public:
+    SROOK_FORCE_INLINE stats_server(const std::vector<std::unique_ptr<worker_stats>>& stats, const std::vector<std::string>& names)
+        : stats_(stats), names_(names), fd_(-1) {}
+
+    stats_server(const stats_server&) = delete;
+    stats_server& operator=(const stats_server&) = delete;
+
+    SROOK_FORCE_INLINE bool start(const std::string& path, int stop_fd)
+    {
+        ::sockaddr_un addr{};
+        if (path.size() >= sizeof(addr.sun_path)) {
+            std::cerr << path << ": path too long for a Unix socket" << std::endl;
+            return false;
+        }
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path.data(), path.size());
+        ::unlink(path.c_str());
+
+        fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd_ < 0 || ::bind(fd_, reinterpret_cast<const ::sockaddr*>(&addr), sizeof(addr)) < 0 || ::listen(fd_, 8) < 0) {
+            srook::process::perror(path.c_str());
+            return false;
+        }
+        path_ = path;
+        thread_ = std::thread([stop_fd, this] { serve(stop_fd); });
+        return true;
+    }
+
+    SROOK_FORCE_INLINE void join()
+    {
+        if (thread_.joinable()) thread_.join();
+    }
+
+    SROOK_FORCE_INLINE ~stats_server()
+    {
+        join();
+        if (fd_ >= 0) ::close(fd_);
+        if (!path_.empty()) ::unlink(path_.c_str());
+    }
+private:
+    SROOK_FORCE_INLINE void serve(int stop_fd)
+    {
+        for (;;) {
+            ::pollfd fds[] = { { fd_, POLLIN, 0 }, { stop_fd, POLLIN, 0 } };
+            if (::poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                srook::process::perror("poll");
+                return;
+            }
+            if (fds[1].revents) return;
+            const int client = ::accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0) continue;
+            respond(client);
+            ::close(client);
+        }
+    }
+
+    SROOK_FORCE_INLINE void respond(int client)
+    {
+        std::string request;
+        char buf[256];
+        for (::pollfd p = { client, POLLIN, 0 }; request.find('\n') == std::string::npos && request.size() < 4096 && ::poll(&p, 1, 1000) > 0;) {
+            const ::ssize_t n = ::read(client, buf, sizeof(buf));
+            if (n <= 0) break;
+            request.append(buf, std::size_t(n));
+        }
+
+        std::string body;
+        if (!request.compare(0, 8, "snapshot")) {
+            body = binary_snapshot(stats_);
+        } else if (!request.compare(0, 4, "GET ")) {
+            const std::string text = prometheus_text(stats_, names_);
+            body = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(text.size()) + "\r\n\r\n" + text;
+        } else {
+            body = prometheus_text(stats_, names_);
+        }
+        for (std::size_t off = 0; off < body.size();) {
+            const ::ssize_t n = ::write(client, body.data() + off, body.size() - off);
+            if (n <= 0) break;
+            off += std::size_t(n);
+        }
+    }
+
+    const std::vector<std::unique_ptr<worker_stats>>& stats_;
+    const std::vector<std::string>& names_;
+    int fd_;
+    std::string path_;
+    std::thread thread_;
+};
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
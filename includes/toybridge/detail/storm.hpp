@@ -0,0 +1,149 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_DETAIL_STORM_HPP
+#define INCLUDED_TOYBRIDGE_DETAIL_STORM_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/devinfo.hpp>
+#include <toybridge/storm_config.hpp>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+namespace detail {
+
+// A token bucket, kept as the generic cell rate algorithm does: instead of tokens and a refill,
+// one theoretical arrival time, which each admitted frame pushes back by what it costs. A frame is
+// let through as long as that time is at most tolerance ahead of now. Refilling is thereby free,
+// and admitting a frame one compare-and-swap, so that the workers can share one bucket.
+//
+// Times are in nanoseconds, whose signed difference does not wrap for centuries, so that a bucket
+// may stay idle for any time. Only the interval a unit costs is kept in 1/1024 ns, which keeps it
+// exact to about 1% for a byte at 100 Gbit/s; what a frame costs is rounded to the nanosecond.
+class gcra {
+public:
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST unsigned int shift = 10;
+
+    SROOK_FORCE_INLINE gcra() SROOK_NOEXCEPT_TRUE : tat_(0), interval_(0), tolerance_(0) {}
+
+    // rate units a second, any burst of them that fits in tolerance nanoseconds going through at once.
+    SROOK_FORCE_INLINE void reset(srook::uint64_t rate, srook::uint64_t tolerance, srook::uint64_t now) SROOK_NOEXCEPT_TRUE
+    {
+        interval_ = rate ? std::max<srook::uint64_t>((srook::uint64_t(1000000000) << shift) / rate, 1) : 0;
+        tolerance_ = tolerance;
+        tat_.store(now, std::memory_order_relaxed);
+    }
+
+    SROOK_FORCE_INLINE explicit operator bool() const SROOK_NOEXCEPT_TRUE
+    {
+        return interval_ != 0;
+    }
+
+    // Whether anything may go through at now.
+    SROOK_FORCE_INLINE bool conforms(srook::uint64_t now) const SROOK_NOEXCEPT_TRUE
+    {
+        return ahead(tat_.load(std::memory_order_relaxed), now) <= srook::int64_t(tolerance_);
+    }
+
+    // Takes cost units at now, unless they may not go through.
+    SROOK_FORCE_INLINE bool admit(srook::uint64_t now, srook::uint64_t cost) SROOK_NOEXCEPT_TRUE
+    {
+        srook::uint64_t tat = tat_.load(std::memory_order_relaxed);
+        for (;;) {
+            const srook::int64_t a = ahead(tat, now);
+            if (a > srook::int64_t(tolerance_)) return false;
+            if (tat_.compare_exchange_weak(tat, (a > 0 ? tat : now) + charge(cost), std::memory_order_relaxed)) return true;
+        }
+    }
+private:
+    SROOK_FORCE_INLINE static srook::int64_t ahead(srook::uint64_t tat, srook::uint64_t now) SROOK_NOEXCEPT_TRUE
+    {
+        return srook::int64_t(tat - now);
+    }
+
+    SROOK_FORCE_INLINE srook::uint64_t charge(srook::uint64_t cost) const SROOK_NOEXCEPT_TRUE
+    {
+        return (cost * interval_ + (srook::uint64_t(1) << (shift - 1))) >> shift;
+    }
+
+    std::atomic<srook::uint64_t> tat_;
+    srook::uint64_t interval_, tolerance_;
+};
+
+// CLOCK_MONOTONIC_COARSE in nanoseconds: no more than a read of the vDSO page, at the price of
+// advancing once per tick of the kernel only.
+SROOK_FORCE_INLINE srook::uint64_t coarse_time() SROOK_NOEXCEPT_TRUE
+{
+    ::timespec ts{};
+    ::clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return srook::uint64_t(ts.tv_sec) * 1000000000 + srook::uint64_t(ts.tv_nsec);
+}
+
+// The storm control limits of every port, a frame and a bit rate bucket per port and class,
+// shared by all workers.
+class storm_control {
+public:
+    // How far ahead of its rate a bucket may get: bursts that fit in this many nanoseconds pass
+    // whole. It has to cover a few ticks of the coarse clock.
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST srook::uint64_t burst = 20000000;
+
+    SROOK_FORCE_INLINE storm_control(const storm_config& cfg, const std::vector<std::string>& devices)
+        : buckets_(new bucket[devices.size() * storm_config::classes])
+    {
+        for (const storm_config::port& p : cfg.ports()) {
+            if (std::find(devices.cbegin(), devices.cend(), p.device) == devices.cend()) {
+                std::cerr << "storm: " << p.device << " is not a port of the bridge, ignoring it" << std::endl;
+            }
+        }
+        const srook::uint64_t now = coarse_time();
+        for (std::size_t c = 0; c < storm_config::classes; ++c) limited_[c] = 0;
+        for (std::size_t i = 0; i < devices.size(); ++i) {
+            const storm_config::port p = cfg.find(devices[i]);
+            for (std::size_t c = 0; c < storm_config::classes; ++c) {
+                bucket& b = buckets_[i * storm_config::classes + c];
+                b.frames.reset(p.limits[c].pps, burst, now);
+                b.bytes.reset(p.limits[c].bps ? std::max<srook::uint64_t>(p.limits[c].bps / 8, 1) : 0, burst, now);
+                if (b.frames || b.bytes) limited_[c] |= port_mask(1) << i;
+            }
+        }
+    }
+
+    // Whether frames of class c that come in on port in are limited at all.
+    SROOK_FORCE_INLINE bool limited(std::size_t in, std::size_t c) const SROOK_NOEXCEPT_TRUE
+    {
+        return (limited_[c] >> in) & 1;
+    }
+
+    // Whether a frame of len bytes and class c that came in on port in is within the limits, which
+    // it is then charged to.
+    SROOK_FORCE_INLINE bool admit(std::size_t in, std::size_t c, std::size_t len) SROOK_NOEXCEPT_TRUE
+    {
+        bucket& b = buckets_[in * storm_config::classes + c];
+        const srook::uint64_t now = coarse_time();
+        if (!b.bytes) return b.frames.admit(now, 1);
+        if ((b.frames && !b.frames.conforms(now)) || !b.bytes.admit(now, len)) return false;
+        // Another worker may have taken the last frame meanwhile, which lets one frame too many through.
+        if (b.frames) b.frames.admit(now, 1);
+        return true;
+    }
+private:
+    struct bucket {
+        gcra frames, bytes;
+    };
+
+    std::unique_ptr<bucket[]> buckets_;
+    port_mask limited_[storm_config::classes];
+};
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
@@ -0,0 +1,56 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_DETAIL_TIMESTAMP_HPP
+#define INCLUDED_TOYBRIDGE_DETAIL_TIMESTAMP_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/detail/init.hpp>
+#include <srook/optional.hpp>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <cstring>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+namespace detail {
+
+// Room for one SCM_TIMESTAMPING control message.
+SROOK_INLINE_VARIABLE SROOK_CONSTEXPR_OR_CONST std::size_t timestamping_space = CMSG_SPACE(sizeof(::scm_timestamping));
+
+// Asks for a software timestamp of every frame soc receives, taken when the device handed the frame
+// to the stack, as an SCM_TIMESTAMPING control message. Frames on a PACKET_RX_RING carry it in their
+// tpacket3_hdr instead.
+SROOK_FORCE_INLINE srook::optional<int> timestamping(int soc) SROOK_NOEXCEPT_TRUE
+{
+    const int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    return toybridge::detail::setsockopt(soc, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+}
+
+// The software receive timestamp in msg, in nanoseconds of CLOCK_REALTIME, or 0 when there is none.
+SROOK_FORCE_INLINE srook::uint64_t rx_timestamp(const ::msghdr& msg) SROOK_NOEXCEPT_TRUE
+{
+    for (const ::cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(const_cast<::msghdr*>(&msg), const_cast<::cmsghdr*>(c))) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_TIMESTAMPING || c->cmsg_len < CMSG_LEN(sizeof(::scm_timestamping))) continue;
+        ::scm_timestamping ts;
+        std::memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+        return srook::uint64_t(ts.ts[0].tv_sec) * 1000000000 + srook::uint64_t(ts.ts[0].tv_nsec);
+    }
+    return 0;
+}
+
+// CLOCK_REALTIME, which the timestamps are taken on, in nanoseconds.
+SROOK_FORCE_INLINE srook::uint64_t real_time() SROOK_NOEXCEPT_TRUE
+{
+    ::timespec ts{};
+    ::clock_gettime(CLOCK_REALTIME, &ts);
+    return srook::uint64_t(ts.tv_sec) * 1000000000 + srook::uint64_t(ts.tv_nsec);
+}
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
@@ -0,0 +1,305 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_DETAIL_URING_HPP
+#define INCLUDED_TOYBRIDGE_DETAIL_URING_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/detail/memory.hpp>
+#include <srook/process/perror.hpp>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+namespace detail {
+
+// An io_uring of one worker together with the ring of buffers its receives are provided with.
+// Receives pick a buffer themselves; a received buffer is lent to the sends that forward it
+// and goes back to the kernel once the last of them has completed. Needs Linux 6.0 or later.
+class uring_engine {
+public:
+    enum op_type : srook::uint64_t { poll_op = 1, recv_op, send_op };
+
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST unsigned int entries = 1024;
+
+    // Buffers of buffer_size bytes each, as many as fit in about 16 MiB, but no fewer than 512 and no more than 4096,
+    // on huge pages with huge.
+    SROOK_FORCE_INLINE explicit uring_engine(std::size_t buffer_size = 2048, bool huge = false) SROOK_NOEXCEPT_TRUE
+        : fd_(-1), rings_(MAP_FAILED), sqes_(MAP_FAILED), pool_(MAP_FAILED), rings_size_(0), pool_mapped_(0), sq_tail_(0), submitted_(0),
+        buffers_(pool_buffers(buffer_size)), buffer_size_(buffer_size), buf_tail_(0), lent_(0), refs_(buffers_)
+    {
+        // A ring that only ever its own worker thread submits to, and which does the kernel's
+        // share of completion work only when asked for completions. It comes up disabled,
+        // so that the worker thread is the one that enables, and thereby owns, it.
+        ::io_uring_params p;
+        for (unsigned int flags : { IORING_SETUP_R_DISABLED | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN, IORING_SETUP_R_DISABLED }) {
+            std::memset(&p, 0, sizeof(p));
+            p.flags = flags | IORING_SETUP_CQSIZE;
+            p.cq_entries = entries * 4;
+            if ((fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p))) >= 0 || errno != EINVAL) break;
+        }
+        if (fd_ < 0) {
+            srook::process::perror("io_uring_setup");
+            return;
+        }
+        if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+            teardown("io_uring: kernel too old");
+            return;
+        }
+
+        // What teardown() unmaps is sized by these, so they are set before anything is mapped.
+        sq_entries_ = p.sq_entries;
+        rings_size_ = std::max(p.sq_off.array + p.sq_entries * sizeof(srook::uint32_t), p.cq_off.cqes + p.cq_entries * sizeof(::io_uring_cqe));
+        rings_ = ::mmap(nullptr, rings_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        sqes_ = ::mmap(nullptr, p.sq_entries * sizeof(::io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        pool_mapped_ = pool_size();
+        pool_ = map_anonymous(pool_mapped_, huge);
+        if (rings_ == MAP_FAILED || sqes_ == MAP_FAILED || pool_ == MAP_FAILED) {
+            teardown("mmap");
+            return;
+        }
+        char* base = static_cast<char*>(rings_);
+        sq_head_ = reinterpret_cast<srook::uint32_t*>(base + p.sq_off.head);
+        sq_ktail_ = reinterpret_cast<srook::uint32_t*>(base + p.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<srook::uint32_t*>(base + p.sq_off.ring_mask);
+        srook::uint32_t* array = reinterpret_cast<srook::uint32_t*>(base + p.sq_off.array);
+        for (srook::uint32_t i = 0; i < p.sq_entries; ++i) array[i] = i;
+        cq_head_ = reinterpret_cast<srook::uint32_t*>(base + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<srook::uint32_t*>(base + p.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<srook::uint32_t*>(base + p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<::io_uring_cqe*>(base + p.cq_off.cqes);
+
+        // The buffer ring comes first in the pool, the buffers after it.
+        ::io_uring_buf_reg reg;
+        std::memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<srook::uint64_t>(pool_);
+        reg.ring_entries = static_cast<srook::uint32_t>(buffers_);
+        reg.bgid = group;
+        if (::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            teardown("io_uring_register(IORING_REGISTER_PBUF_RING)");
+            return;
+        }
+        for (std::size_t b = 0; b < buffers_; ++b) provide(static_cast<srook::uint16_t>(b));
+        publish();
+    }
+
+    uring_engine(const uring_engine&) = delete;
+    uring_engine& operator=(const uring_engine&) = delete;
+
+    SROOK_FORCE_INLINE ~uring_engine()
+    {
+        teardown(nullptr);
+    }
+
+    SROOK_FORCE_INLINE explicit operator bool() const SROOK_NOEXCEPT_TRUE
+    {
+        return fd_ >= 0;
+    }
+
+    // Makes the calling thread the one that submits to the ring.
+    SROOK_FORCE_INLINE bool enable() SROOK_NOEXCEPT_TRUE
+    {
+        if (::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_ENABLE_RINGS, nullptr, 0) < 0) {
+            srook::process::perror("io_uring_register(IORING_REGISTER_ENABLE_RINGS)");
+            return false;
+        }
+        return true;
+    }
+
+    SROOK_FORCE_INLINE static srook::uint64_t tag(op_type op, std::size_t port, srook::uint16_t buffer = 0) SROOK_NOEXCEPT_TRUE
+    {
+        return srook::uint64_t(op) << 56 | srook::uint64_t(buffer) << 16 | port;
+    }
+
+    SROOK_FORCE_INLINE static op_type op(srook::uint64_t tag) SROOK_NOEXCEPT_TRUE { return op_type(tag >> 56); }
+    SROOK_FORCE_INLINE static std::size_t port(srook::uint64_t tag) SROOK_NOEXCEPT_TRUE { return std::size_t(tag & 0xffff); }
+    SROOK_FORCE_INLINE static srook::uint16_t buffer(srook::uint64_t tag) SROOK_NOEXCEPT_TRUE { return srook::uint16_t(tag >> 16); }
+
+    // Queues a multishot poll for fd becoming readable.
+    SROOK_FORCE_INLINE bool poll(int fd, std::size_t port) SROOK_NOEXCEPT_TRUE
+    {
+        ::io_uring_sqe* sqe = next();
+        if (!sqe) return false;
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = POLLIN;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = tag(poll_op, port);
+        return true;
+    }
+
+    // Queues a multishot receive on soc into provided buffers. It stays armed until a completion comes without IORING_CQE_F_MORE.
+    // A completion tells the whole length of the frame, even when only buffer_size() bytes of it were received.
+    SROOK_FORCE_INLINE bool recv(int soc, std::size_t port) SROOK_NOEXCEPT_TRUE
+    {
+        ::io_uring_sqe* sqe = next();
+        if (!sqe) return false;
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = soc;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->msg_flags = MSG_TRUNC;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = group;
+        sqe->user_data = tag(recv_op, port);
+        return true;
+    }
+
+    // Queues sending len bytes of buffer b out of soc, port being where soc belongs.
+    SROOK_FORCE_INLINE bool send(int soc, std::size_t port, srook::uint16_t b, std::size_t len) SROOK_NOEXCEPT_TRUE
+    {
+        ::io_uring_sqe* sqe = next();
+        if (!sqe) return false;
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = soc;
+        sqe->addr = reinterpret_cast<srook::uint64_t>(data(b));
+        sqe->len = static_cast<srook::uint32_t>(len);
+        sqe->user_data = tag(send_op, port, b);
+        return true;
+    }
+
+    // Submits everything queued and, when wait, sleeps until there is at least one completion.
+    SROOK_FORCE_INLINE bool enter(bool wait) SROOK_NOEXCEPT_TRUE
+    {
+        __atomic_store_n(sq_ktail_, sq_tail_, __ATOMIC_RELEASE);
+        const int n = static_cast<int>(::syscall(__NR_io_uring_enter, fd_, sq_tail_ - submitted_, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+        if (n < 0) return errno == EINTR;
+        submitted_ += srook::uint32_t(n);
+        return true;
+    }
+
+    // Hands every completion to fn and returns how many there were.
+    template <class F>
+    SROOK_FORCE_INLINE std::size_t reap(F&& fn)
+    {
+        srook::uint32_t head = *cq_head_;
+        const srook::uint32_t tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE), n = tail - head;
+        for (; head != tail; ++head) fn(static_cast<const ::io_uring_cqe&>(cqes_[head & cq_mask_]));
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    SROOK_FORCE_INLINE ::u_char* data(srook::uint16_t b) const SROOK_NOEXCEPT_TRUE
+    {
+        return static_cast<::u_char*>(pool_) + ring_size() + std::size_t(b) * buffer_size_;
+    }
+
+    SROOK_FORCE_INLINE std::size_t buffer_size() const SROOK_NOEXCEPT_TRUE
+    {
+        return buffer_size_;
+    }
+
+    // A buffer the kernel has received into now has n sends to wait for before it is given back.
+    SROOK_FORCE_INLINE void lend(srook::uint16_t b, std::size_t n) SROOK_NOEXCEPT_TRUE
+    {
+        ++lent_;
+        refs_[b] = static_cast<srook::uint16_t>(n);
+        if (!n) give_back(b);
+    }
+
+    SROOK_FORCE_INLINE void returned(srook::uint16_t b) SROOK_NOEXCEPT_TRUE
+    {
+        if (!--refs_[b]) give_back(b);
+    }
+
+    // Whether receives have any buffer left to pick.
+    SROOK_FORCE_INLINE bool has_buffers() const SROOK_NOEXCEPT_TRUE
+    {
+        return lent_ < buffers_;
+    }
+
+    // Makes the buffers given back since the last call available to receives again.
+    SROOK_FORCE_INLINE void publish() SROOK_NOEXCEPT_TRUE
+    {
+        __atomic_store_n(&reinterpret_cast<::io_uring_buf_ring*>(pool_)->tail, buf_tail_, __ATOMIC_RELEASE);
+    }
+private:
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST srook::uint16_t group = 0;
+
+    SROOK_FORCE_INLINE static std::size_t pool_buffers(std::size_t buffer_size) SROOK_NOEXCEPT_TRUE
+    {
+        std::size_t n = 4096;
+        while (n > 512 && n * buffer_size > (std::size_t(1) << 24)) n >>= 1;
+        return n;
+    }
+
+    SROOK_FORCE_INLINE std::size_t ring_size() const SROOK_NOEXCEPT_TRUE
+    {
+        const std::size_t page = std::size_t(::sysconf(_SC_PAGESIZE));
+        return (buffers_ * sizeof(::io_uring_buf) + page - 1) / page * page;
+    }
+
+    SROOK_FORCE_INLINE std::size_t pool_size() const SROOK_NOEXCEPT_TRUE
+    {
+        return ring_size() + buffers_ * buffer_size_;
+    }
+
+    // The next free submission queue entry, zeroed. When the queue is full, what is in it is submitted first.
+    SROOK_FORCE_INLINE ::io_uring_sqe* next() SROOK_NOEXCEPT_TRUE
+    {
+        if (sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_ && (!enter(false) || sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_)) {
+            srook::process::perror("io_uring_enter");
+            return nullptr;
+        }
+        ::io_uring_sqe* sqe = static_cast<::io_uring_sqe*>(sqes_) + (sq_tail_++ & sq_mask_);
+        std::memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    SROOK_FORCE_INLINE void give_back(srook::uint16_t b) SROOK_NOEXCEPT_TRUE
+    {
+        --lent_;
+        provide(b);
+    }
+
+    // Only the address, length and id of an entry are written: the ring's tail shares its first entry.
+    // The entries are indexed by hand, since C++ gives io_uring_buf_ring::bufs an offset of its own.
+    SROOK_FORCE_INLINE void provide(srook::uint16_t b) SROOK_NOEXCEPT_TRUE
+    {
+        ::io_uring_buf& e = static_cast<::io_uring_buf*>(pool_)[buf_tail_++ & (buffers_ - 1)];
+        e.addr = reinterpret_cast<srook::uint64_t>(data(b));
+        e.len = static_cast<srook::uint32_t>(buffer_size_);
+        e.bid = b;
+    }
+
+    SROOK_FORCE_INLINE void teardown(const char* error) SROOK_NOEXCEPT_TRUE
+    {
+        if (error) srook::process::perror(error);
+        if (pool_ != MAP_FAILED) ::munmap(pool_, pool_mapped_);
+        if (sqes_ != MAP_FAILED) ::munmap(sqes_, sq_entries_ * sizeof(::io_uring_sqe));
+        if (rings_ != MAP_FAILED) ::munmap(rings_, rings_size_);
+        if (fd_ >= 0) ::close(fd_);
+        pool_ = sqes_ = rings_ = MAP_FAILED;
+        fd_ = -1;
+    }
+
+    int fd_;
+    void* rings_;
+    void* sqes_;
+    void* pool_;
+    std::size_t rings_size_, pool_mapped_;
+    srook::uint32_t* sq_head_;
+    srook::uint32_t* sq_ktail_;
+    srook::uint32_t sq_mask_, sq_entries_ = 0, sq_tail_, submitted_;
+    srook::uint32_t* cq_head_;
+    srook::uint32_t* cq_tail_;
+    srook::uint32_t cq_mask_;
+    ::io_uring_cqe* cqes_;
+    std::size_t buffers_, buffer_size_;
+    srook::uint16_t buf_tail_;
+    std::size_t lent_;
+    std::vector<srook::uint16_t> refs_;
+};
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
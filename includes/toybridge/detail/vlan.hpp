@@ -0,0 +1,176 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_DETAIL_VLAN_HPP
+#define INCLUDED_TOYBRIDGE_DETAIL_VLAN_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/detail/init.hpp>
+#include <toybridge/detail/timestamp.hpp>
+#include <toybridge/devinfo.hpp>
+#include <toybridge/vlan_config.hpp>
+#include <srook/optional.hpp>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+namespace detail {
+
+SROOK_INLINE_VARIABLE SROOK_CONSTEXPR_OR_CONST std::size_t vlan_tag_size = 4;
+
+// The VID of a frame that carries an 802.1Q tag.
+SROOK_FORCE_INLINE srook::uint16_t vlan_vid(const ::u_char* frame) SROOK_NOEXCEPT_TRUE
+{
+    return static_cast<srook::uint16_t>((frame[14] << 8 | frame[15]) & 0xfff);
+}
+
+// Whether a frame carries a tag with an 802.1Q (0x8100), 802.1ad (0x88a8) or pre-standard
+// service (0x9100) TPID in front of its ethertype.
+SROOK_FORCE_INLINE bool vlan_tagged(const ::u_char* frame, std::size_t len) SROOK_NOEXCEPT_TRUE
+{
+    const srook::uint16_t tpid = static_cast<srook::uint16_t>(frame[12] << 8 | frame[13]);
+    return (tpid == ETH_P_8021Q || tpid == ETH_P_8021AD || tpid == 0x9100) && len >= ETH_HLEN + vlan_tag_size;
+}
+
+// Inserts a tag between the addresses and the ethertype of a frame, moving only the addresses into
+// the vlan_tag_size bytes in front of it, which must be there to take them. Returns where the frame
+// now begins.
+SROOK_FORCE_INLINE ::u_char* push_tag(::u_char* frame, std::size_t& len, srook::uint16_t tpid, srook::uint16_t tci) SROOK_NOEXCEPT_TRUE
+{
+    ::u_char* const p = frame - vlan_tag_size;
+    std::memmove(p, frame, 2 * ETH_ALEN);
+    p[12] = static_cast<::u_char>(tpid >> 8);
+    p[13] = static_cast<::u_char>(tpid);
+    p[14] = static_cast<::u_char>(tci >> 8);
+    p[15] = static_cast<::u_char>(tci);
+    len += vlan_tag_size;
+    return p;
+}
+
+// Drivers and veth take the outer tag off a frame before a packet socket sees it and hand it over
+// in a PACKET_AUXDATA control message instead. This puts such a tag back as push_tag() does.
+SROOK_FORCE_INLINE ::u_char* restore_tag(const ::msghdr& msg, ::u_char* frame, std::size_t& len) SROOK_NOEXCEPT_TRUE
+{
+    for (const ::cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(const_cast<::msghdr*>(&msg), const_cast<::cmsghdr*>(c))) {
+        if (c->cmsg_level != SOL_PACKET || c->cmsg_type != PACKET_AUXDATA || c->cmsg_len < CMSG_LEN(sizeof(::tpacket_auxdata))) continue;
+        ::tpacket_auxdata aux;
+        std::memcpy(&aux, CMSG_DATA(c), sizeof(aux));
+        if (!(aux.tp_status & TP_STATUS_VLAN_VALID) || len < 2 * ETH_ALEN) return frame;
+        const srook::uint16_t tpid = aux.tp_status & TP_STATUS_VLAN_TPID_VALID ? aux.tp_vlan_tpid : srook::uint16_t(ETH_P_8021Q);
+        return push_tag(frame, len, tpid, aux.tp_vlan_tci);
+    }
+    return frame;
+}
+
+// Room for one PACKET_AUXDATA control message.
+SROOK_INLINE_VARIABLE SROOK_CONSTEXPR_OR_CONST std::size_t auxdata_space = CMSG_SPACE(sizeof(::tpacket_auxdata));
+
+// Asks for PACKET_AUXDATA on soc.
+SROOK_FORCE_INLINE srook::optional<int> auxdata(int soc) SROOK_NOEXCEPT_TRUE
+{
+    const int one = 1;
+    return toybridge::detail::setsockopt(soc, SOL_PACKET, PACKET_AUXDATA, &one, sizeof(one));
+}
+
+// Receives a frame into frame, as recv(2) with MSG_TRUNC would, and puts back the tag the kernel
+// took off, if any, which moves frame. Returns the whole length of the frame; a frame that did not
+// fit is left as it was. With stamp, also tells the frame's rx_timestamp() through it.
+SROOK_FORCE_INLINE srook::optional<int> recv_tagged(int soc, ::u_char*& frame, std::size_t len, srook::uint64_t* stamp = nullptr) SROOK_NOEXCEPT_TRUE
+{
+    ::iovec iov = { frame, len };
+    alignas(::cmsghdr) char control[auxdata_space + timestamping_space];
+    ::msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    const ::ssize_t n = ::recvmsg(soc, &msg, MSG_TRUNC);
+    if (n <= 0) return srook::nullopt;
+    if (stamp) *stamp = rx_timestamp(msg);
+    std::size_t whole = std::size_t(n);
+    if (!(msg.msg_flags & MSG_TRUNC)) frame = restore_tag(msg, frame, whole);
+    return { int(whole) };
+}
+
+// The VLAN membership of every port as bitmaps: per VID, the ports that carry it and those of them
+// that send it untagged. Frames are forwarded tagged with their VLAN, whichever port they came in
+// on, and leave untagged ports without the tag.
+class vlan_table {
+public:
+    SROOK_FORCE_INLINE vlan_table(const vlan_config& cfg, const std::vector<std::string>& devices)
+        : entries_(new entry[vlan_config::vids]())
+    {
+        for (const vlan_config::port& p : cfg.ports()) {
+            if (std::find(devices.cbegin(), devices.cend(), p.device) == devices.cend()) {
+                std::cerr << "vlan: " << p.device << " is not a port of the bridge, ignoring it" << std::endl;
+            }
+        }
+        for (std::size_t i = 0; i < devices.size(); ++i) {
+            const vlan_config::port p = cfg.find(devices[i]);
+            const port_mask bit = port_mask(1) << i;
+            for (std::size_t vid = 1; vid < vlan_config::vids - 1; ++vid) {
+                if (p.tagged[vid]) entries_[vid].members |= bit;
+            }
+            pvid_.push_back(p.pvid);
+            if (!p.pvid) continue;
+            entries_[p.pvid].members |= bit;
+            entries_[p.pvid].untagged |= bit;
+        }
+    }
+
+    // The ports of VLAN vid.
+    SROOK_FORCE_INLINE port_mask members(srook::uint16_t vid) const SROOK_NOEXCEPT_TRUE
+    {
+        return entries_[vid].members;
+    }
+
+    // The ports that send VLAN vid untagged.
+    SROOK_FORCE_INLINE port_mask untagged(srook::uint16_t vid) const SROOK_NOEXCEPT_TRUE
+    {
+        return entries_[vid].untagged;
+    }
+
+    // Tags a frame that came in on port in with its VLAN: a tagged frame, which may carry an
+    // 802.1ad service tag as well as an 802.1Q one, is in the VLAN of its outer tag, and an
+    // untagged or priority-tagged frame gets the VID of the port's pvid. Returns whether the port
+    // is a member of that VLAN; when it is not, the frame must be dropped. An untagged frame needs
+    // vlan_tag_size bytes of room in front of it, and moves into them; a tagged one is never moved,
+    // so that a frame whose tag restore_tag() put back does not need room for a second one.
+    SROOK_FORCE_INLINE bool admit(std::size_t in, ::u_char*& frame, std::size_t& len) const SROOK_NOEXCEPT_TRUE
+    {
+        srook::uint16_t vid;
+        if (vlan_tagged(frame, len)) {
+            vid = vlan_vid(frame);
+            if (!vid) {
+                vid = pvid_[in];
+                frame[14] = static_cast<::u_char>((frame[14] & 0xf0) | (vid >> 8));
+                frame[15] = static_cast<::u_char>(vid);
+            }
+        } else {
+            vid = pvid_[in];
+            if (vid) frame = push_tag(frame, len, ETH_P_8021Q, vid);
+        }
+        return (entries_[vid].members >> in) & 1;
+    }
+private:
+    struct entry {
+        port_mask members, untagged;
+    };
+
+    std::unique_ptr<entry[]> entries_;
+    std::vector<srook::uint16_t> pvid_;
+};
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
@@ -0,0 +1,119 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_DETAIL_WORKER_HPP
+#define INCLUDED_TOYBRIDGE_DETAIL_WORKER_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/detail/egress.hpp>
+#include <toybridge/detail/frame_pool.hpp>
+#include <toybridge/detail/init.hpp>
+#include <toybridge/detail/log.hpp>
+#include <toybridge/detail/pcapng.hpp>
+#include <toybridge/detail/mmsg.hpp>
+#include <toybridge/detail/ring.hpp>
+#include <toybridge/detail/stats.hpp>
+#include <toybridge/detail/uring.hpp>
+#include <toybridge/detail/xdp.hpp>
+#include <toybridge/fdb.hpp>
+#include <srook/optional.hpp>
+#include <linux/if_packet.h>
+#include <pthread.h>
+#include <sched.h>
+#include <cerrno>
+#include <memory>
+#include <vector>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+namespace detail {
+
+// Everything one forwarding thread owns: a socket per port, the rings mapped onto those
+// sockets and its receive buffers. Nothing in here is touched by any other thread.
+struct worker {
+    std::vector<srook::optional<int>> socks;
+    std::vector<srook::optional<packet_rings>> rings;
+    // The frames received with read(2) or recvmmsg(2) live in here. It is made by the worker thread
+    // itself, once pinned, and outlives everything below that may hold on to its frames.
+    std::unique_ptr<frame_pool> pool;
+    srook::optional<mmsg_batch> batch;
+    // One per port, when queues are on. backlog holds the ports whose queue has frames, blocked those
+    // of them whose socket is full, which wait for EPOLLOUT.
+    std::vector<egress_queue> egress;
+    port_mask backlog = 0, blocked = 0;
+    // With AF_XDP, socks are the AF_XDP sockets in here and nothing else above is used.
+    std::unique_ptr<xdp_ports> xdp;
+    // With io_uring, the worker neither uses rings nor batch, and does without epoll.
+    std::unique_ptr<uring_engine> uring;
+    fdb::time_type now = 0;
+    // The ports whose TX ring (PACKET_TX_RING or AF_XDP) holds frames that have not been kicked yet.
+    port_mask pending = 0;
+    // Where verbose records go, when verbose is on.
+    log_ring* log = nullptr;
+    // Where captured frames go, when capturing, and how many frames were forwarded since the last one.
+    capture_ring* capture = nullptr;
+    std::size_t unsampled = 0;
+    worker_stats* stats = nullptr;
+    // Whether the sockets timestamp what they receive, against which stats->transit is measured.
+    bool timestamps = false;
+};
+
+// Makes soc a member of the PACKET_FANOUT group of the given id, so that the kernel spreads
+// the frames of the port over every member socket. PACKET_FANOUT_HASH keeps each flow on one
+// member, PACKET_FANOUT_CPU picks the member by the CPU the frame arrived on.
+SROOK_FORCE_INLINE srook::optional<int> join_fanout(int soc, srook::uint16_t group, int mode)
+SROOK_NOEXCEPT_TRUE
+{
+    const int arg = group | (mode << 16);
+    return toybridge::detail::setsockopt(soc, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg));
+}
+
+// Makes soc the first member of a new PACKET_FANOUT group, whose id the kernel picks among those
+// no socket on the host uses (Linux 4.19), and stores that id in group for the other members.
+SROOK_FORCE_INLINE srook::optional<int> create_fanout(int soc, int mode, srook::optional<srook::uint16_t>& group)
+SROOK_NOEXCEPT_TRUE
+{
+    const int arg = (mode | PACKET_FANOUT_FLAG_UNIQUEID) << 16;
+    return toybridge::detail::setsockopt(soc, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) >>= [&group](int soc) -> srook::optional<int> {
+        int id = 0;
+        ::socklen_t len = sizeof(id);
+        if (::getsockopt(soc, SOL_PACKET, PACKET_FANOUT, &id, &len) < 0) return error_close("getsockopt", soc), srook::nullopt;
+        group = static_cast<srook::uint16_t>(id);
+        return { soc };
+    };
+}
+
+// Pins the calling thread to CPU cpu.
+SROOK_FORCE_INLINE bool pin_to(int cpu) SROOK_NOEXCEPT_TRUE
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        errno = EINVAL;
+        return false;
+    }
+    ::cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    const int r = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+    errno = r;
+    return !r;
+}
+
+// Pins the calling thread to the n-th CPU it is allowed to run on, wrapping around.
+SROOK_FORCE_INLINE bool pin(std::size_t n) SROOK_NOEXCEPT_TRUE
+{
+    ::cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (::sched_getaffinity(0, sizeof(allowed), &allowed) < 0 || !CPU_COUNT(&allowed)) return false;
+
+    n %= std::size_t(CPU_COUNT(&allowed));
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed) && !n--) return pin_to(cpu);
+    }
+    return false;
+}
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
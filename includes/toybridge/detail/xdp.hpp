@@ -0,0 +1,451 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_DETAIL_XDP_HPP
+#define INCLUDED_TOYBRIDGE_DETAIL_XDP_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/detail/init.hpp>
+#include <toybridge/detail/memory.hpp>
+#include <srook/optional.hpp>
+#include <srook/process/perror.hpp>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef AF_XDP
+#   define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#   define SOL_XDP 283
+#endif
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+namespace detail {
+
+SROOK_FORCE_INLINE int bpf(int cmd, ::bpf_attr& attr) SROOK_NOEXCEPT_TRUE
+{
+    return static_cast<int>(::syscall(__NR_bpf, cmd, &attr, sizeof(attr)));
+}
+
+// The XDP program of one port, attached through a BPF link that goes away with it: every
+// frame that arrives on a queue with an AF_XDP socket in the map is redirected to that socket,
+// everything else goes on to the kernel stack. Generic (SKB) mode works on any device, veth
+// included; native mode needs driver support.
+class xdp_program {
+public:
+    SROOK_FORCE_INLINE xdp_program(unsigned int ifindex, std::size_t queues, bool native) SROOK_NOEXCEPT_TRUE
+        : map_(-1), prog_(-1), link_(-1)
+    {
+        ::bpf_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.map_type = BPF_MAP_TYPE_XSKMAP;
+        attr.key_size = sizeof(srook::uint32_t);
+        attr.value_size = sizeof(srook::uint32_t);
+        attr.max_entries = static_cast<srook::uint32_t>(queues);
+        if ((map_ = bpf(BPF_MAP_CREATE, attr)) < 0) {
+            srook::process::perror("bpf(BPF_MAP_CREATE)");
+            return;
+        }
+
+        // r2 = ctx->rx_queue_index; return bpf_redirect_map(map, r2, XDP_PASS);
+        const ::bpf_insn insns[] = {
+            { BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof(::xdp_md, rx_queue_index), 0 },
+            { BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_ },
+            { 0, 0, 0, 0, 0 },
+            { BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS },
+            { BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map },
+            { BPF_JMP | BPF_EXIT, 0, 0, 0, 0 },
+        };
+        static const char license[] = "Dual MIT/GPL";
+        std::memset(&attr, 0, sizeof(attr));
+        attr.prog_type = BPF_PROG_TYPE_XDP;
+        attr.insns = reinterpret_cast<srook::uint64_t>(insns);
+        attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+        attr.license = reinterpret_cast<srook::uint64_t>(license);
+        attr.expected_attach_type = BPF_XDP;
+        if ((prog_ = bpf(BPF_PROG_LOAD, attr)) < 0) {
+            srook::process::perror("bpf(BPF_PROG_LOAD)");
+            return;
+        }
+
+        std::memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = static_cast<srook::uint32_t>(prog_);
+        attr.link_create.target_ifindex = ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = native ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+        if ((link_ = bpf(BPF_LINK_CREATE, attr)) < 0) srook::process::perror("bpf(BPF_LINK_CREATE)");
+    }
+
+    xdp_program(const xdp_program&) = delete;
+    xdp_program& operator=(const xdp_program&) = delete;
+
+    SROOK_FORCE_INLINE ~xdp_program()
+    {
+        for (int fd : { link_, prog_, map_ }) {
+            if (fd >= 0) ::close(fd);
+        }
+    }
+
+    SROOK_FORCE_INLINE explicit operator bool() const SROOK_NOEXCEPT_TRUE
+    {
+        return link_ >= 0;
+    }
+
+    // Directs the frames of the given queue to the AF_XDP socket soc.
+    SROOK_FORCE_INLINE bool add(srook::uint32_t queue, int soc) SROOK_NOEXCEPT_TRUE
+    {
+        const srook::uint32_t value = static_cast<srook::uint32_t>(soc);
+        ::bpf_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.map_fd = static_cast<srook::uint32_t>(map_);
+        attr.key = reinterpret_cast<srook::uint64_t>(&queue);
+        attr.value = reinterpret_cast<srook::uint64_t>(&value);
+        attr.flags = BPF_ANY;
+        if (bpf(BPF_MAP_UPDATE_ELEM, attr) < 0) {
+            srook::process::perror("bpf(BPF_MAP_UPDATE_ELEM)");
+            return false;
+        }
+        return true;
+    }
+private:
+    int map_, prog_, link_;
+};
+
+// The frames of one worker, shared by its sockets on every port: a frame received on one port
+// is sent out of another by handing its address over, without a copy. Frames not in any ring
+// sit on a free list.
+class xsk_umem {
+public:
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t frame_size = 2048;
+
+    // frames frames, on huge pages with huge.
+    SROOK_FORCE_INLINE explicit xsk_umem(std::size_t frames, bool huge = false) SROOK_NOEXCEPT_TRUE
+        : size_(frames * frame_size), mapped_(size_), area_(static_cast<::u_char*>(map_anonymous(mapped_, huge)))
+    {
+        if (area_ == MAP_FAILED) {
+            srook::process::perror("mmap");
+            return;
+        }
+        free_.reserve(frames);
+        for (std::size_t i = frames; i--;) free_.push_back(i * frame_size);
+    }
+
+    xsk_umem(const xsk_umem&) = delete;
+    xsk_umem& operator=(const xsk_umem&) = delete;
+
+    SROOK_FORCE_INLINE ~xsk_umem()
+    {
+        if (area_ != MAP_FAILED) ::munmap(area_, mapped_);
+    }
+
+    SROOK_FORCE_INLINE explicit operator bool() const SROOK_NOEXCEPT_TRUE
+    {
+        return area_ != MAP_FAILED;
+    }
+
+    SROOK_FORCE_INLINE ::xdp_umem_reg registration() const SROOK_NOEXCEPT_TRUE
+    {
+        ::xdp_umem_reg reg{};
+        reg.addr = reinterpret_cast<srook::uint64_t>(area_);
+        reg.len = size_;
+        reg.chunk_size = frame_size;
+        return reg;
+    }
+
+    SROOK_FORCE_INLINE ::u_char* data(srook::uint64_t addr) const SROOK_NOEXCEPT_TRUE
+    {
+        return area_ + addr;
+    }
+
+    SROOK_FORCE_INLINE bool alloc(srook::uint64_t& addr) SROOK_NOEXCEPT_TRUE
+    {
+        if (free_.empty()) return false;
+        addr = free_.back();
+        free_.pop_back();
+        return true;
+    }
+
+    // Takes back the frame that addr points into.
+    SROOK_FORCE_INLINE void release(srook::uint64_t addr) SROOK_NOEXCEPT_TRUE
+    {
+        free_.push_back(addr & ~srook::uint64_t(frame_size - 1));
+    }
+
+    // A free frame holding a copy of the len bytes at addr.
+    SROOK_FORCE_INLINE bool copy(srook::uint64_t addr, std::size_t len, srook::uint64_t& to) SROOK_NOEXCEPT_TRUE
+    {
+        if (!alloc(to)) return false;
+        std::memcpy(data(to), data(addr), len);
+        return true;
+    }
+private:
+    std::size_t size_, mapped_;
+    ::u_char* area_;
+    std::vector<srook::uint64_t> free_;
+};
+
+// One of the four single-producer, single-consumer rings an AF_XDP socket shares with the kernel.
+template <class T>
+class xsk_queue {
+public:
+    SROOK_FORCE_INLINE xsk_queue() SROOK_NOEXCEPT_TRUE
+        : map_(MAP_FAILED), size_(0), producer_(nullptr), consumer_(nullptr), ring_(nullptr), mask_(0) {}
+
+    xsk_queue(const xsk_queue&) = delete;
+    xsk_queue& operator=(const xsk_queue&) = delete;
+
+    SROOK_FORCE_INLINE ~xsk_queue()
+    {
+        if (map_ != MAP_FAILED) ::munmap(map_, size_);
+    }
+
+    SROOK_FORCE_INLINE bool map(int soc, const ::xdp_ring_offset& off, std::size_t n, ::off_t pgoff) SROOK_NOEXCEPT_TRUE
+    {
+        size_ = off.desc + n * sizeof(T);
+        map_ = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, soc, pgoff);
+        if (map_ == MAP_FAILED) return false;
+        char* base = static_cast<char*>(map_);
+        producer_ = reinterpret_cast<srook::uint32_t*>(base + off.producer);
+        consumer_ = reinterpret_cast<srook::uint32_t*>(base + off.consumer);
+        ring_ = reinterpret_cast<T*>(base + off.desc);
+        mask_ = static_cast<srook::uint32_t>(n - 1);
+        return true;
+    }
+
+    // The producer's side: how many entries may be written at producer() onwards, and publishing n of them.
+    SROOK_FORCE_INLINE srook::uint32_t room() const SROOK_NOEXCEPT_TRUE
+    {
+        return mask_ + 1 - (producer() - __atomic_load_n(consumer_, __ATOMIC_ACQUIRE));
+    }
+
+    SROOK_FORCE_INLINE srook::uint32_t producer() const SROOK_NOEXCEPT_TRUE
+    {
+        return __atomic_load_n(producer_, __ATOMIC_RELAXED);
+    }
+
+    SROOK_FORCE_INLINE void produce(srook::uint32_t n) SROOK_NOEXCEPT_TRUE
+    {
+        __atomic_store_n(producer_, producer() + n, __ATOMIC_RELEASE);
+    }
+
+    // The consumer's side: how many entries may be read at consumer() onwards, and releasing n of them.
+    SROOK_FORCE_INLINE srook::uint32_t ready() const SROOK_NOEXCEPT_TRUE
+    {
+        return __atomic_load_n(producer_, __ATOMIC_ACQUIRE) - consumer();
+    }
+
+    SROOK_FORCE_INLINE srook::uint32_t consumer() const SROOK_NOEXCEPT_TRUE
+    {
+        return __atomic_load_n(consumer_, __ATOMIC_RELAXED);
+    }
+
+    SROOK_FORCE_INLINE void consume(srook::uint32_t n) SROOK_NOEXCEPT_TRUE
+    {
+        __atomic_store_n(consumer_, consumer() + n, __ATOMIC_RELEASE);
+    }
+
+    // Whether the kernel has yet to consume anything that was produced.
+    SROOK_FORCE_INLINE bool busy() const SROOK_NOEXCEPT_TRUE
+    {
+        return producer() != __atomic_load_n(consumer_, __ATOMIC_ACQUIRE);
+    }
+
+    SROOK_FORCE_INLINE T& operator[](srook::uint32_t i) SROOK_NOEXCEPT_TRUE
+    {
+        return ring_[i & mask_];
+    }
+private:
+    void* map_;
+    std::size_t size_;
+    srook::uint32_t* producer_;
+    srook::uint32_t* consumer_;
+    T* ring_;
+    srook::uint32_t mask_;
+};
+
+// An AF_XDP socket bound to one queue of one port. The first socket of a worker registers
+// the UMEM, the others share it; each has fill and completion rings of its own, as sockets
+// on different devices must. The descriptor belongs to the worker's port sockets, which the
+// bridge closes; this only unmaps the rings.
+class xsk {
+public:
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t ring_size = 1024;
+
+    SROOK_FORCE_INLINE xsk(xsk_umem& umem, unsigned int ifindex, srook::uint32_t queue, int shared) SROOK_NOEXCEPT_TRUE
+        : soc_(::socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0))
+    {
+        if (soc_ < 0) {
+            srook::process::perror("socket(AF_XDP)");
+            return;
+        }
+        const int n = ring_size;
+        const ::xdp_umem_reg reg = umem.registration();
+        ::xdp_mmap_offsets off{};
+        ::socklen_t offlen = sizeof(off);
+        ::sockaddr_xdp addr{};
+        addr.sxdp_family = AF_XDP;
+        addr.sxdp_ifindex = ifindex;
+        addr.sxdp_queue_id = queue;
+        addr.sxdp_flags = shared < 0 ? 0 : XDP_SHARED_UMEM;
+        addr.sxdp_shared_umem_fd = shared < 0 ? 0 : static_cast<srook::uint32_t>(shared);
+
+        const bool ok = (shared >= 0 || !::setsockopt(soc_, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg))) &&
+            !::setsockopt(soc_, SOL_XDP, XDP_UMEM_FILL_RING, &n, sizeof(n)) &&
+            !::setsockopt(soc_, SOL_XDP, XDP_UMEM_COMPLETION_RING, &n, sizeof(n)) &&
+            !::setsockopt(soc_, SOL_XDP, XDP_RX_RING, &n, sizeof(n)) &&
+            !::setsockopt(soc_, SOL_XDP, XDP_TX_RING, &n, sizeof(n)) &&
+            !::getsockopt(soc_, SOL_XDP, XDP_MMAP_OFFSETS, &off, &offlen) &&
+            fill_.map(soc_, off.fr, ring_size, XDP_UMEM_PGOFF_FILL_RING) &&
+            comp_.map(soc_, off.cr, ring_size, XDP_UMEM_PGOFF_COMPLETION_RING) &&
+            rx_.map(soc_, off.rx, ring_size, XDP_PGOFF_RX_RING) &&
+            tx_.map(soc_, off.tx, ring_size, XDP_PGOFF_TX_RING) &&
+            (refill(umem), !::bind(soc_, reinterpret_cast<const ::sockaddr*>(&addr), sizeof(addr)));
+        if (!ok) {
+            error_close("AF_XDP", soc_);
+            soc_ = -1;
+        }
+    }
+
+    SROOK_FORCE_INLINE explicit operator bool() const SROOK_NOEXCEPT_TRUE
+    {
+        return soc_ >= 0;
+    }
+
+    SROOK_FORCE_INLINE int fd() const SROOK_NOEXCEPT_TRUE
+    {
+        return soc_;
+    }
+
+    // Hands every received frame to fn(addr, len), which from then on owns it, and returns how many there were.
+    template <class F>
+    SROOK_FORCE_INLINE std::size_t receive(F&& fn)
+    {
+        const srook::uint32_t n = rx_.ready(), first = rx_.consumer();
+        for (srook::uint32_t i = 0; i < n; ++i) {
+            const ::xdp_desc d = rx_[first + i];
+            fn(d.addr, d.len);
+        }
+        rx_.consume(n);
+        return n;
+    }
+
+    // Queues the frame at addr for sending; on success it belongs to the kernel until it completes.
+    SROOK_FORCE_INLINE bool send(srook::uint64_t addr, srook::uint32_t len) SROOK_NOEXCEPT_TRUE
+    {
+        if (!tx_.room()) return false;
+        ::xdp_desc& d = tx_[tx_.producer()];
+        d.addr = addr;
+        d.len = len;
+        d.options = 0;
+        tx_.produce(1);
+        return true;
+    }
+
+    // Makes the kernel send what is queued. In copy mode it only takes so many frames per call, so
+    // it is asked again while frames are left, but not once the device cannot take more: those wait
+    // for the next kick, and busy() tells whether there are any.
+    SROOK_FORCE_INLINE bool kick() SROOK_NOEXCEPT_TRUE
+    {
+        for (std::size_t tries = 0; tx_.busy() && tries < ring_size; ++tries) {
+            if (::sendto(soc_, nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0) return errno == EAGAIN || errno == EBUSY || errno == ENOBUFS;
+        }
+        return true;
+    }
+
+    // Whether frames are queued that the kernel has yet to take.
+    SROOK_FORCE_INLINE bool busy() const SROOK_NOEXCEPT_TRUE
+    {
+        return tx_.busy();
+    }
+
+    // Takes back the frames that were sent and gives free frames to the kernel to receive into.
+    SROOK_FORCE_INLINE void recycle(xsk_umem& umem) SROOK_NOEXCEPT_TRUE
+    {
+        const srook::uint32_t n = comp_.ready(), first = comp_.consumer();
+        for (srook::uint32_t i = 0; i < n; ++i) umem.release(comp_[first + i]);
+        comp_.consume(n);
+        refill(umem);
+    }
+private:
+    SROOK_FORCE_INLINE void refill(xsk_umem& umem) SROOK_NOEXCEPT_TRUE
+    {
+        const srook::uint32_t first = fill_.producer();
+        srook::uint32_t n = 0;
+        for (const srook::uint32_t room = fill_.room(); n < room && umem.alloc(fill_[first + n]); ++n);
+        fill_.produce(n);
+    }
+
+    int soc_;
+    xsk_queue<srook::uint64_t> fill_, comp_;
+    xsk_queue<::xdp_desc> rx_, tx_;
+};
+
+// The AF_XDP sockets of one worker, one per port, and the UMEM they share. There are enough
+// frames for every ring of every socket to be full at once.
+struct xdp_ports {
+    SROOK_FORCE_INLINE explicit xdp_ports(std::size_t ports, bool huge = false)
+        : umem(ports * 4 * xsk::ring_size, huge)
+    {
+        sockets.reserve(ports);
+    }
+
+    SROOK_FORCE_INLINE srook::optional<int> add(unsigned int ifindex, srook::uint32_t queue)
+    {
+        sockets.emplace_back(new xsk(umem, ifindex, queue, sockets.empty() ? -1 : sockets.front()->fd()));
+        return *sockets.back() ? srook::make_optional(sockets.back()->fd()) : srook::nullopt;
+    }
+
+    SROOK_FORCE_INLINE void recycle() SROOK_NOEXCEPT_TRUE
+    {
+        for (const std::unique_ptr<xsk>& s : sockets) s->recycle(umem);
+    }
+
+    xsk_umem umem;
+    std::vector<std::unique_ptr<xsk>> sockets;
+};
+
+// The interface index of a device, or 0 when there is no such device.
+SROOK_FORCE_INLINE unsigned int ifindex(const std::string& device) SROOK_NOEXCEPT_TRUE
+{
+    ::ifreq ifr{};
+    std::strncpy(ifr.ifr_name, device.c_str(), sizeof(ifr.ifr_name) - 1);
+    return bool(toybridge::detail::socket(AF_INET, SOCK_DGRAM, 0) >>= [&ifr](int soc) {
+        return toybridge::detail::ioctl(soc, SIOCGIFINDEX, &ifr) >>= [](int soc) {
+            ::close(soc);
+            return srook::make_optional(soc);
+        };
+    }) ? static_cast<unsigned int>(ifr.ifr_ifindex) : 0;
+}
+
+// Puts a device into promiscuous mode, as init() does for AF_PACKET ports.
+SROOK_FORCE_INLINE bool promiscuous(const std::string& device) SROOK_NOEXCEPT_TRUE
+{
+    ::ifreq ifr{};
+    std::strncpy(ifr.ifr_name, device.c_str(), sizeof(ifr.ifr_name) - 1);
+    return bool(toybridge::detail::socket(AF_INET, SOCK_DGRAM, 0) >>= [&ifr](int soc) {
+        return toybridge::detail::ioctl(soc, SIOCGIFFLAGS, &ifr) >>= [&ifr](int soc) {
+            ifr.ifr_flags = ifr.ifr_flags | IFF_PROMISC;
+            return toybridge::detail::ioctl(soc, SIOCSIFFLAGS, &ifr) >>= [](int soc) {
+                ::close(soc);
+                return srook::make_optional(soc);
+            };
+        };
+    });
+}
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
@@ -7,52 +7,42 @@
 #include <srook/type_traits/detail/logical.hpp>
 #include <srook/type_traits/decay.hpp>
 #include <srook/type_traits/is_constructible.hpp>
-#include <srook/type_traits/bool_constant.hpp>
-#include <srook/type_traits/type_constant.hpp>
-#include <srook/tmpl/vt/transfer.hpp>
-#include <srook/tmpl/vt/replicate.hpp>
-#include <tuple>
+#include <vector>
 
 namespace toybridge {
 SROOK_INLINE_NAMESPACE(v1)
 
 class devinfo {
 public:
-    // TODO: This implementation allowed only 2 devices.
-    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t max_devices = 2; 
+    // The number of ports a bridge can span. A set of ports fits in one 64-bit word.
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t max_devices = 64; 
     typedef srook::string::string_view string_type;
-    typedef SROOK_DEDUCED_TYPENAME srook::tmpl::vt::transfer<std::tuple, SROOK_DEDUCED_TYPENAME srook::tmpl::vt::replicate<max_devices, string_type>::type>::type tuple_type;
+    typedef std::vector<string_type> container_type;
+    typedef SROOK_DEDUCED_TYPENAME container_type::const_iterator const_iterator;
 
     template <class... Ts, 
-    SROOK_REQUIRES(srook::type_traits::detail::Land<srook::bool_constant<sizeof...(Ts) == max_devices>, srook::is_constructible<string_type, SROOK_DEDUCED_TYPENAME srook::decay<Ts>::type>...>::value)>
-    SROOK_FORCE_INLINE SROOK_CONSTEXPR devinfo(Ts&&... ts) SROOK_NOEXCEPT_TRUE 
-        : devices { srook::forward<Ts>(ts)... } 
+    SROOK_REQUIRES(srook::type_traits::detail::Land<srook::is_constructible<string_type, SROOK_DEDUCED_TYPENAME srook::decay<Ts>::type>...>::value)>
+    SROOK_FORCE_INLINE devinfo(Ts&&... ts)
+        : devices { string_type(srook::forward<Ts>(ts))... } 
     {}
+
+    template <class InputIterator, SROOK_REQUIRES(!srook::is_constructible<string_type, InputIterator>::value)>
+    SROOK_FORCE_INLINE devinfo(InputIterator first, InputIterator last)
+        : devices(first, last)
+    {}
+
+    SROOK_FORCE_INLINE std::size_t size() const SROOK_NOEXCEPT_TRUE { return devices.size(); }
+    SROOK_FORCE_INLINE const string_type& operator[](std::size_t n) const SROOK_NOEXCEPT_TRUE { return devices[n]; }
+    SROOK_FORCE_INLINE const_iterator begin() const SROOK_NOEXCEPT_TRUE { return devices.cbegin(); }
+    SROOK_FORCE_INLINE const_iterator end() const SROOK_NOEXCEPT_TRUE { return devices.cend(); }
     
-    tuple_type devices;
+    container_type devices;
 };
 
-template <std::size_t n>
-SROOK_CONSTEXPR SROOK_DECLTYPE(auto) 
-get(const devinfo& d) SROOK_NOEXCEPT_TRUE 
-{ 
-    return std::get<n>(d.devices); 
-}
+// A set of ports of one bridge, one bit per port index.
+typedef srook::uint64_t port_mask;
 
 SROOK_INLINE_NAMESPACE_END
 } // namespace toybridge
 
-namespace std {
-
-template <>
-struct tuple_size<toybridge::devinfo> 
-    : integral_constant<std::size_t, 2> {};
-
-template <std::size_t n>
-struct tuple_element<n, toybridge::devinfo>
-    : srook::type_constant<toybridge::devinfo::string_type> {};
-
-} // namespace std
-
 #endif
-
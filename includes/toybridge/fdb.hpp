@@ -0,0 +1,200 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_FDB_HPP
+#define INCLUDED_TOYBRIDGE_FDB_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+// The forwarding database of a learning bridge: which port a MAC address was last seen on, in
+// each VLAN of its own; a VLAN-unaware bridge keeps every address in VLAN 0.
+//
+// The table is a flat, fixed-capacity open-addressing hash table. Entries are 16 bytes and
+// grouped four to a 64-byte bucket; an address may live in either of two buckets picked by
+// independent hashes, so any lookup touches at most two cache lines and nothing is heap-allocated
+// after construction. Entries are not removed when they age out: a lookup ignores them, the
+// slot is reused by the next insertion and age() reclaims them incrementally.
+//
+// Every forwarding thread may call learn() and lookup() concurrently. Both are lock-free and,
+// as long as an address stays on its port, learn() writes to its entry at most once a second.
+// age() must only be called by one thread at a time.
+class fdb {
+public:
+    typedef srook::uint16_t port_type;
+    typedef srook::uint32_t time_type;
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST port_type npos = port_type(-1);
+
+    SROOK_FORCE_INLINE fdb(std::size_t max_entries, time_type aging)
+        : buckets_(allocate(bucket_count(max_entries))), mask_(bucket_count(max_entries) - 1),
+        max_entries_(max_entries), size_(0), aging_(aging), sweep_(0)
+    {}
+
+    // Records that mac was seen on port in VLAN vid at now.
+    SROOK_FORCE_INLINE void learn(const ::u_char* mac, port_type port, time_type now, srook::uint16_t vid = 0) SROOK_NOEXCEPT_TRUE
+    {
+        const srook::uint64_t k = key(mac, vid);
+        bucket* const b[] = { &buckets_[hash(k, 0x9e3779b97f4a7c15ull)], &buckets_[hash(k, 0xc2b2ae3d27d4eb4full)] };
+        entry* reusable = nullptr;
+        entry* oldest = nullptr;
+        std::size_t most_free = 0;
+        for (bucket* bk : b) {
+            entry* slot = nullptr;
+            std::size_t free = 0;
+            for (entry& e : bk->entries) {
+                const srook::uint64_t ek = e.key.load(std::memory_order_acquire);
+                // A slot another thread is filling in is neither free nor anyone's to evict.
+                if (ek == busy) continue;
+                if (ek == k) {
+                    if (e.port.load(std::memory_order_relaxed) != port) e.port.store(port, std::memory_order_relaxed);
+                    if (e.seen.load(std::memory_order_relaxed) != now) e.seen.store(now, std::memory_order_relaxed);
+                    return;
+                }
+                if (!ek || expired(e, now)) {
+                    if (!slot) slot = &e;
+                    ++free;
+                }
+                if (!oldest || e.seen.load(std::memory_order_relaxed) < oldest->seen.load(std::memory_order_relaxed)) oldest = &e;
+            }
+            // The emptier of the two buckets takes a new address, which keeps both from overflowing.
+            if (free > most_free) {
+                reusable = slot;
+                most_free = free;
+            }
+        }
+        if (!reusable) reusable = oldest;
+        if (!reusable) return;
+
+        // Claim the slot for this thread alone before filling it in, so that a concurrent lookup
+        // never pairs the new address with the port of the old one, and a thread that claims the
+        // same slot never leaves its port under this address.
+        srook::uint64_t old = reusable->key.load(std::memory_order_relaxed);
+        if (old == busy || (!old && size_.load(std::memory_order_relaxed) >= max_entries_)) return;
+        if (!reusable->key.compare_exchange_strong(old, busy, std::memory_order_acq_rel)) return;
+        if (old) size_.fetch_sub(1, std::memory_order_relaxed);
+        reusable->seen.store(now, std::memory_order_relaxed);
+        reusable->port.store(port, std::memory_order_relaxed);
+        reusable->key.store(k, std::memory_order_seq_cst);
+        size_.fetch_add(1, std::memory_order_relaxed);
+        deduplicate(b, k, reusable);
+    }
+
+    // The port mac was last seen on in VLAN vid, or npos when it is unknown or has aged out.
+    SROOK_FORCE_INLINE port_type lookup(const ::u_char* mac, time_type now, srook::uint16_t vid = 0) const SROOK_NOEXCEPT_TRUE
+    {
+        const srook::uint64_t k = key(mac, vid);
+        for (const entry& e : buckets_[hash(k, 0x9e3779b97f4a7c15ull)].entries) {
+            if (e.key.load(std::memory_order_acquire) == k) return expired(e, now) ? npos : e.port.load(std::memory_order_relaxed);
+        }
+        for (const entry& e : buckets_[hash(k, 0xc2b2ae3d27d4eb4full)].entries) {
+            if (e.key.load(std::memory_order_acquire) == k) return expired(e, now) ? npos : e.port.load(std::memory_order_relaxed);
+        }
+        return npos;
+    }
+
+    // Reclaims aged-out entries in the next n buckets, so the whole table is swept a little at a time.
+    SROOK_FORCE_INLINE void age(time_type now, std::size_t n) SROOK_NOEXCEPT_TRUE
+    {
+        for (; n; --n, sweep_ = (sweep_ + 1) & mask_) {
+            for (entry& e : buckets_[sweep_].entries) {
+                srook::uint64_t k = e.key.load(std::memory_order_relaxed);
+                if (k && k != busy && expired(e, now) && e.key.compare_exchange_strong(k, 0, std::memory_order_acq_rel)) {
+                    size_.fetch_sub(1, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    SROOK_FORCE_INLINE std::size_t size() const SROOK_NOEXCEPT_TRUE
+    {
+        return size_.load(std::memory_order_relaxed);
+    }
+
+    SROOK_FORCE_INLINE std::size_t capacity() const SROOK_NOEXCEPT_TRUE
+    {
+        return (mask_ + 1) * entries_per_bucket;
+    }
+private:
+    struct entry {
+        std::atomic<srook::uint64_t> key;
+        std::atomic<time_type> seen;
+        std::atomic<port_type> port;
+        srook::uint16_t reserved;
+    };
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t entries_per_bucket = 4;
+    // The key of a slot that learn() has claimed and is filling in. It lacks the marker bit of
+    // key(), so that it matches no address; lookup() and deduplicate() thereby pass it by.
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST srook::uint64_t busy = 1;
+    struct alignas(64) bucket {
+        entry entries[entries_per_bucket];
+    };
+    struct bucket_deleter {
+        SROOK_FORCE_INLINE void operator()(bucket* p) const SROOK_NOEXCEPT_TRUE { std::free(p); }
+    };
+
+    // Sized for a load factor of at most one half, rounded up to a power of two.
+    SROOK_FORCE_INLINE static std::size_t bucket_count(std::size_t max_entries) SROOK_NOEXCEPT_TRUE
+    {
+        std::size_t n = 2;
+        while (n * entries_per_bucket < max_entries * 2) n <<= 1;
+        return n;
+    }
+
+    static std::unique_ptr<bucket[], bucket_deleter> allocate(std::size_t n)
+    {
+        void* p = nullptr;
+        if (::posix_memalign(&p, alignof(bucket), n * sizeof(bucket))) throw std::bad_alloc();
+        return std::unique_ptr<bucket[], bucket_deleter>(new (p) bucket[n]());
+    }
+
+    // Two threads that learn the same new address at once may both insert it. Each then looks
+    // for another copy and removes whichever of the two sits later in the table, so the later
+    // copy is gone as soon as either of them sees the other.
+    SROOK_FORCE_INLINE void deduplicate(bucket* const (&b)[2], srook::uint64_t k, entry* mine) SROOK_NOEXCEPT_TRUE
+    {
+        for (bucket* bk : b) {
+            for (entry& e : bk->entries) {
+                if (&e == mine || e.key.load(std::memory_order_seq_cst) != k) continue;
+                srook::uint64_t expected = k;
+                if ((&e < mine ? mine : &e)->key.compare_exchange_strong(expected, 0, std::memory_order_acq_rel)) {
+                    size_.fetch_sub(1, std::memory_order_relaxed);
+                }
+                return;
+            }
+        }
+    }
+
+    // The six address bytes, the 12-bit VID above them and a marker bit on top, so that no valid key is zero.
+    SROOK_FORCE_INLINE static srook::uint64_t key(const ::u_char* mac, srook::uint16_t vid) SROOK_NOEXCEPT_TRUE
+    {
+        srook::uint64_t k = 0;
+        std::memcpy(&k, mac, ETH_ALEN);
+        return k | srook::uint64_t(vid & 0xfff) << 48 | (srook::uint64_t(1) << 63);
+    }
+
+    SROOK_FORCE_INLINE std::size_t hash(srook::uint64_t k, srook::uint64_t multiplier) const SROOK_NOEXCEPT_TRUE
+    {
+        return std::size_t((k * multiplier) >> 32) & mask_;
+    }
+
+    SROOK_FORCE_INLINE bool expired(const entry& e, time_type now) const SROOK_NOEXCEPT_TRUE
+    {
+        return now - e.seen.load(std::memory_order_relaxed) > aging_;
+    }
+
+    std::unique_ptr<bucket[], bucket_deleter> buckets_;
+    std::size_t mask_, max_entries_;
+    std::atomic<std::size_t> size_;
+    time_type aging_;
+    std::size_t sweep_;
+};
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
@@ -0,0 +1,277 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_MDB_HPP
+#define INCLUDED_TOYBRIDGE_MDB_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/devinfo.hpp>
+#include <toybridge/fdb.hpp>
+#include <srook/optional.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+// The multicast database of a snooping bridge: which ports have listeners for a multicast group,
+// and which ports multicast routers or queriers sit behind, each until its timer runs out.
+//
+// Groups are kept by destination MAC address and VLAN, which is what frames are forwarded by;
+// the 32 IPv4 groups that share a MAC address share an entry. The router ports of a VLAN are an
+// entry of their own under the all-zero address, which no group has, and take up room as a group
+// does; in a VLAN whose querier finds the table full, multicast goes on being flooded. The table is a fixed-capacity
+// open-addressing hash table with linear probing, so nothing is heap-allocated after construction.
+// Groups that go are taken out by backward-shift deletion rather than left as tombstones, so that
+// a probe for an unknown group never gets longer than the groups that are there make it.
+//
+// lookup() and routers() are lock-free and may be called by every forwarding thread at once; one
+// that races with age() moving an entry may miss its group, and the frame is flooded as for an
+// unknown one.
+// Reports, leaves and queries are rare, so join(), leave() and query() take a lock; age() only
+// tries to, and must only be called by one thread at a time.
+class mdb {
+public:
+    typedef fdb::time_type time_type;
+    // How long a listener stays after its last report unless told otherwise, as RFC 3376 and RFC 3810
+    // have it by default: the robustness variable times the query interval plus the query response interval.
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST time_type membership_interval = 2 * 125 + 10;
+    // How long a listener that has left stays, for the querier's group-specific queries to find
+    // out whether there is another one behind the same port: the last member query time.
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST time_type last_member_time = 2;
+    // How long a port stays a router port after the last query from it: the other querier present interval.
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST time_type querier_interval = 2 * 125 + 10 / 2;
+
+    SROOK_FORCE_INLINE mdb(std::size_t max_groups, std::size_t ports, time_type membership = membership_interval)
+        : groups_(new group[slot_count(max_groups)]()), timers_(new std::atomic<time_type>[slot_count(max_groups) * ports]()),
+        mask_(slot_count(max_groups) - 1), ports_(ports), max_groups_(max_groups), size_(0), sweep_(0), membership_(membership)
+    {}
+
+    // Records that port has a listener for the group mac in VLAN vid as of now.
+    SROOK_FORCE_INLINE void join(const ::u_char* mac, srook::uint16_t vid, std::size_t port, time_type now) SROOK_NOEXCEPT_TRUE
+    {
+        std::lock_guard<std::mutex> lk(lock_);
+        if (group* g = insert(key(mac, vid))) refresh(*g, timers(*g), port, now + membership_, false);
+    }
+
+    // Records that the last listener behind port left the group mac, unless another one reports soon.
+    SROOK_FORCE_INLINE void leave(const ::u_char* mac, srook::uint16_t vid, std::size_t port, time_type now) SROOK_NOEXCEPT_TRUE
+    {
+        std::lock_guard<std::mutex> lk(lock_);
+        group* g = find(key(mac, vid));
+        if (g && ((g->ports.load(std::memory_order_relaxed) >> port) & 1)) refresh(*g, timers(*g), port, now + last_member_time, true);
+    }
+
+    // Records that a query came in on port in VLAN vid at now.
+    SROOK_FORCE_INLINE void query(std::size_t port, srook::uint16_t vid, time_type now) SROOK_NOEXCEPT_TRUE
+    {
+        std::lock_guard<std::mutex> lk(lock_);
+        if (group* g = insert(router_key(vid))) refresh(*g, timers(*g), port, now + querier_interval, false);
+    }
+
+    // The ports with listeners for the group mac in VLAN vid, or nothing when the group is unknown.
+    SROOK_FORCE_INLINE srook::optional<port_mask> lookup(const ::u_char* mac, srook::uint16_t vid, time_type now) const SROOK_NOEXCEPT_TRUE
+    {
+        return lookup(key(mac, vid), now);
+    }
+
+    // The ports queries came in on lately in VLAN vid, none when no querier has been seen there.
+    SROOK_FORCE_INLINE port_mask routers(srook::uint16_t vid, time_type now) const SROOK_NOEXCEPT_TRUE
+    {
+        const srook::optional<port_mask> m = lookup(router_key(vid), now);
+        return m ? *m : 0;
+    }
+
+    // Whether the table has no room for another group.
+    SROOK_FORCE_INLINE bool full() const SROOK_NOEXCEPT_TRUE
+    {
+        return size_.load(std::memory_order_relaxed) >= max_groups_;
+    }
+
+    SROOK_FORCE_INLINE std::size_t size() const SROOK_NOEXCEPT_TRUE
+    {
+        return size_.load(std::memory_order_relaxed);
+    }
+
+    // Lets the timers that ran out in the next n entries go, and the groups left without listeners
+    // with them, unless another thread holds the lock.
+    SROOK_FORCE_INLINE void age(time_type now, std::size_t n) SROOK_NOEXCEPT_TRUE
+    {
+        std::unique_lock<std::mutex> lk(lock_, std::try_to_lock);
+        if (!lk) return;
+        for (; n; --n) {
+            group& g = groups_[sweep_];
+            if ((g.key.load(std::memory_order_relaxed) & live) && !expire(g, timers(g), now)) {
+                erase(sweep_);
+                size_.fetch_sub(1, std::memory_order_relaxed);
+                // The entry that moved into the slot, if any, is the next to check.
+                continue;
+            }
+            sweep_ = (sweep_ + 1) & mask_;
+        }
+    }
+private:
+    struct group {
+        std::atomic<srook::uint64_t> key;
+        std::atomic<port_mask> ports;
+        // The earliest timer of any port in ports.
+        std::atomic<time_type> soonest;
+    };
+    // A slot that an entry is being moved into or out of holds a tombstone, which probes go past.
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST srook::uint64_t live = srook::uint64_t(1) << 63, tombstone = 1;
+
+    // Room for twice as many groups, rounded up to a power of two, so that probes stay short.
+    SROOK_FORCE_INLINE static std::size_t slot_count(std::size_t max_groups) SROOK_NOEXCEPT_TRUE
+    {
+        std::size_t n = 2;
+        while (n < max_groups * 2) n <<= 1;
+        return n;
+    }
+
+    // The six address bytes, the VID above them and the live bit on top.
+    SROOK_FORCE_INLINE static srook::uint64_t key(const ::u_char* mac, srook::uint16_t vid) SROOK_NOEXCEPT_TRUE
+    {
+        srook::uint64_t k = 0;
+        std::memcpy(&k, mac, ETH_ALEN);
+        return k | srook::uint64_t(vid & 0xfff) << 48 | live;
+    }
+
+    // The key of the router ports of VLAN vid.
+    SROOK_FORCE_INLINE static srook::uint64_t router_key(srook::uint16_t vid) SROOK_NOEXCEPT_TRUE
+    {
+        return srook::uint64_t(vid & 0xfff) << 48 | live;
+    }
+
+    SROOK_FORCE_INLINE std::size_t hash(srook::uint64_t k) const SROOK_NOEXCEPT_TRUE
+    {
+        return std::size_t((k * 0x9e3779b97f4a7c15ull) >> 32) & mask_;
+    }
+
+    // The timer of every port of g.
+    SROOK_FORCE_INLINE std::atomic<time_type>* timers(const group& g) const SROOK_NOEXCEPT_TRUE
+    {
+        return &timers_[std::size_t(&g - groups_.get()) * ports_];
+    }
+
+    // The ports of the entry of k whose timers have not run out, or nothing when there is none.
+    SROOK_FORCE_INLINE srook::optional<port_mask> lookup(srook::uint64_t k, time_type now) const SROOK_NOEXCEPT_TRUE
+    {
+        for (std::size_t i = hash(k), n = 0; n <= mask_; i = (i + 1) & mask_, ++n) {
+            const group& g = groups_[i];
+            const srook::uint64_t gk = g.key.load(std::memory_order_acquire);
+            if (!gk) break;
+            if (gk != k) continue;
+            const port_mask m = current(g, timers(g), now);
+            // The entry may have been taken over by another group meanwhile.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (g.key.load(std::memory_order_relaxed) != k) break;
+            return { m };
+        }
+        return srook::nullopt;
+    }
+
+    SROOK_FORCE_INLINE group* find(srook::uint64_t k) SROOK_NOEXCEPT_TRUE
+    {
+        for (std::size_t i = hash(k), n = 0; n <= mask_; i = (i + 1) & mask_, ++n) {
+            const srook::uint64_t gk = groups_[i].key.load(std::memory_order_relaxed);
+            if (!gk) break;
+            if (gk == k) return &groups_[i];
+        }
+        return nullptr;
+    }
+
+    // The entry of k, which is made when there is none yet and the table has room for it.
+    SROOK_FORCE_INLINE group* insert(srook::uint64_t k) SROOK_NOEXCEPT_TRUE
+    {
+        if (group* g = find(k)) return g;
+        if (full()) return nullptr;
+        std::size_t i = hash(k);
+        while (groups_[i].key.load(std::memory_order_relaxed) & live) i = (i + 1) & mask_;
+        group& g = groups_[i];
+        g.ports.store(0, std::memory_order_relaxed);
+        g.soonest.store(~time_type(0), std::memory_order_relaxed);
+        g.key.store(k, std::memory_order_release);
+        size_.fetch_add(1, std::memory_order_relaxed);
+        return &g;
+    }
+
+    // Empties slot i. Every entry further along its probe sequence that a probe from its home slot
+    // would still find in the hole moves into it, and leaves a hole behind in turn, until an empty
+    // slot ends the sequence; the last hole becomes empty.
+    SROOK_FORCE_INLINE void erase(std::size_t i) SROOK_NOEXCEPT_TRUE
+    {
+        groups_[i].key.store(tombstone, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (std::size_t j = (i + 1) & mask_;; j = (j + 1) & mask_) {
+            const srook::uint64_t k = groups_[j].key.load(std::memory_order_relaxed);
+            if (!k) break;
+            // An entry whose home slot lies after the hole stays, or a probe from there would miss it.
+            if (((j - hash(k)) & mask_) < ((j - i) & mask_)) continue;
+            move(groups_[j], groups_[i]);
+            i = j;
+        }
+        groups_[i].key.store(0, std::memory_order_release);
+    }
+
+    // Copies the entry from into the empty slot to and makes from a tombstone. A reader that read
+    // the timers of a slot while they were overwritten tells by its key, which changed first.
+    SROOK_FORCE_INLINE void move(group& from, group& to) SROOK_NOEXCEPT_TRUE
+    {
+        const std::atomic<time_type>* src = timers(from);
+        std::atomic<time_type>* dst = timers(to);
+        for (std::size_t p = 0; p < ports_; ++p) dst[p].store(src[p].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.ports.store(from.ports.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.soonest.store(from.soonest.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.key.store(from.key.load(std::memory_order_relaxed), std::memory_order_release);
+        from.key.store(tombstone, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    // Sets the timer of port to until, or only shortens it to until when shorten is set.
+    SROOK_FORCE_INLINE static void refresh(group& g, std::atomic<time_type>* t, std::size_t port, time_type until, bool shorten) SROOK_NOEXCEPT_TRUE
+    {
+        if (shorten && t[port].load(std::memory_order_relaxed) <= until) return;
+        t[port].store(until, std::memory_order_relaxed);
+        g.ports.fetch_or(port_mask(1) << port, std::memory_order_release);
+        if (until < g.soonest.load(std::memory_order_relaxed)) g.soonest.store(until, std::memory_order_relaxed);
+    }
+
+    // The ports of g whose timers have not run out. Only once the earliest of them has is there
+    // anything to check.
+    SROOK_FORCE_INLINE static port_mask current(const group& g, const std::atomic<time_type>* t, time_type now) SROOK_NOEXCEPT_TRUE
+    {
+        port_mask m = g.ports.load(std::memory_order_acquire);
+        if (now <= g.soonest.load(std::memory_order_relaxed)) return m;
+        for (port_mask left = m; left; left &= left - 1) {
+            const std::size_t p = std::size_t(__builtin_ctzll(left));
+            if (now > t[p].load(std::memory_order_relaxed)) m &= ~(port_mask(1) << p);
+        }
+        return m;
+    }
+
+    // Drops the ports of g whose timers have run out and returns those that are left.
+    SROOK_FORCE_INLINE static port_mask expire(group& g, std::atomic<time_type>* t, time_type now) SROOK_NOEXCEPT_TRUE
+    {
+        if (now <= g.soonest.load(std::memory_order_relaxed)) return g.ports.load(std::memory_order_relaxed);
+        const port_mask m = current(g, t, now);
+        time_type soonest = ~time_type(0);
+        for (port_mask left = m; left; left &= left - 1) soonest = std::min(soonest, t[__builtin_ctzll(left)].load(std::memory_order_relaxed));
+        g.ports.store(m, std::memory_order_release);
+        g.soonest.store(soonest, std::memory_order_relaxed);
+        return m;
+    }
+
+    std::unique_ptr<group[]> groups_;
+    std::unique_ptr<std::atomic<time_type>[]> timers_;
+    std::size_t mask_, ports_, max_groups_;
+    std::atomic<std::size_t> size_;
+    std::size_t sweep_;
+    time_type membership_;
+    std::mutex lock_;
+};
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
@@ -0,0 +1,106 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_OPTIONS_HPP
+#define INCLUDED_TOYBRIDGE_OPTIONS_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/packet_filter.hpp>
+#include <toybridge/storm_config.hpp>
+#include <toybridge/vlan_config.hpp>
+#include <toybridge/detail/egress.hpp>
+#include <toybridge/detail/pcapng.hpp>
+#include <toybridge/detail/ring.hpp>
+#include <string>
+#include <vector>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+struct options {
+    srook::uint32_t filter = ETH_P_ALL;
+    bool promiscuous = true;
+    bool verbose = false;
+    // Receive through a PACKET_RX_RING (TPACKET_V3) instead of one read(2) per frame.
+    bool rx_ring = false;
+    // Send through a PACKET_TX_RING with one sendto(2) kick per batch instead of one write(2) per frame.
+    bool tx_ring = false;
+    detail::ring_config ring;
+    // Drain each ready socket with recvmmsg(2) and flush with sendmmsg(2), batch_size frames at a time.
+    bool mmsg = false;
+    std::size_t batch_size = 32;
+    // The forwarding database holds at most fdb_size addresses, each forgotten fdb_aging seconds after it was last seen.
+    std::size_t fdb_size = 1 << 16;
+    srook::uint32_t fdb_aging = 300;
+    // IGMP and MLD snooping keeps track of at most mdb_size multicast groups per bridge and forwards
+    // frames to a group only to ports with listeners and to ports queries came in on. A size of 0
+    // turns snooping off, which floods multicast like broadcast. A listener is forgotten mdb_aging
+    // seconds after its last report.
+    std::size_t mdb_size = 1024;
+    srook::uint32_t mdb_aging = 260;
+    // With more than one worker, each worker thread is pinned to a core of its own and opens its own
+    // socket on every port; the sockets of a port form a PACKET_FANOUT group of the given mode.
+    std::size_t workers = 1;
+    int fanout = PACKET_FANOUT_HASH;
+    // An eventfd(2) that stops the bridge when it is written to. The bridge makes one of its own by default.
+    int wakeup_fd = -1;
+    // With verbose on, the forwarding threads only queue a fixed-size record per frame in a ring of log_ring
+    // records each; a logger thread formats them, or writes them raw to log_file when it is set.
+    std::string log_file;
+    std::size_t log_ring = 1 << 12;
+    // Forwarded frames are captured to pcapng off the forwarding threads when capture.path is set.
+    detail::capture_config capture;
+    // Compiled to classic BPF and attached to every port socket, so that the kernel drops what the rules reject.
+    packet_filter rules;
+    // Bridge through an AF_XDP socket per port and worker instead of AF_PACKET, behind an XDP program
+    // attached in generic mode, or in native mode with xdp_native. Worker k binds queue k of every port,
+    // so a port needs as many queues as there are workers. When AF_XDP cannot be set up, or with filter
+    // rules, the bridge falls back to AF_PACKET.
+    bool xdp = false;
+    bool xdp_native = false;
+    // Forward through an io_uring per worker: a multishot receive per port into a ring of provided
+    // buffers, and sends straight out of those buffers, all submitted and reaped with one
+    // io_uring_enter(2) per loop iteration. Takes the place of rx_ring, tx_ring and mmsg; when io_uring
+    // cannot be set up, the bridge falls back to them.
+    bool uring = false;
+    // Read and write every frame behind a virtio_net_hdr (PACKET_VNET_HDR), so that GSO super-packets of up
+    // to 64 KiB cross the bridge whole. Needs read(2) or recvmmsg(2) on every port: it is ignored with
+    // rx_ring, tx_ring, xdp or uring.
+    bool vnet_hdr = false;
+    // Frames a port cannot take right now wait in a bounded queue per port and worker, one ring per
+    // 802.1p traffic class, instead of being dropped. A depth of 0 turns the queues off. Does not
+    // apply to tx_ring, xdp or uring, which queue on their own rings.
+    detail::egress_config egress;
+    // Access and trunk ports, which make the bridge forward and flood within each VLAN on its own.
+    // Frames are tagged in place on the way in and sent without the tag out of untagged ports. Needs
+    // read(2) or recvmmsg(2) on every port: rx_ring, tx_ring, xdp, uring and vnet_hdr are not used with it.
+    vlan_config vlans;
+    // Per port, how many broadcast, multicast and unknown unicast frames a second and bits a second
+    // may come in before storm control drops the rest. Dropped frames are counted per port and class.
+    storm_config storm;
+    // A Unix domain socket to serve counters on, in Prometheus text format or as a binary snapshot.
+    std::string stats_path;
+    // Busy polling for the lowest latency at the price of a core per worker: instead of sleeping in
+    // epoll_wait(2), every worker spins over its ports with non-blocking receives, or over the status
+    // words of its rings, and only ever looks for the wakeup in between. The port sockets get
+    // SO_BUSY_POLL of busy_poll microseconds and SO_PREFER_BUSY_POLL, so that a receive polls the
+    // device queue itself. Implies lock_memory, hugepages and timestamps, and pins every worker. Does
+    // not apply to uring. 0 turns it off.
+    unsigned int busy_poll = 0;
+    // The CPUs to pin the workers to, worker k to cpus[k % cpus.size()]. Without any, workers are pinned
+    // to a core of their own each only when there is more than one of them or they busy poll.
+    std::vector<int> cpus;
+    // Lock every page of the process in memory with mlockall(2) while the bridge runs.
+    bool lock_memory = false;
+    // Map the frame pools, AF_XDP UMEMs and io_uring buffers on 2 MiB pages: from the hugetlbfs pool when
+    // it has enough of them, transparent huge pages otherwise. The packet rings are kernel memory and
+    // mapped by the kernel.
+    bool hugepages = false;
+    // Take a software receive timestamp of every frame (SO_TIMESTAMPING) and measure from it how long
+    // forwarded frames take through the bridge, whose p50, p99 and p999 go in the stats and are reported
+    // on exit. Not with xdp or uring.
+    bool timestamps = false;
+};
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
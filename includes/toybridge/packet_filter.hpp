@@ -0,0 +1,470 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_PACKET_FILTER_HPP
+#define INCLUDED_TOYBRIDGE_PACKET_FILTER_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <toybridge/detail/bpf.hpp>
+#include <toybridge/detail/init.hpp>
+#include <srook/optional.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+// An ordered list of rules that decide which frames a port accepts, compiled into a classic
+// BPF program so that the kernel drops everything else before it is copied to the bridge.
+//
+// A rule is an optional action, accept (the default) or drop, followed by any number of terms
+// that must all hold:
+//
+//     type <ethertype>      the ethertype of the payload, behind an 802.1Q tag if there is one
+//     vlan <id>             the frame carries an 802.1Q tag with this VLAN ID
+//     src <mac>[/<bits>]    the source address, or its first bits
+//     dst <mac>[/<bits>]    the destination address, or its first bits
+//     proto <number>        the IPv4 protocol or IPv6 next header
+//
+// The first rule whose terms all hold decides; a rule without terms holds for every frame, and
+// a frame that no rule holds for is accepted. A frame too short for any field the program looks
+// at is dropped, as the kernel does.
+class packet_filter {
+public:
+    // Parses one rule and appends it. On error, says why on err and leaves the filter as it was.
+    bool add(const std::string& expr, std::ostream& err)
+    {
+        std::istringstream is(expr);
+        rule r;
+        std::string word;
+        if (!(is >> word)) {
+            err << "filter: empty rule\n";
+            return false;
+        }
+        if (word == "accept" || word == "drop") {
+            r.accept = word == "accept";
+            if (!(is >> word)) word.clear();
+        }
+        for (; !word.empty(); word = is >> word ? word : std::string()) {
+            term t;
+            std::string arg;
+            if (!(is >> arg)) {
+                err << "filter: '" << word << "' needs an argument in '" << expr << "'\n";
+                return false;
+            }
+            bool ok = false;
+            if (word == "type") {
+                t.kind = term::type;
+                ok = number(arg, 0xffff, t.value);
+            } else if (word == "vlan") {
+                t.kind = term::vlan;
+                ok = number(arg, 0xfff, t.value);
+            } else if (word == "proto") {
+                t.kind = term::proto;
+                ok = number(arg, 0xff, t.value);
+            } else if (word == "src" || word == "dst") {
+                t.kind = word == "src" ? term::src : term::dst;
+                ok = mac(arg, t);
+            } else {
+                err << "filter: unknown term '" << word << "' in '" << expr << "'\n";
+                return false;
+            }
+            if (!ok) {
+                err << "filter: bad argument '" << arg << "' to '" << word << "' in '" << expr << "'\n";
+                return false;
+            }
+            r.terms.push_back(t);
+        }
+        rules_.push_back(srook::move(r));
+        return true;
+    }
+
+    // Adds every rule in a file, one per line. Blank lines and everything after a '#' are ignored.
+    bool load(const std::string& path, std::ostream& err)
+    {
+        std::ifstream ifs(path);
+        if (!ifs) {
+            err << "filter: cannot open " << path << '\n';
+            return false;
+        }
+        for (std::string line; std::getline(ifs, line);) {
+            line.erase(std::find(line.begin(), line.end(), '#'), line.end());
+            if (line.find_first_not_of(" \t\r") != std::string::npos && !add(line, err)) return false;
+        }
+        return true;
+    }
+
+    bool empty() const SROOK_NOEXCEPT_TRUE
+    {
+        return rules_.empty();
+    }
+
+    // The program, or nothing when a rule is too long for the 8-bit jump offsets of classic BPF.
+    srook::optional<std::vector<::sock_filter>> compile() const
+    {
+        assembler as;
+        // X holds the length of an in-line 802.1Q tag for every later indexed load.
+        const int tagged = as.label(), cont = as.label();
+        as.stmt(BPF_LD | BPF_H | BPF_ABS, 12);
+        as.jump(BPF_JEQ, ETH_P_8021Q, tagged, -1);
+        as.stmt(BPF_LDX | BPF_IMM, 0);
+        as.ja(cont);
+        as.bind(tagged);
+        as.stmt(BPF_LDX | BPF_IMM, 4);
+        as.bind(cont);
+
+        for (const rule& r : rules_) {
+            const int next = as.label();
+            for (const term& t : r.terms) {
+                switch (t.kind) {
+                    case term::type:
+                        as.stmt(BPF_LD | BPF_H | BPF_IND, 12);
+                        as.jump(BPF_JEQ, t.value, -1, next);
+                        break;
+                    case term::vlan: {
+                        const int inline_tag = as.label(), pass = as.label();
+                        as.stmt(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT);
+                        as.jump(BPF_JEQ, 0, inline_tag, -1);
+                        as.stmt(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_VLAN_TAG);
+                        as.stmt(BPF_ALU | BPF_AND | BPF_K, 0xfff);
+                        as.jump(BPF_JEQ, t.value, pass, next);
+                        as.bind(inline_tag);
+                        as.stmt(BPF_LD | BPF_H | BPF_ABS, 12);
+                        as.jump(BPF_JEQ, ETH_P_8021Q, -1, next);
+                        as.stmt(BPF_LD | BPF_H | BPF_ABS, 14);
+                        as.stmt(BPF_ALU | BPF_AND | BPF_K, 0xfff);
+                        as.jump(BPF_JEQ, t.value, -1, next);
+                        as.bind(pass);
+                        break;
+                    }
+                    case term::src:
+                    case term::dst: {
+                        const srook::uint32_t base = t.kind == term::src ? ETH_ALEN : 0;
+                        const unsigned int hi = std::min(t.prefix, 32u);
+                        if (hi) {
+                            as.stmt(BPF_LD | BPF_W | BPF_ABS, base);
+                            if (hi < 32) as.stmt(BPF_ALU | BPF_AND | BPF_K, mask(hi, 32));
+                            as.jump(BPF_JEQ, word(t.mac, 4) & mask(hi, 32), -1, next);
+                        }
+                        if (t.prefix > 32) {
+                            as.stmt(BPF_LD | BPF_H | BPF_ABS, base + 4);
+                            if (t.prefix < 48) as.stmt(BPF_ALU | BPF_AND | BPF_K, mask(t.prefix - 32, 16));
+                            as.jump(BPF_JEQ, word(t.mac + 4, 2) & mask(t.prefix - 32, 16), -1, next);
+                        }
+                        break;
+                    }
+                    case term::proto: {
+                        const int v6 = as.label(), pass = as.label();
+                        as.stmt(BPF_LD | BPF_H | BPF_IND, 12);
+                        as.jump(BPF_JEQ, ETH_P_IP, -1, v6);
+                        as.stmt(BPF_LD | BPF_B | BPF_IND, ETH_HLEN + 9);
+                        as.jump(BPF_JEQ, t.value, pass, next);
+                        as.bind(v6);
+                        as.jump(BPF_JEQ, ETH_P_IPV6, -1, next);
+                        as.stmt(BPF_LD | BPF_B | BPF_IND, ETH_HLEN + 6);
+                        as.jump(BPF_JEQ, t.value, -1, next);
+                        as.bind(pass);
+                        break;
+                    }
+                }
+            }
+            as.stmt(BPF_RET | BPF_K, r.accept ? keep : 0);
+            as.bind(next);
+        }
+        as.stmt(BPF_RET | BPF_K, keep);
+        return as.link();
+    }
+
+    // Whether a frame passes, decided directly from the rules. The compiled program must agree.
+    bool accepts(const ::u_char* pkt, std::size_t len, const detail::bpf_metadata& meta = detail::bpf_metadata()) const SROOK_NOEXCEPT_TRUE
+    {
+        if (len < ETH_HLEN) return false;
+        const std::size_t x = (pkt[12] << 8 | pkt[13]) == ETH_P_8021Q ? 4 : 0;
+        for (const rule& r : rules_) {
+            bool holds = true;
+            for (auto t = r.terms.cbegin(); holds && t != r.terms.cend(); ++t) {
+                switch (t->kind) {
+                    case term::type:
+                        if (len < x + 14) return false;
+                        holds = (pkt[x + 12] << 8 | pkt[x + 13]) == t->value;
+                        break;
+                    case term::vlan:
+                        if (meta.vlan_tag_present) {
+                            holds = (meta.vlan_tci & 0xfff) == t->value;
+                        } else if ((pkt[12] << 8 | pkt[13]) != ETH_P_8021Q) {
+                            holds = false;
+                        } else {
+                            if (len < 16) return false;
+                            holds = ((pkt[14] << 8 | pkt[15]) & 0xfff) == t->value;
+                        }
+                        break;
+                    case term::src:
+                    case term::dst: {
+                        const ::u_char* mac = pkt + (t->kind == term::src ? ETH_ALEN : 0);
+                        holds = (word(mac, 4) & mask(std::min(t->prefix, 32u), 32)) == (word(t->mac, 4) & mask(std::min(t->prefix, 32u), 32)) &&
+                            (t->prefix <= 32 || (word(mac + 4, 2) & mask(t->prefix - 32, 16)) == (word(t->mac + 4, 2) & mask(t->prefix - 32, 16)));
+                        break;
+                    }
+                    case term::proto: {
+                        if (len < x + 14) return false;
+                        const unsigned int type = pkt[x + 12] << 8 | pkt[x + 13];
+                        const std::size_t off = type == ETH_P_IP ? ETH_HLEN + 9 : type == ETH_P_IPV6 ? ETH_HLEN + 6 : 0;
+                        if (!off) {
+                            holds = false;
+                        } else {
+                            if (len <= x + off) return false;
+                            holds = pkt[x + off] == t->value;
+                        }
+                        break;
+                    }
+                }
+            }
+            if (holds) return r.accept;
+        }
+        return true;
+    }
+
+    // Runs the compiled program through detail::bpf_run over frames built to hit both sides of
+    // every term, tagged in-line, tagged by the driver and untagged, and cut short at every field
+    // boundary, and compares each verdict with accepts(). Reports on os and returns whether all agree.
+    bool self_test(std::ostream& os) const
+    {
+        const srook::optional<std::vector<::sock_filter>> prog = compile();
+        if (!prog) {
+            os << "filter: a rule is too long to compile\n";
+            return false;
+        }
+
+        std::vector<std::vector<::u_char>> frames;
+        for (const rule& r : rules_) {
+            std::vector<::u_char> base(64);
+            base[12] = ETH_P_IP >> 8;
+            base[13] = ETH_P_IP & 0xff;
+            for (const term& t : r.terms) apply(base, t, false);
+            frames.push_back(base);
+            for (const term& t : r.terms) {
+                std::vector<::u_char> f = base;
+                apply(f, t, true);
+                frames.push_back(f);
+                if (t.kind == term::proto) {
+                    f = base;
+                    f[12] = ETH_P_IPV6 >> 8;
+                    f[13] = ETH_P_IPV6 & 0xff;
+                    frames.push_back(f);
+                }
+            }
+        }
+        frames.emplace_back(64);
+
+        std::size_t checked = 0;
+        for (const std::vector<::u_char>& f : frames) {
+            std::vector<::u_char> tagged(f.begin(), f.begin() + 12);
+            const ::u_char tag[] = { ETH_P_8021Q >> 8, ETH_P_8021Q & 0xff, 0, 0 };
+            tagged.insert(tagged.end(), tag, tag + sizeof(tag));
+            tagged.insert(tagged.end(), f.begin() + 12, f.end());
+
+            std::vector<srook::uint16_t> vids = { 1 };
+            for (const rule& r : rules_) {
+                for (const term& t : r.terms) {
+                    if (t.kind == term::vlan) vids.push_back(t.value);
+                }
+            }
+            for (srook::uint16_t vid : vids) {
+                tagged[14] = vid >> 8;
+                tagged[15] = vid & 0xff;
+                detail::bpf_metadata meta;
+                meta.vlan_tag_present = true;
+                meta.vlan_tci = vid;
+                const std::pair<const std::vector<::u_char>*, detail::bpf_metadata> cases[] = {
+                    { &f, detail::bpf_metadata() }, { &f, meta }, { &tagged, detail::bpf_metadata() }
+                };
+                for (const auto& c : cases) {
+                    for (std::size_t len = 0; len <= c.first->size(); len = len < 32 ? len + 1 : c.first->size() + (len == c.first->size())) {
+                        const bool kernel = detail::bpf_run(*prog, c.first->data(), len, c.second) != 0;
+                        if (kernel != accepts(c.first->data(), len, c.second)) {
+                            os << "filter: the compiled program " << (kernel ? "accepts" : "drops") << " a frame of " << len << " bytes (vlan tag "
+                                << (c.second.vlan_tag_present ? "metadata" : c.first == &tagged ? "in-line" : "none") << ") that the rules do not\n";
+                            return false;
+                        }
+                        ++checked;
+                    }
+                }
+            }
+        }
+        os << "filter: " << prog->size() << " instructions agree with the rules on " << checked << " frames\n";
+        return true;
+    }
+
+    // The program in the format of tcpdump -dd.
+    std::ostream& disassemble(std::ostream& os) const
+    {
+        const srook::optional<std::vector<::sock_filter>> prog = compile();
+        if (!prog) return os;
+        for (const ::sock_filter& f : *prog) {
+            os << std::hex << std::setfill('0') << "{ 0x" << std::setw(2) << f.code << ", " << std::dec << unsigned(f.jt) << ", " << unsigned(f.jf)
+                << ", 0x" << std::hex << std::setw(8) << f.k << std::dec << std::setfill(' ') << " },\n";
+        }
+        return os;
+    }
+private:
+    // What an accepting program returns: keep the whole frame.
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST srook::uint32_t keep = 0x40000;
+
+    struct term {
+        enum kind_type { type, vlan, src, dst, proto } kind;
+        srook::uint16_t value = 0;
+        ::u_char mac[ETH_ALEN]{};
+        unsigned int prefix = 48;
+    };
+
+    struct rule {
+        bool accept = true;
+        std::vector<term> terms;
+    };
+
+    // Straight-line code with forward jumps to labels, resolved once the code is complete.
+    class assembler {
+    public:
+        int label()
+        {
+            labels_.push_back(-1);
+            return int(labels_.size() - 1);
+        }
+
+        void bind(int l)
+        {
+            labels_[l] = long(code_.size());
+        }
+
+        void stmt(srook::uint16_t code, srook::uint32_t k)
+        {
+            code_.push_back(::sock_filter{ code, 0, 0, k });
+            targets_.push_back({ -1, -1 });
+        }
+
+        // A conditional jump to jt or jf; -1 falls through to the next instruction.
+        void jump(srook::uint16_t op, srook::uint32_t k, int jt, int jf)
+        {
+            code_.push_back(::sock_filter{ srook::uint16_t(BPF_JMP | op | BPF_K), 0, 0, k });
+            targets_.push_back({ jt, jf });
+        }
+
+        void ja(int l)
+        {
+            code_.push_back(::sock_filter{ BPF_JMP | BPF_JA, 0, 0, 0 });
+            targets_.push_back({ l, -1 });
+        }
+
+        srook::optional<std::vector<::sock_filter>> link() const
+        {
+            std::vector<::sock_filter> code = code_;
+            for (std::size_t i = 0; i < code.size(); ++i) {
+                const auto offset = [&](int l) { return l < 0 ? 0 : labels_[l] - long(i) - 1; };
+                if (BPF_OP(code[i].code) == BPF_JA && BPF_CLASS(code[i].code) == BPF_JMP) {
+                    code[i].k = srook::uint32_t(offset(targets_[i].first));
+                    continue;
+                }
+                const long jt = offset(targets_[i].first), jf = offset(targets_[i].second);
+                if (jt > 0xff || jf > 0xff) return srook::nullopt;
+                code[i].jt = static_cast<srook::uint8_t>(jt);
+                code[i].jf = static_cast<srook::uint8_t>(jf);
+            }
+            return { srook::move(code) };
+        }
+    private:
+        std::vector<::sock_filter> code_;
+        std::vector<std::pair<int, int>> targets_;
+        std::vector<long> labels_;
+    };
+
+    static bool number(const std::string& s, unsigned long max, srook::uint16_t& v)
+    {
+        char* end;
+        const unsigned long n = std::strtoul(s.c_str(), &end, 0);
+        if (s.empty() || *end || n > max) return false;
+        v = static_cast<srook::uint16_t>(n);
+        return true;
+    }
+
+    static bool mac(const std::string& s, term& t)
+    {
+        unsigned int b[ETH_ALEN];
+        int n = 0;
+        if (std::sscanf(s.c_str(), "%x:%x:%x:%x:%x:%x%n", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &n) != ETH_ALEN) return false;
+        if (s[n] == '/') {
+            char* end;
+            t.prefix = static_cast<unsigned int>(std::strtoul(s.c_str() + n + 1, &end, 10));
+            if (end == s.c_str() + n + 1 || *end || t.prefix > 48) return false;
+        } else if (s[n]) {
+            return false;
+        }
+        for (std::size_t i = 0; i < ETH_ALEN; ++i) {
+            if (b[i] > 0xff) return false;
+            t.mac[i] = static_cast<::u_char>(b[i]);
+        }
+        return true;
+    }
+
+    static srook::uint32_t word(const ::u_char* p, std::size_t n) SROOK_NOEXCEPT_TRUE
+    {
+        srook::uint32_t v = 0;
+        for (std::size_t i = 0; i < n; ++i) v = v << 8 | p[i];
+        return v;
+    }
+
+    // The first bits of a width-bit word.
+    static srook::uint32_t mask(unsigned int bits, unsigned int width) SROOK_NOEXCEPT_TRUE
+    {
+        return bits ? srook::uint32_t(((srook::uint64_t(1) << bits) - 1) << (width - bits)) : 0;
+    }
+
+    // Makes f satisfy t, or, when miss, just barely not.
+    static void apply(std::vector<::u_char>& f, const term& t, bool miss)
+    {
+        switch (t.kind) {
+            case term::type:
+                f[12] = static_cast<::u_char>((t.value ^ miss) >> 8);
+                f[13] = static_cast<::u_char>(t.value ^ miss);
+                break;
+            case term::vlan:
+                // Only the tagged variants that self_test() derives can satisfy a vlan term.
+                break;
+            case term::src:
+            case term::dst: {
+                ::u_char* mac = &f[t.kind == term::src ? ETH_ALEN : 0];
+                std::copy_n(t.mac, ETH_ALEN, mac);
+                if (miss && t.prefix) mac[(t.prefix - 1) / 8] ^= ::u_char(0x80 >> ((t.prefix - 1) % 8));
+                break;
+            }
+            case term::proto:
+                f[ETH_HLEN + 9] = f[ETH_HLEN + 6] = static_cast<::u_char>(t.value ^ miss);
+                break;
+        }
+    }
+
+    std::vector<rule> rules_;
+};
+
+namespace detail {
+
+// Attaches a classic BPF program to soc.
+srook::optional<int> attach_filter(int soc, const std::vector<::sock_filter>& prog)
+SROOK_NOEXCEPT_TRUE
+{
+    ::sock_fprog fprog{};
+    fprog.len = static_cast<unsigned short>(prog.size());
+    fprog.filter = const_cast<::sock_filter*>(prog.data());
+    return toybridge::detail::setsockopt(soc, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
+}
+
+} // namespace detail
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
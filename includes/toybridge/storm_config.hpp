@@ -0,0 +1,129 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_STORM_CONFIG_HPP
+#define INCLUDED_TOYBRIDGE_STORM_CONFIG_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+// How much flooded traffic each port may bring into the bridge: per class of traffic, at most so
+// many frames and so many bits per second. A port that is not configured, and a class without a
+// limit, is not limited at all.
+class storm_config {
+public:
+    // Frames to the broadcast address, to any other group address, and to unicast addresses the
+    // forwarding database does not know.
+    enum traffic { broadcast, multicast, unknown_unicast };
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t classes = 3;
+
+    // 0 for no limit.
+    struct limit {
+        srook::uint64_t pps = 0, bps = 0;
+    };
+
+    struct port {
+        std::string device;
+        limit limits[classes];
+    };
+
+    // The name of a class as --storm takes it.
+    static const char* name(std::size_t c) SROOK_NOEXCEPT_TRUE
+    {
+        static const char* const names[classes] = { "broadcast", "multicast", "unknown" };
+        return names[c];
+    }
+
+    // Parses <device>=<class>:<rate>[,<class>:<rate>...], rate being a number with one of the units
+    // pps, kpps, mpps, bps, kbps, mbps and gbps, and limits those classes of device to that rate.
+    // A frame rate and a bit rate may both be given for a class, and both apply.
+    bool parse(const std::string& arg, std::ostream& err)
+    {
+        const std::string::size_type eq = arg.find('=');
+        if (eq == std::string::npos || !eq) {
+            err << "storm: expected <device>=<class>:<rate>[,...] in '" << arg << "'\n";
+            return false;
+        }
+        port& p = find_or_add(arg.substr(0, eq));
+        std::istringstream is(arg.substr(eq + 1));
+        for (std::string item; std::getline(is, item, ',');) {
+            const std::string::size_type colon = item.find(':');
+            std::size_t c = 0;
+            while (c < classes && item.compare(0, colon, name(c))) ++c;
+            if (colon == std::string::npos || c == classes) {
+                err << "storm: expected broadcast, multicast or unknown in '" << item << "'\n";
+                return false;
+            }
+            if (!rate(item.substr(colon + 1), p.limits[c])) {
+                err << "storm: bad rate in '" << item << "', expected a number and pps, kpps, mpps, bps, kbps, mbps or gbps\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool empty() const SROOK_NOEXCEPT_TRUE
+    {
+        return ports_.empty();
+    }
+
+    // How device is limited, which is not at all when it is not configured.
+    port find(const std::string& device) const
+    {
+        for (const port& p : ports_) {
+            if (p.device == device) return p;
+        }
+        port p;
+        p.device = device;
+        return p;
+    }
+
+    const std::vector<port>& ports() const SROOK_NOEXCEPT_TRUE
+    {
+        return ports_;
+    }
+private:
+    static bool rate(const std::string& s, limit& l)
+    {
+        static const struct {
+            const char* unit;
+            srook::uint64_t scale;
+            bool frames;
+        } units[] = {
+            { "pps", 1, true }, { "kpps", 1000, true }, { "mpps", 1000000, true },
+            { "bps", 1, false }, { "kbps", 1000, false }, { "mbps", 1000000, false }, { "gbps", 1000000000, false },
+        };
+        char* end = nullptr;
+        const unsigned long long n = std::strtoull(s.c_str(), &end, 10);
+        if (end == s.c_str() || !n) return false;
+        for (const auto& u : units) {
+            if (std::strcmp(end, u.unit)) continue;
+            (u.frames ? l.pps : l.bps) = n * u.scale;
+            return true;
+        }
+        return false;
+    }
+
+    port& find_or_add(const std::string& device)
+    {
+        for (port& p : ports_) {
+            if (p.device == device) return p;
+        }
+        ports_.emplace_back();
+        ports_.back().device = device;
+        return ports_.back();
+    }
+
+    std::vector<port> ports_;
+};
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
@@ -0,0 +1,133 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+#ifndef INCLUDED_TOYBRIDGE_VLAN_CONFIG_HPP
+#define INCLUDED_TOYBRIDGE_VLAN_CONFIG_HPP
+
+#include <toybridge/detail/config.hpp>
+#include <bitset>
+#include <cstdlib>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace toybridge {
+SROOK_INLINE_NAMESPACE(v1)
+
+// Which 802.1Q VLANs the ports of a bridge belong to. A port is either an access port, which takes
+// and sends untagged frames of one VLAN, or a trunk, which carries a set of VLANs tagged and, when
+// it has a native VLAN, that one untagged. A port that is not configured is an access port of
+// VLAN 1. Without any port configured, the bridge is not VLAN-aware at all.
+class vlan_config {
+public:
+    // VIDs run from 1 to 4094; 0 and 4095 are reserved.
+    SROOK_INLINE_VARIABLE static SROOK_CONSTEXPR_OR_CONST std::size_t vids = 4096;
+
+    struct port {
+        std::string device;
+        // The VLAN of untagged frames, which also leaves the port untagged, or 0 for none.
+        srook::uint16_t pvid = 0;
+        // The VLANs the port carries tagged.
+        std::bitset<vids> tagged;
+    };
+
+    // Parses <device>=<vid> and makes device an access port of that VLAN.
+    bool access(const std::string& arg, std::ostream& err)
+    {
+        port p;
+        unsigned long vid = 0;
+        if (!split(arg, p.device) || !number(arg.substr(p.device.size() + 1), vid)) {
+            err << "vlan: expected <device>=<vid> in '" << arg << "'\n";
+            return false;
+        }
+        p.pvid = static_cast<srook::uint16_t>(vid);
+        set(srook::move(p));
+        return true;
+    }
+
+    // Parses <device>=<vids>[:<native vid>], vids being a comma-separated list of VIDs and ranges
+    // <first>-<last>, and makes device a trunk of those VLANs.
+    bool trunk(const std::string& arg, std::ostream& err)
+    {
+        port p;
+        if (!split(arg, p.device)) {
+            err << "vlan: expected <device>=<vids>[:<native vid>] in '" << arg << "'\n";
+            return false;
+        }
+        std::string list = arg.substr(p.device.size() + 1);
+        const std::string::size_type colon = list.find(':');
+        unsigned long native = 0;
+        if (colon != std::string::npos && !number(list.substr(colon + 1), native)) {
+            err << "vlan: bad native VLAN in '" << arg << "'\n";
+            return false;
+        }
+        p.pvid = static_cast<srook::uint16_t>(native);
+        std::istringstream is(list.substr(0, colon));
+        for (std::string item; std::getline(is, item, ',');) {
+            const std::string::size_type dash = item.find('-');
+            unsigned long first = 0, last = 0;
+            if (!number(item.substr(0, dash), first) || !number(dash == std::string::npos ? item : item.substr(dash + 1), last) || last < first) {
+                err << "vlan: bad VLAN '" << item << "' in '" << arg << "'\n";
+                return false;
+            }
+            for (; first <= last; ++first) p.tagged.set(first);
+        }
+        set(srook::move(p));
+        return true;
+    }
+
+    bool empty() const SROOK_NOEXCEPT_TRUE
+    {
+        return ports_.empty();
+    }
+
+    // How device is configured, or an access port of VLAN 1 when it is not.
+    port find(const std::string& device) const
+    {
+        for (const port& p : ports_) {
+            if (p.device == device) return p;
+        }
+        port p;
+        p.device = device;
+        p.pvid = 1;
+        return p;
+    }
+
+    const std::vector<port>& ports() const SROOK_NOEXCEPT_TRUE
+    {
+        return ports_;
+    }
+private:
+    static bool split(const std::string& arg, std::string& device)
+    {
+        const std::string::size_type eq = arg.find('=');
+        if (eq == std::string::npos || !eq) return false;
+        device = arg.substr(0, eq);
+        return true;
+    }
+
+    static bool number(const std::string& s, unsigned long& vid)
+    {
+        char* end = nullptr;
+        vid = std::strtoul(s.c_str(), &end, 10);
+        return !s.empty() && !*end && vid && vid < vids - 1;
+    }
+
+    // A device configured again is configured anew.
+    void set(port p)
+    {
+        for (port& q : ports_) {
+            if (q.device == p.device) {
+                q = srook::move(p);
+                return;
+            }
+        }
+        ports_.push_back(srook::move(p));
+    }
+
+    std::vector<port> ports_;
+};
+
+SROOK_INLINE_NAMESPACE_END
+} // namespace toybridge
+
+#endif
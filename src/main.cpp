@@ -1,9 +1,71 @@
 #include <toybridge/bridge.hpp>
+#include <getopt.h>
+#include <sched.h>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+SROOK_FORCE_INLINE void usage(const char* const progname)
+{
+    std::cerr
+        << "Usage: " << progname << " [options] <interface 1> <interface 2> [<interface 3> ...]\n"
+        << "  -q, --quiet                   do not dump the forwarded headers\n"
+        << "  -r, --rx-ring                 receive through a TPACKET_V3 ring\n"
+        << "  -t, --tx-ring                 send through a TPACKET_V3 ring\n"
+        << "  -m, --mmsg                    receive and send with recvmmsg/sendmmsg\n"
+        << "      --batch-size <n>          frames per recvmmsg/sendmmsg (default: 32)\n"
+        << "      --fdb-size <n>            maximum number of learned addresses (default: 65536)\n"
+        << "      --fdb-aging <s>           seconds until a learned address is forgotten (default: 300)\n"
+        << "      --mdb-size <n>            maximum number of snooped multicast groups, 0 for no snooping (default: 1024)\n"
+        << "      --mdb-aging <s>           seconds until a multicast listener is forgotten without a report (default: 260)\n"
+        << "  -w, --workers <n>             number of pinned forwarding threads (default: 1)\n"
+        << "      --fanout <hash|cpu>       how frames are spread over the workers (default: hash)\n"
+        << "      --log-file <path>         write the dump as binary records for logdump (default: stdout)\n"
+        << "      --log-ring <n>            dump records queued per worker before they are dropped (default: 4096)\n"
+        << "      --capture <path>          write forwarded frames to a pcapng file\n"
+        << "      --snaplen <n>             bytes captured per frame (default: 256)\n"
+        << "      --capture-ring <n>        frames queued per worker before they are dropped (default: 4096)\n"
+        << "      --capture-sample <n>      capture one in n forwarded frames (default: 1)\n"
+        << "      --capture-type <type>     capture only frames of this ethertype\n"
+        << "      --rotate-size <bytes>     start a new capture file at this size\n"
+        << "      --rotate-time <s>         start a new capture file after this many seconds\n"
+        << "      --filter <rule>           accept or drop frames in the kernel (repeatable, first match wins)\n"
+        << "      --filter-file <path>      read filter rules from a file, one per line\n"
+        << "      --filter-check            print the compiled filter, check it against the rules and exit\n"
+        << "      --stats <path>            serve counters on a Unix domain socket\n"
+        << "      --xdp                     bridge through AF_XDP sockets, falling back to AF_PACKET\n"
+        << "      --xdp-native              like --xdp, with the XDP program in native (driver) mode\n"
+        << "      --uring                   forward through io_uring, falling back to epoll\n"
+        << "      --busy-poll[=<us>]        spin on the sockets instead of sleeping, with SO_BUSY_POLL of us\n"
+        << "                                microseconds (default: 50); implies --mlock, --hugepages and --timestamps\n"
+        << "      --cpus <list>             pin the workers to these CPUs, like 2,3 or 4-7\n"
+        << "      --mlock                   lock all memory while bridging\n"
+        << "      --hugepages               keep frame buffers on huge pages\n"
+        << "      --timestamps              measure transit latency from the kernel's receive timestamps\n"
+        << "      --vnet-hdr                pass GSO super-packets through whole (PACKET_VNET_HDR)\n"
+        << "      --access <port>=<vid>     make port an access port of a VLAN (repeatable)\n"
+        << "      --trunk <port>=<vids>[:<native vid>]\n"
+        << "                                make port a trunk of the VLANs in a list like 10,20,100-199 (repeatable)\n"
+        << "      --storm <port>=<class>:<rate>[,...]\n"
+        << "                                limit broadcast, multicast or unknown unicast coming in on port to a rate\n"
+        << "                                like 1000pps or 10mbps (repeatable)\n"
+        << "      --egress-depth <n>        frames queued per port and worker when a port is busy, 0 for none (default: 1024)\n"
+        << "      --egress-drop <tail|lowest>\n"
+        << "                                what a full egress queue drops (default: tail)\n"
+        << "      --egress-sched <strict|weighted>\n"
+        << "                                how egress queues pick the next traffic class (default: strict)\n"
+        << "      --egress-weights <w0,...,w7>\n"
+        << "                                weighted shares of traffic classes 0 to 7 (default: 1,2,3,4,5,6,7,8)\n"
+        << "      --ring-block-size <n>     ring block size in bytes (default: 262144)\n"
+        << "      --ring-block-count <n>    number of ring blocks (default: 64)\n"
+        << "      --ring-timeout <ms>       block retire timeout (default: 8)" << std::endl;
+}
 
 SROOK_FORCE_INLINE bool cmdarg_check(const int argc, const char* const progname)
 {
-    if (argc != 3) {
-        std::cerr << "Usage: " << progname << " <interface 1> <interface 2>" << std::endl;
+    if (argc < 2 || std::size_t(argc) > toybridge::devinfo::max_devices) {
+        usage(progname);
         return false;
     } else if (::getuid() && geteuid()) {
         std::cerr << "Needs to be superuser" << std::endl;
@@ -12,12 +74,183 @@ SROOK_FORCE_INLINE bool cmdarg_check(const int argc, const char* const progname)
     return true;
 }
 
-int main(const int argc, const char** const argv)
+// Eight comma-separated weights, none of them 0.
+SROOK_FORCE_INLINE bool parse_weights(const char* arg, srook::uint32_t (&weights)[toybridge::detail::traffic_classes])
+{
+    std::istringstream ss(arg);
+    std::string w;
+    std::size_t c = 0;
+    for (; std::getline(ss, w, ','); ++c) {
+        char* end;
+        const unsigned long v = std::strtoul(w.c_str(), &end, 0);
+        if (c == toybridge::detail::traffic_classes || w.empty() || *end || !v) return false;
+        weights[c] = static_cast<srook::uint32_t>(v);
+    }
+    return c == toybridge::detail::traffic_classes;
+}
+
+// Comma-separated CPUs and ranges of them.
+SROOK_FORCE_INLINE bool parse_cpus(const char* arg, std::vector<int>& cpus)
 {
-    if (!cmdarg_check(argc, argv[0])) return EXIT_FAILURE;
+    std::istringstream ss(arg);
+    std::string item;
+    cpus.clear();
+    while (std::getline(ss, item, ',')) {
+        char* end;
+        const unsigned long first = std::strtoul(item.c_str(), &end, 10);
+        const unsigned long last = *end == '-' ? std::strtoul(end + 1, &end, 10) : first;
+        if (item.empty() || !std::isdigit(static_cast<unsigned char>(item.back())) || *end || last < first || last >= CPU_SETSIZE) return false;
+        for (unsigned long cpu = first; cpu <= last; ++cpu) cpus.push_back(static_cast<int>(cpu));
+    }
+    return !cpus.empty();
+}
+
+SROOK_FORCE_INLINE bool parse_options(int argc, char** argv, toybridge::options& opts, bool& check)
+{
+    enum { ring_block_size = 256, ring_block_count, ring_timeout, batch_size, fdb_size, fdb_aging, mdb_size, mdb_aging, fanout, log_file, log_ring,
+        capture, snaplen, capture_ring, capture_sample, capture_type, rotate_size, rotate_time,
+        filter, filter_file, filter_check, stats, xdp, xdp_native, uring, vnet_hdr,
+        egress_depth, egress_drop, egress_sched, egress_weights, access, trunk, storm, busy_poll, cpus, mlock, hugepages, timestamps };
+    const ::option longopts[] = {
+        { "quiet", no_argument, nullptr, 'q' },
+        { "rx-ring", no_argument, nullptr, 'r' },
+        { "tx-ring", no_argument, nullptr, 't' },
+        { "ring-block-size", required_argument, nullptr, ring_block_size },
+        { "ring-block-count", required_argument, nullptr, ring_block_count },
+        { "ring-timeout", required_argument, nullptr, ring_timeout },
+        { "mmsg", no_argument, nullptr, 'm' },
+        { "batch-size", required_argument, nullptr, batch_size },
+        { "fdb-size", required_argument, nullptr, fdb_size },
+        { "fdb-aging", required_argument, nullptr, fdb_aging },
+        { "mdb-size", required_argument, nullptr, mdb_size },
+        { "mdb-aging", required_argument, nullptr, mdb_aging },
+        { "workers", required_argument, nullptr, 'w' },
+        { "fanout", required_argument, nullptr, fanout },
+        { "log-file", required_argument, nullptr, log_file },
+        { "log-ring", required_argument, nullptr, log_ring },
+        { "capture", required_argument, nullptr, capture },
+        { "snaplen", required_argument, nullptr, snaplen },
+        { "capture-ring", required_argument, nullptr, capture_ring },
+        { "capture-sample", required_argument, nullptr, capture_sample },
+        { "capture-type", required_argument, nullptr, capture_type },
+        { "rotate-size", required_argument, nullptr, rotate_size },
+        { "rotate-time", required_argument, nullptr, rotate_time },
+        { "filter", required_argument, nullptr, filter },
+        { "filter-file", required_argument, nullptr, filter_file },
+        { "filter-check", no_argument, nullptr, filter_check },
+        { "stats", required_argument, nullptr, stats },
+        { "xdp", no_argument, nullptr, xdp },
+        { "xdp-native", no_argument, nullptr, xdp_native },
+        { "uring", no_argument, nullptr, uring },
+        { "vnet-hdr", no_argument, nullptr, vnet_hdr },
+        { "egress-depth", required_argument, nullptr, egress_depth },
+        { "egress-drop", required_argument, nullptr, egress_drop },
+        { "egress-sched", required_argument, nullptr, egress_sched },
+        { "egress-weights", required_argument, nullptr, egress_weights },
+        { "access", required_argument, nullptr, access },
+        { "trunk", required_argument, nullptr, trunk },
+        { "storm", required_argument, nullptr, storm },
+        { "busy-poll", optional_argument, nullptr, busy_poll },
+        { "cpus", required_argument, nullptr, cpus },
+        { "mlock", no_argument, nullptr, mlock },
+        { "hugepages", no_argument, nullptr, hugepages },
+        { "timestamps", no_argument, nullptr, timestamps },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    opts.verbose = true;
+    for (int c; (c = ::getopt_long(argc, argv, "qrtmw:", longopts, nullptr)) != -1;) {
+        switch (c) {
+            case 'q': opts.verbose = false; break;
+            case 'r': opts.rx_ring = true; break;
+            case 't': opts.tx_ring = true; break;
+            case 'm': opts.mmsg = true; break;
+            case ring_block_size: opts.ring.block_size = std::strtoul(optarg, nullptr, 0); break;
+            case ring_block_count: opts.ring.block_count = std::strtoul(optarg, nullptr, 0); break;
+            case ring_timeout: opts.ring.retire_timeout = static_cast<unsigned int>(std::strtoul(optarg, nullptr, 0)); break;
+            case batch_size: opts.batch_size = std::strtoul(optarg, nullptr, 0); break;
+            case fdb_size: opts.fdb_size = std::strtoul(optarg, nullptr, 0); break;
+            case fdb_aging: opts.fdb_aging = static_cast<srook::uint32_t>(std::strtoul(optarg, nullptr, 0)); break;
+            case mdb_size: opts.mdb_size = std::strtoul(optarg, nullptr, 0); break;
+            case mdb_aging: opts.mdb_aging = static_cast<srook::uint32_t>(std::strtoul(optarg, nullptr, 0)); break;
+            case 'w': opts.workers = std::strtoul(optarg, nullptr, 0); break;
+            case fanout:
+                if (!std::strcmp(optarg, "hash")) opts.fanout = PACKET_FANOUT_HASH;
+                else if (!std::strcmp(optarg, "cpu")) opts.fanout = PACKET_FANOUT_CPU;
+                else return false;
+                break;
+            case log_file: opts.log_file = optarg; break;
+            case log_ring: opts.log_ring = std::strtoul(optarg, nullptr, 0); break;
+            case capture: opts.capture.path = optarg; break;
+            case snaplen: opts.capture.snaplen = std::strtoul(optarg, nullptr, 0); break;
+            case capture_ring: opts.capture.ring = std::strtoul(optarg, nullptr, 0); break;
+            case capture_sample: opts.capture.sample = std::strtoul(optarg, nullptr, 0); break;
+            case capture_type: opts.capture.ethertype = static_cast<srook::uint16_t>(std::strtoul(optarg, nullptr, 0)); break;
+            case rotate_size: opts.capture.rotate_size = std::strtoul(optarg, nullptr, 0); break;
+            case rotate_time: opts.capture.rotate_seconds = static_cast<unsigned int>(std::strtoul(optarg, nullptr, 0)); break;
+            case filter: if (!opts.rules.add(optarg, std::cerr)) return false; break;
+            case filter_file: if (!opts.rules.load(optarg, std::cerr)) return false; break;
+            case filter_check: check = true; break;
+            case stats: opts.stats_path = optarg; break;
+            case xdp: opts.xdp = true; break;
+            case xdp_native: opts.xdp = opts.xdp_native = true; break;
+            case uring: opts.uring = true; break;
+            case vnet_hdr: opts.vnet_hdr = true; break;
+            case egress_depth: opts.egress.depth = std::strtoul(optarg, nullptr, 0); break;
+            case egress_drop:
+                if (!std::strcmp(optarg, "tail")) opts.egress.drop = toybridge::detail::egress_drop::tail;
+                else if (!std::strcmp(optarg, "lowest")) opts.egress.drop = toybridge::detail::egress_drop::lowest;
+                else return false;
+                break;
+            case egress_sched:
+                if (!std::strcmp(optarg, "strict")) opts.egress.sched = toybridge::detail::egress_sched::strict;
+                else if (!std::strcmp(optarg, "weighted")) opts.egress.sched = toybridge::detail::egress_sched::weighted;
+                else return false;
+                break;
+            case egress_weights:
+                if (!parse_weights(optarg, opts.egress.weights)) return false;
+                break;
+            case access: if (!opts.vlans.access(optarg, std::cerr)) return false; break;
+            case trunk: if (!opts.vlans.trunk(optarg, std::cerr)) return false; break;
+            case storm: if (!opts.storm.parse(optarg, std::cerr)) return false; break;
+            case busy_poll:
+                opts.busy_poll = optarg ? static_cast<unsigned int>(std::strtoul(optarg, nullptr, 0)) : 50;
+                if (!opts.busy_poll) return false;
+                break;
+            case cpus: if (!parse_cpus(optarg, opts.cpus)) return false; break;
+            case mlock: opts.lock_memory = true; break;
+            case hugepages: opts.hugepages = true; break;
+            case timestamps: opts.timestamps = true; break;
+            default: return false;
+        }
+    }
+    return opts.batch_size && opts.workers && opts.capture.sample;
+}
+
+int main(const int argc, char** const argv)
+{
+    toybridge::options opts;
+    bool check = false;
+    if (!parse_options(argc, argv, opts, check)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (check) {
+        opts.rules.disassemble(std::cout);
+        return opts.rules.self_test(std::cout) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (!opts.rules.empty()) {
+        std::ostringstream result;
+        if (!opts.rules.self_test(result)) {
+            std::cerr << result.str();
+            return EXIT_FAILURE;
+        }
+    }
+    if (!cmdarg_check(argc - optind, argv[0])) return EXIT_FAILURE;
 
-    toybridge::devinfo devs (argv[1], argv[2]);
-    toybridge::bridge br { devs };
-    br.flip_verbose();
-    br.run(std::cout);
+    toybridge::devinfo devs (argv + optind, argv + argc);
+    toybridge::bridge br { devs, opts };
+    const bool result = br.run(std::cout);
+    br.report(std::cerr);
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
 }
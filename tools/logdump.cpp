@@ -0,0 +1,42 @@
+// Copyright (C) 2011-2018 Roki. Distributed under the MIT License
+//
+// Turns a binary log written by toybridge --log-file back into the text the bridge prints.
+// Usage: logdump [-t] [file (default: stdin)]
+//   -t  prefix every record with its CLOCK_REALTIME timestamp
+#include <toybridge/detail/log.hpp>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+int main(const int argc, char** const argv)
+{
+    bool timestamps = false;
+    for (int c; (c = ::getopt(argc, argv, "t")) != -1;) {
+        if (c != 't') {
+            std::cerr << "Usage: " << argv[0] << " [-t] [file]" << std::endl;
+            return EXIT_FAILURE;
+        }
+        timestamps = true;
+    }
+
+    std::ifstream file;
+    if (optind < argc) file.open(argv[optind], std::ios::binary);
+    std::istream& is = optind < argc ? file : std::cin;
+
+    char magic[sizeof(toybridge::detail::log_magic)];
+    if (!is.read(magic, sizeof(magic)) || std::memcmp(magic, toybridge::detail::log_magic, sizeof(magic))) {
+        std::cerr << "not a toybridge log" << std::endl;
+        return EXIT_FAILURE;
+    }
+    for (toybridge::detail::log_record r; is.read(reinterpret_cast<char*>(&r), sizeof(r));) {
+        if (timestamps) std::cout << r.timestamp / 1000000000 << '.' << std::setw(9) << std::setfill('0') << r.timestamp % 1000000000 << std::setfill(' ') << ' ';
+        toybridge::detail::out(std::cout, r);
+    }
+    if (is.gcount()) {
+        std::cerr << "truncated record at the end" << std::endl;
+        return EXIT_FAILURE;
+    }
+}